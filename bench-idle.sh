@@ -0,0 +1,78 @@
+#!/bin/bash
+
+readonly TOOL="./build/tools/bench-latency"
+
+usage() {
+  echo "$0 <BINARY-PATH> <HOST-IPV4> <START-PORT> <SERVER-THREADS> <TOOL-THREADS> <TOOL-CONNS> <TOOL-REQS> <TOOL-DELAY> <SOURCE-ADDRS> <IDLE-CONNS>..."
+  echo "SOURCE-ADDRS are the local addresses of the connections, e.g. 127.0.0.2-127.0.0.41 for 1M connections"
+  exit 1
+}
+
+if [[ $# -lt 10 ]]; then
+  usage
+fi
+
+readonly BINARY_PATH="$1"
+readonly HOST_IPV4="$2"
+readonly START_PORT="$3"
+readonly SERVER_THREADS="$4"
+readonly TOOL_THREADS="$5"
+readonly TOOL_CONNS="$6"
+readonly TOOL_REQS="$7"
+readonly TOOL_DELAY="$8"
+readonly SOURCE_ADDRS="$9"
+shift 9
+readonly IDLE_CONNS=("$@")
+
+keys=("rss [KiB]" "rss per conn [B]" "pss per conn [B]" median "q 0.99" "q 0.999")
+
+# Both the server and the tool need a file descriptor per connection.
+ulimit -n "$(ulimit -Hn)"
+
+results=()
+for ((i = 0; i < ${#IDLE_CONNS[@]}; i++)); do
+  idle="${IDLE_CONNS[$i]}"
+
+  # Workaround for io_uring bug
+  PORT=$((START_PORT + i))
+
+  # for threads the last param needs to be removed:
+  # "$BINARY_PATH" "$HOST_IPV4" "$PORT" &>/dev/null &
+
+  "$BINARY_PATH" "$HOST_IPV4" "$PORT" "$SERVER_THREADS" &>/dev/null &
+  pid=$!
+  echo "Created server with pid $pid"
+
+  sleep 1
+
+  # The tool requires at least one idle connection with -I.
+  idle_args=()
+  if [[ $idle -gt 0 ]]; then
+    idle_args=(-I "$idle")
+  fi
+
+  result=$("$TOOL" -w "$TOOL_THREADS" -c "$TOOL_CONNS" -r "$TOOL_REQS" -d "$TOOL_DELAY" "${idle_args[@]}" -s "$SOURCE_ADDRS" -A -M "$pid" "$HOST_IPV4" "$PORT")
+
+  row=$(printf "%-10s" "$idle")
+  for key in "${keys[@]}"; do
+    value=$(echo "$result" | grep -F "$key:" | cut -d: -f2 | grep -Eo '[+-]?[0-9]+([.][0-9]+)?' | head -n1)
+    row+=$(printf " %16s" "$value")
+  done
+  echo "$row"
+  results+=("$row")
+
+  echo "Killing $pid"
+  if ! kill $pid; then
+    echo "Server failed"
+    exit 1
+  fi
+
+  wait
+done
+
+header=$(printf "%-10s" idle)
+for key in "${keys[@]}"; do
+  header+=$(printf " %16s" "$key")
+done
+echo "$header"
+printf "%s\n" "${results[@]}"
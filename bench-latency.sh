@@ -1,6 +1,8 @@
 #!/bin/bash
 
+readonly RUN="./build/tools/bench-run"
 readonly TOOL="./build/tools/bench-latency"
+readonly MERGE="./build/tools/hist-merge"
 
 usage() {
   echo "$0 <BINARY-PATH> <HOST-IPV4> <START-PORT> <SERVER-THREADS> <TOOL-THREADS> <TOOL-CONNS> <TOOL-REQS> <TOOL-DELAY> <WARMUP-ROUNDS> <NORMAL-ROUNDS>"
@@ -22,46 +24,26 @@ readonly TOOL_DELAY="$8"
 readonly WARMUP_ROUNDS="$9"
 readonly NORMAL_ROUNDS="${10}"
 
-keys=(mean median "q 0.9" "q 0.99" "q 0.999" "q 0.9999")
-
-declare -A total
-for key in "${keys[@]}"; do
-  total["$key"]=0
-done
-
-for ((i = 1; i <= $((WARMUP_ROUNDS + NORMAL_ROUNDS)); i++)); do
-  # Workaround for io_uring bug
-  PORT=$((START_PORT + i))
-
-  # for threads use:
-  # taskset -c 0-5 "$BINARY_PATH" "$HOST_IPV4" "$PORT" &>/dev/null &
-
-  "$BINARY_PATH" "$HOST_IPV4" "$PORT" "$SERVER_THREADS" &>/dev/null &
-  pid=$!
-  echo "Created server with pid $pid"
-
-  sleep 1
-
-  result=$("$TOOL" -w "$TOOL_THREADS" -c "$TOOL_CONNS" -r "$TOOL_REQS" -d "$TOOL_DELAY" "$HOST_IPV4" "$PORT")
-
-  if [[ $i -le $WARMUP_ROUNDS ]]; then
-    echo "$i/$WARMUP_ROUNDS warm up"
-  else
-    n=$((i - WARMUP_ROUNDS))
-    echo "$n/$NORMAL_ROUNDS"
-    for key in "${keys[@]}"; do
-      value=$(echo "$result" | grep "$key:" | grep -Eo '[+-]?[0-9]+([.][0-9]+)?' | tail -n1)
-      total["$key"]=$(echo "${total[$key]}" "$value" | awk '{ printf "%f", $1 + $2 }')
-      avg=$(echo "${total[$key]}" $n | awk '{ printf "%.02f", $1 / $2 }')
-      printf "%-12s cur=%-12.f avg=%-12.f\n" "$key:" "$value" "$avg"
-    done
-  fi
+# Quantiles cannot be averaged, the histograms of all measured rounds are merged instead.
+hist_dir=$(mktemp -d)
+trap 'rm -rf "$hist_dir"' EXIT
+
+# PARTITION=cores or PARTITION=smt pins the server and the tool to disjoint CPUs, see bench-run.
+partition_args=()
+server_cpus=()
+tool_cpus=()
+if [[ -n $PARTITION ]]; then
+  partition_args=(-p "$PARTITION")
+  server_cpus=("{server-cpus}")
+  tool_cpus=(-C "{tool-cpus}")
+fi
 
-  echo "Killing $pid"
-  if ! kill $pid; then
-    echo "Server failed"
-    exit 1
-  fi
+# for threads "$SERVER_THREADS" and "${server_cpus[@]}" need to be removed, the server takes no thread
+# count, bench-run still restricts it to its CPUs.
+"$RUN" -W "$WARMUP_ROUNDS" -m "$NORMAL_ROUNDS" -n "$NORMAL_ROUNDS" "${partition_args[@]}" -k mean -k median \
+  "$HOST_IPV4" "$START_PORT" "$BINARY_PATH" "$SERVER_THREADS" "${server_cpus[@]}" -- \
+  "$TOOL" -w "$TOOL_THREADS" "${tool_cpus[@]}" -c "$TOOL_CONNS" -r "$TOOL_REQS" -d "$TOOL_DELAY" \
+  -H "$hist_dir/{round}.hist" || exit 1
 
-  wait
-done
+echo
+"$MERGE" "$hist_dir"/[0-9]*.hist
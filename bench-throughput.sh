@@ -1,5 +1,6 @@
 #!/bin/bash
 
+readonly RUN="./build/tools/bench-run"
 readonly TOOL="./build/tools/bench-throughput"
 
 usage() {
@@ -21,36 +22,18 @@ readonly TOOL_REQS="$7"
 readonly WARMUP_ROUNDS="$8"
 readonly NORMAL_ROUNDS="$9"
 
-total=0
-for ((i = 1; i <= $((WARMUP_ROUNDS + NORMAL_ROUNDS)); i++)); do
-  # Workaround for io_uring bug
-  PORT=$((START_PORT + i))
-
-  # for threads the last param needs to be removed:
-  # "$BINARY_PATH" "$HOST_IPV4" "$PORT" &>/dev/null &
-
-  "$BINARY_PATH" "$HOST_IPV4" "$PORT" "$SERVER_THREADS" &>/dev/null &
-  pid=$!
-  echo "Created server with pid $pid"
-
-  sleep 1
-
-  reqs=$("$TOOL" -w "$TOOL_THREADS" -c "$TOOL_CONNS" -r "$TOOL_REQS" "$HOST_IPV4" "$PORT" | grep -Eo '[+-]?[0-9]+([.][0-9]+)?' | tail -n1)
-
-  if [[ $i -le $WARMUP_ROUNDS ]]; then
-    echo "$i/$WARMUP_ROUNDS warm up"
-  else
-    n=$((i - WARMUP_ROUNDS))
-    total=$(echo "$total" "$reqs" | awk '{ printf "%f", $1 + $2 }')
-    avg=$(echo "$total" $n | awk '{ printf "%.02f", $1 / $2 }')
-    echo "$n/$NORMAL_ROUNDS cur=$reqs avg=$avg"
-  fi
-
-  echo "Killing $pid"
-  if ! kill $pid; then
-    echo "Server failed"
-    exit 1
-  fi
+# PARTITION=cores or PARTITION=smt pins the server and the tool to disjoint CPUs, see bench-run.
+partition_args=()
+server_cpus=()
+tool_cpus=()
+if [[ -n $PARTITION ]]; then
+  partition_args=(-p "$PARTITION")
+  server_cpus=("{server-cpus}")
+  tool_cpus=(-C "{tool-cpus}")
+fi
 
-  wait
-done
+# for threads "$SERVER_THREADS" and "${server_cpus[@]}" need to be removed, the server takes no thread
+# count, bench-run still restricts it to its CPUs.
+exec "$RUN" -W "$WARMUP_ROUNDS" -m "$NORMAL_ROUNDS" -n "$NORMAL_ROUNDS" "${partition_args[@]}" -k rate \
+  "$HOST_IPV4" "$START_PORT" "$BINARY_PATH" "$SERVER_THREADS" "${server_cpus[@]}" -- \
+  "$TOOL" -w "$TOOL_THREADS" "${tool_cpus[@]}" -c "$TOOL_CONNS" -r "$TOOL_REQS"
@@ -32,6 +32,10 @@ cmake --build "$BUILD_DIR/asio" --config Release
 cmake -S "$SRC_DIR/frameworks/raw-epoll" -B "$BUILD_DIR/raw-epoll" -DCMAKE_BUILD_TYPE=Release
 cmake --build "$BUILD_DIR/raw-epoll" --config Release
 
+# raw-io_uring
+cmake -S "$SRC_DIR/frameworks/raw-io_uring" -B "$BUILD_DIR/raw-io_uring" -DCMAKE_BUILD_TYPE=Release
+cmake --build "$BUILD_DIR/raw-io_uring" --config Release
+
 # threads
 cmake -S "$SRC_DIR/frameworks/threads" -B "$BUILD_DIR/threads" -DCMAKE_BUILD_TYPE=Release
 cmake --build "$BUILD_DIR/threads" --config Release
@@ -43,6 +47,7 @@ cmake --build "$BUILD_DIR/libuv" --config Release
 # go
 go build -o "$BUILD_DIR/go/hello" "$SRC_DIR/frameworks/go/hello.go"
 go build -o "$BUILD_DIR/go/hello-timeout" "$SRC_DIR/frameworks/go/hello-timeout.go"
+go build -o "$BUILD_DIR/go/hello-sync" "$SRC_DIR/frameworks/go/hello-sync.go"
 
 # async-std
 cargo build --release --manifest-path "$SRC_DIR/frameworks/async-std/Cargo.toml" --target-dir "$BUILD_DIR/async-std"
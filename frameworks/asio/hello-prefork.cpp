@@ -1,6 +1,7 @@
 #include <sys/socket.h>
 
 #include <charconv>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -12,7 +13,13 @@
 
 #include <boost/asio.hpp>
 
-#define RESPONSE "HTTP/1.1 200 OK\nContent-Length: 12\n\nHello world!"
+#include "cpus.h"
+#include "requests.h"
+#include "responses.hpp"
+
+#ifdef WITH_WORK
+#include "work.h"
+#endif
 
 namespace {
 
@@ -39,19 +46,31 @@ private:
     auto self{shared_from_this()};
     socket_.async_read_some(
         boost::asio::buffer(data_, max_length),
-        [this, self](boost::system::error_code ec, std::size_t /*length*/) {
-          if (!ec)
-            do_write();
+        [this, self](boost::system::error_code ec, std::size_t length) {
+          if (ec)
+            return;
+
+          auto num_responses = count_requests(data_, length, &end_state_);
+          if (num_responses == 0)
+            do_read();
+          else
+            do_write(num_responses);
         });
   }
 
-  void do_write() {
+  void do_write(std::size_t num_responses) {
+#ifdef WITH_WORK
+    do_work(num_responses);
+#endif
+
     auto self{shared_from_this()};
     boost::asio::async_write(
-        socket_, boost::asio::const_buffer(RESPONSE, sizeof(RESPONSE) - 1),
-        [this, self](boost::system::error_code ec, std::size_t num_written) {
+        socket_,
+        boost::asio::buffer(responses.data(), num_responses * response_size),
+        [this, self, num_responses](boost::system::error_code ec,
+                                    std::size_t num_written) {
           if (!ec) {
-            if (num_written != sizeof(RESPONSE) - 1) {
+            if (num_written != num_responses * response_size) {
               std::cerr << "Writing to socket failed\n";
               std::exit(1);
             }
@@ -62,8 +81,10 @@ private:
   }
 
   tcp::socket socket_;
-  enum { max_length = 1024 };
   char data_[max_length];
+
+  // Number of matched bytes of REQUEST_END at the end of the last read.
+  std::uint8_t end_state_{0};
 };
 
 class server {
@@ -110,20 +131,40 @@ void worker(const boost::asio::ip::address &address, unsigned short port) {
 } // namespace
 
 int main(int argc, char *argv[]) {
-  if (argc != 4) {
-    std::cerr << "Usage: " << argv[0] << " <HOST-IPV4> <PORT> <NUM-THREADS>\n";
+  if (argc != 4 && argc != 5) {
+    std::cerr << "Usage: " << argv[0]
+              << " <HOST-IPV4> <PORT> <NUM-THREADS> [<CPU-LIST>]\n";
     return 1;
   }
 
   auto host = boost::asio::ip::make_address(argv[1]);
   auto port = parse_arg<unsigned short>(argv[2]);
   auto num_threads = parse_arg<std::size_t>(argv[3]);
+  cpu_list cpus{};
+  if (argc == 5 && !cpus_parse(&cpus, argv[4])) {
+    std::cerr << "Failed to parse CPU list '" << argv[4] << "'\n";
+    return 1;
+  }
+
+#ifdef WITH_WORK
+  const char *work_arg = std::getenv("WORK");
+  if (work_arg == nullptr)
+    work_arg = DEFAULT_WORK;
+  if (!parse_work(work_arg)) {
+    std::cerr << "Failed to parse WORK '" << work_arg << "'\n";
+    return 1;
+  }
+#endif
 
   std::vector<std::thread> threads;
   threads.reserve(num_threads);
 
-  for (std::size_t i = 0; i < num_threads; i++)
-    threads.push_back(std::thread{&worker, host, port});
+  for (std::size_t i = 0; i < num_threads; i++) {
+    threads.push_back(std::thread{[&cpus, i, host, port] {
+      cpus_pin_worker(&cpus, i);
+      worker(host, port);
+    }});
+  }
 
   for (auto &thread : threads)
     thread.join();
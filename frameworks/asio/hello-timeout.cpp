@@ -6,10 +6,14 @@
 #include <memory>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #include <boost/asio.hpp>
 
-#define RESPONSE "HTTP/1.1 200 OK\nContent-Length: 12\n\nHello world!"
+#include "cpus.h"
+#include "requests.h"
+#include "responses.hpp"
+
 #define TIMEOUT_SECS 5
 
 namespace {
@@ -58,29 +62,37 @@ private:
     auto self{shared_from_this()};
     socket_.async_read_some(
         boost::asio::buffer(data_, max_length),
-        [this, self](boost::system::error_code ec, std::size_t /*length*/) {
+        [this, self](boost::system::error_code ec, std::size_t length) {
           if (stopped())
             return;
 
-          if (!ec)
-            do_write();
-          else
+          if (ec) {
             stop();
+            return;
+          }
+
+          auto num_responses = count_requests(data_, length, &end_state_);
+          if (num_responses == 0)
+            do_read();
+          else
+            do_write(num_responses);
         });
   }
 
-  void do_write() {
+  void do_write(std::size_t num_responses) {
     write_deadline_.expires_after(std::chrono::seconds(TIMEOUT_SECS));
 
     auto self{shared_from_this()};
     boost::asio::async_write(
-        socket_, boost::asio::const_buffer(RESPONSE, sizeof(RESPONSE) - 1),
-        [this, self](boost::system::error_code ec, std::size_t num_written) {
+        socket_,
+        boost::asio::buffer(responses.data(), num_responses * response_size),
+        [this, self, num_responses](boost::system::error_code ec,
+                                    std::size_t num_written) {
           if (stopped())
             return;
 
           if (!ec) {
-            if (num_written != sizeof(RESPONSE) - 1) {
+            if (num_written != num_responses * response_size) {
               std::cerr << "Writing to socket failed\n";
               std::exit(1);
             }
@@ -109,8 +121,10 @@ private:
   tcp::socket socket_;
   steady_timer read_deadline_;
   steady_timer write_deadline_;
-  enum { max_length = 1024 };
   char data_[max_length];
+
+  // Number of matched bytes of REQUEST_END at the end of the last read.
+  std::uint8_t end_state_{0};
 };
 
 class server {
@@ -139,22 +153,33 @@ private:
 } // namespace
 
 int main(int argc, char *argv[]) {
-  if (argc != 4) {
-    std::cerr << "Usage: " << argv[0] << " <HOST-IPV4> <PORT> <NUM-THREADS>\n";
+  if (argc != 4 && argc != 5) {
+    std::cerr << "Usage: " << argv[0]
+              << " <HOST-IPV4> <PORT> <NUM-THREADS> [<CPU-LIST>]\n";
     return 1;
   }
 
   auto host = boost::asio::ip::make_address(argv[1]);
   auto port = parse_arg<unsigned short>(argv[2]);
   auto num_threads = parse_arg<int>(argv[3]);
+  cpu_list cpus{};
+  if (argc == 5 && !cpus_parse(&cpus, argv[4])) {
+    std::cerr << "Failed to parse CPU list '" << argv[4] << "'\n";
+    return 1;
+  }
 
   boost::asio::io_context io_context{num_threads};
   server s{io_context, host, port};
 
   for (int i = 1; i < num_threads; ++i) {
-    std::thread worker{[&io_context] { io_context.run(); }};
+    std::thread worker{[&io_context, &cpus, i] {
+      cpus_pin_worker(&cpus, static_cast<std::size_t>(i));
+      io_context.run();
+    }};
     worker.detach();
   }
 
+  // The main thread is the worker 0.
+  cpus_pin_worker(&cpus, 0);
   io_context.run();
 }
@@ -1,14 +1,29 @@
 #include <charconv>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <iterator>
 #include <memory>
+#include <mutex>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #include <boost/asio.hpp>
 
-#define RESPONSE "HTTP/1.1 200 OK\nContent-Length: 12\n\nHello world!"
+#include "cpus.h"
+#include "requests.h"
+#include "responses.hpp"
+
+#ifdef WITH_WORK
+#include "work.h"
+#endif
+
+#ifdef WITH_SYNC
+#include "sync.h"
+#endif
 
 namespace {
 
@@ -24,6 +39,37 @@ template <typename T> T parse_arg(const char *arg) {
   return value;
 }
 
+#ifdef WITH_SYNC
+// Kinds of SYNC, a mutex per counter, which blocks the thread, or a strand per
+// counter, so that the thread runs other handlers while waiting. Both take the
+// lock once for each request, as the other servers do, so the requests of
+// other connections can update the counter between pipelined requests.
+const char *const sync_kinds[] = {"mutex", "strand"};
+enum { sync_kind_mutex, sync_kind_strand };
+
+DEFINE_SYNC_SHARD(std::mutex);
+
+using sync_strand = boost::asio::strand<boost::asio::io_context::executor_type>;
+
+std::unique_ptr<sync_shard[]> sync_shards;
+std::vector<sync_strand> sync_strands;
+
+void init_sync(boost::asio::io_context &io_context) {
+  sync_shards = std::make_unique<sync_shard[]>(sync_num_locks);
+  if (sync_kind == sync_kind_strand) {
+    for (std::uint32_t i = 0; i < sync_num_locks; i++)
+      sync_strands.push_back(boost::asio::make_strand(io_context));
+  }
+}
+
+// Updates the counter for one request, the caller holds the mutex or runs in
+// the strand of the shard.
+void update_shard(sync_shard &shard) {
+  hold_lock();
+  shard.count++;
+}
+#endif
+
 class session : public std::enable_shared_from_this<session> {
 public:
   explicit session(tcp::socket socket) : socket_{std::move(socket)} {}
@@ -35,19 +81,75 @@ private:
     auto self{shared_from_this()};
     socket_.async_read_some(
         boost::asio::buffer(data_, max_length),
-        [this, self](boost::system::error_code ec, std::size_t /*length*/) {
-          if (!ec)
-            do_write();
+        [this, self](boost::system::error_code ec, std::size_t length) {
+          if (ec)
+            return;
+
+          auto num_responses = count_requests(data_, length, &end_state_);
+          if (num_responses == 0) {
+            do_read();
+            return;
+          }
+
+#ifdef WITH_SYNC
+          do_sync(num_responses);
+#else
+          do_write(num_responses);
+#endif
+        });
+  }
+
+#ifdef WITH_SYNC
+  // Updates the shared state once for each request, then writes the responses.
+  void do_sync(std::size_t num_responses) {
+    if (sync_kind == sync_kind_mutex) {
+      auto &shard = sync_shards[conn_no_ % sync_num_locks];
+      for (std::size_t i = 0; i < num_responses; i++) {
+        std::lock_guard<std::mutex> lock{shard.lock};
+        update_shard(shard);
+      }
+      do_write(num_responses);
+      return;
+    }
+
+    sync_in_strand(num_responses, num_responses);
+  }
+
+  // Posts one handler per request to the strand, which is released between
+  // them like the mutex. The write is posted back after the last one, so that
+  // the strand is not held by the send.
+  void sync_in_strand(std::size_t num_left, std::size_t num_responses) {
+    auto self{shared_from_this()};
+    auto shard_no = conn_no_ % sync_num_locks;
+    boost::asio::post(
+        sync_strands[shard_no],
+        [this, self, shard_no, num_left, num_responses] {
+          update_shard(sync_shards[shard_no]);
+          if (num_left > 1) {
+            sync_in_strand(num_left - 1, num_responses);
+            return;
+          }
+          boost::asio::post(socket_.get_executor(),
+                            [this, self, num_responses] {
+                              do_write(num_responses);
+                            });
         });
   }
+#endif
+
+  void do_write(std::size_t num_responses) {
+#ifdef WITH_WORK
+    do_work(num_responses);
+#endif
 
-  void do_write() {
     auto self{shared_from_this()};
     boost::asio::async_write(
-        socket_, boost::asio::const_buffer(RESPONSE, sizeof(RESPONSE) - 1),
-        [this, self](boost::system::error_code ec, std::size_t num_written) {
+        socket_,
+        boost::asio::buffer(responses.data(), num_responses * response_size),
+        [this, self, num_responses](boost::system::error_code ec,
+                                    std::size_t num_written) {
           if (!ec) {
-            if (num_written != sizeof(RESPONSE) - 1) {
+            if (num_written != num_responses * response_size) {
               std::cerr << "Writing to socket failed\n";
               std::exit(1);
             }
@@ -58,8 +160,14 @@ private:
   }
 
   tcp::socket socket_;
-  enum { max_length = 1024 };
   char data_[max_length];
+
+  // Number of matched bytes of REQUEST_END at the end of the last read.
+  std::uint8_t end_state_{0};
+
+#ifdef WITH_SYNC
+  std::uint32_t conn_no_{sync_next_conn()};
+#endif
 };
 
 class server {
@@ -88,22 +196,56 @@ private:
 } // namespace
 
 int main(int argc, char *argv[]) {
-  if (argc != 4) {
-    std::cerr << "Usage: " << argv[0] << " <HOST-IPV4> <PORT> <NUM-THREADS>\n";
+  if (argc != 4 && argc != 5) {
+    std::cerr << "Usage: " << argv[0]
+              << " <HOST-IPV4> <PORT> <NUM-THREADS> [<CPU-LIST>]\n";
     return 1;
   }
 
   auto host = boost::asio::ip::make_address(argv[1]);
   auto port = parse_arg<unsigned short>(argv[2]);
   auto num_threads = parse_arg<int>(argv[3]);
+  cpu_list cpus{};
+  if (argc == 5 && !cpus_parse(&cpus, argv[4])) {
+    std::cerr << "Failed to parse CPU list '" << argv[4] << "'\n";
+    return 1;
+  }
+
+#ifdef WITH_WORK
+  const char *work_arg = std::getenv("WORK");
+  if (work_arg == nullptr)
+    work_arg = DEFAULT_WORK;
+  if (!parse_work(work_arg)) {
+    std::cerr << "Failed to parse WORK '" << work_arg << "'\n";
+    return 1;
+  }
+#endif
+
+#ifdef WITH_SYNC
+  const char *sync_arg = std::getenv("SYNC");
+  if (sync_arg == nullptr)
+    sync_arg = DEFAULT_SYNC;
+  if (!parse_sync(sync_arg, sync_kinds, std::size(sync_kinds))) {
+    std::cerr << "Failed to parse SYNC '" << sync_arg << "'\n";
+    return 1;
+  }
+#endif
 
   boost::asio::io_context io_context{num_threads};
+#ifdef WITH_SYNC
+  init_sync(io_context);
+#endif
   server s{io_context, host, port};
 
   for (int i = 1; i < num_threads; ++i) {
-    std::thread worker{[&io_context] { io_context.run(); }};
+    std::thread worker{[&io_context, &cpus, i] {
+      cpus_pin_worker(&cpus, static_cast<std::size_t>(i));
+      io_context.run();
+    }};
     worker.detach();
   }
 
+  // The main thread is the worker 0.
+  cpus_pin_worker(&cpus, 0);
   io_context.run();
 }
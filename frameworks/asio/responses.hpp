@@ -0,0 +1,30 @@
+#ifndef ASYNC_BENCH_ASIO_RESPONSES_HPP
+#define ASYNC_BENCH_ASIO_RESPONSES_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+
+#include "requests.h"
+
+#define RESPONSE "HTTP/1.1 200 OK\nContent-Length: 12\n\nHello world!"
+
+namespace {
+
+constexpr std::size_t max_length = 1024;
+constexpr std::size_t max_batch = REQUEST_MAX_BATCH(max_length);
+constexpr std::size_t response_size = sizeof(RESPONSE) - 1;
+
+// The responses to a batch of pipelined requests are written with one send. The
+// responses are laid out one after another, as asio's composed writes gather
+// at most 16 buffers per call.
+const auto responses = [] {
+  std::array<char, max_batch * response_size> responses;
+  for (std::size_t i = 0; i < max_batch; i++)
+    std::memcpy(&responses[i * response_size], RESPONSE, response_size);
+  return responses;
+}();
+
+} // namespace
+
+#endif
@@ -0,0 +1,103 @@
+use async_std::net::TcpListener;
+use async_std::prelude::*;
+use async_std::sync::{Arc, Mutex};
+use async_std::task;
+use std::env;
+use std::net::{Ipv4Addr, SocketAddrV4};
+use std::time::{Duration, Instant};
+
+static RESPONSE: &[u8] = b"HTTP/1.1 200 OK\nContent-Length: 12\n\nHello world!";
+
+// Shared state if the SYNC environment variable is not set.
+static DEFAULT_SYNC: &str = "mutex:1:1000";
+
+// A lock and its counter, on their own cache line.
+#[repr(align(64))]
+struct Shard(Mutex<u64>);
+
+// Every request updates a shared counter, as taken from the SYNC environment variable described in
+// frameworks/common/sync.h. mutex guards each counter with an async mutex. async-std has no stable
+// semaphore, so sem is not supported.
+struct SyncState {
+    shards: Vec<Shard>,
+    hold: Duration,
+}
+
+impl SyncState {
+    fn parse(arg: &str) -> Option<SyncState> {
+        let mut parts = arg.split(':');
+        if parts.next()? != "mutex" {
+            return None;
+        }
+        let num_locks = parts.next()?.parse::<usize>().ok().filter(|&n| n != 0)?;
+        let hold = Duration::from_nanos(parts.next()?.parse::<u64>().ok()?);
+        if parts.next().is_some() {
+            return None;
+        }
+
+        let shards = (0..num_locks).map(|_| Shard(Mutex::new(0))).collect();
+        Some(SyncState { shards, hold })
+    }
+
+    // Updates the shared state for a request of the connection conn_no.
+    async fn update(&self, conn_no: usize) {
+        let mut count = self.shards[conn_no % self.shards.len()].0.lock().await;
+        let deadline = Instant::now() + self.hold;
+        while Instant::now() < deadline {}
+        *count += 1;
+    }
+}
+
+fn main() {
+    let ip = env::args().nth(1).unwrap().parse::<Ipv4Addr>().unwrap();
+    let port = env::args().nth(2).unwrap().parse::<u16>().unwrap();
+    let addr = SocketAddrV4::new(ip, port);
+
+    let num_threads = env::args().nth(3).unwrap().parse::<u32>().unwrap();
+    env::set_var("ASYNC_STD_THREAD_COUNT", num_threads.to_string());
+
+    let sync_arg = env::var("SYNC").unwrap_or_else(|_| DEFAULT_SYNC.to_string());
+    let sync = match SyncState::parse(&sync_arg) {
+        Some(sync) => Arc::new(sync),
+        None => panic!("Failed to parse SYNC '{}'", sync_arg),
+    };
+
+    task::block_on(async {
+        let listener = TcpListener::bind(&addr).await.unwrap();
+        for conn_no in 0.. {
+            let (mut stream, _) = listener.accept().await.unwrap();
+            let sync = sync.clone();
+            task::spawn(async move {
+                let mut buf = [0u8; 1024];
+                loop {
+                    let read_future = stream.read(&mut buf);
+                    let num_read = match read_future.await {
+                        Err(e) => {
+                            eprintln!("Reading failed: {:?}", e);
+                            return;
+                        }
+                        Ok(n) => n,
+                    };
+                    if num_read == 0 {
+                        return;
+                    }
+
+                    sync.update(conn_no).await;
+
+                    let write_future = stream.write(RESPONSE);
+                    match write_future.await {
+                        Err(e) => {
+                            eprintln!("Writing failed: {:?}", e);
+                            return;
+                        }
+                        Ok(n) => {
+                            if n != RESPONSE.len() {
+                                panic!("Writing failed")
+                            }
+                        }
+                    }
+                }
+            });
+        }
+    });
+}
@@ -0,0 +1,117 @@
+#ifndef ASYNC_BENCH_CPUS_H
+#define ASYNC_BENCH_CPUS_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* CPUs the workers are pinned to, the worker i runs on cpus[i % num_cpus]. */
+struct cpu_list {
+  unsigned *cpus;
+  size_t num_cpus;
+};
+
+static inline bool cpus_parse_cpu(const char *str, const char **end,
+                                  unsigned *cpu) {
+  char *p;
+  unsigned long value;
+
+  if (*str < '0' || *str > '9')
+    return false;
+  value = strtoul(str, &p, 10);
+  if (value >= CPU_SETSIZE)
+    return false;
+
+  *cpu = (unsigned)value;
+  *end = p;
+  return true;
+}
+
+/*
+ * Appends the CPUs of a list such as 0-5,12-17, as taken by taskset -c, to the
+ * list. Returns false if the list is malformed or allocating memory failed.
+ */
+static inline bool cpus_parse(struct cpu_list *list, const char *str) {
+  for (;;) {
+    unsigned first, last, *cpus;
+    size_t num_cpus;
+
+    if (!cpus_parse_cpu(str, &str, &first))
+      return false;
+    last = first;
+    if (*str == '-' && (!cpus_parse_cpu(str + 1, &str, &last) || last < first))
+      return false;
+    if (*str != ',' && *str != '\0')
+      return false;
+
+    num_cpus = list->num_cpus + (last - first) + 1;
+    cpus = (unsigned *)realloc(list->cpus, num_cpus * sizeof(*cpus));
+    if (cpus == NULL)
+      return false;
+    list->cpus = cpus;
+
+    for (unsigned cpu = first; cpu <= last; cpu++)
+      cpus[list->num_cpus++] = cpu;
+
+    if (*str == '\0')
+      return true;
+    str++;
+  }
+}
+
+/*
+ * Sets the affinity of the thread attributes to the CPU of the worker i, so
+ * that the thread starts there. Nothing is changed if the list is empty.
+ * Returns 0 or an error number.
+ */
+static inline int cpus_set_attr(const struct cpu_list *list, size_t i,
+                                pthread_attr_t *attr) {
+  cpu_set_t set;
+
+  if (list->num_cpus == 0)
+    return 0;
+
+  CPU_ZERO(&set);
+  CPU_SET(list->cpus[i % list->num_cpus], &set);
+  return pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+}
+
+/*
+ * Pins the calling thread to the CPU of the worker i, for threads started
+ * without attributes. Nothing is changed if the list is empty. Exits on
+ * failure.
+ */
+static inline void cpus_pin_worker(const struct cpu_list *list, size_t i) {
+  cpu_set_t set;
+  int ret;
+
+  if (list->num_cpus == 0)
+    return;
+
+  CPU_ZERO(&set);
+  CPU_SET(list->cpus[i % list->num_cpus], &set);
+  ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (ret != 0) {
+    fprintf(stderr, "Pinning thread failed: %s\n", strerror(ret));
+    exit(1);
+  }
+}
+
+/*
+ * Restricts the process to all CPUs of the list, for frameworks that start
+ * their workers themselves, which inherit the CPUs. Returns false on failure.
+ */
+static inline bool cpus_restrict(const struct cpu_list *list) {
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  for (size_t i = 0; i < list->num_cpus; i++)
+    CPU_SET(list->cpus[i], &set);
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef ASYNC_BENCH_REQUESTS_H
+#define ASYNC_BENCH_REQUESTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define REQUEST_END "\r\n\r\n"
+
+/*
+ * Most requests that end in a read of buf_size bytes. Each request ends with 4
+ * bytes, the first end can continue the last read.
+ */
+#define REQUEST_MAX_BATCH(buf_size)                                            \
+  (((buf_size) + sizeof(REQUEST_END) - 2) / (sizeof(REQUEST_END) - 1))
+
+/*
+ * Counts the requests that end in buf. Requests are not parsed, only the empty
+ * line ending their headers is searched for. end_state is the number of
+ * matched bytes of REQUEST_END at the end of the last read, 0 at first.
+ */
+static inline uint32_t count_requests(const void *buf, size_t len,
+                                      uint8_t *end_state) {
+  static const char end[] = REQUEST_END;
+  const unsigned char *bytes = (const unsigned char *)buf;
+  uint32_t count = 0;
+  uint8_t state = *end_state;
+
+  for (size_t i = 0; i < len; i++) {
+    if (bytes[i] == end[state]) {
+      if (++state == sizeof(end) - 1) {
+        count++;
+        state = 0;
+      }
+    } else {
+      state = bytes[i] == end[0];
+    }
+  }
+
+  *end_state = state;
+  return count;
+}
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef ASYNC_BENCH_SYNC_H
+#define ASYNC_BENCH_SYNC_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "clock.h"
+
+/*
+ * Every request of the hello-sync servers updates a shared counter, as taken
+ * from the SYNC environment variable: <KIND>:<NUM-LOCKS>:<HOLD-NS>. The
+ * connections are spread over NUM-LOCKS counters by their number, and each
+ * request holds the lock of its counter for HOLD-NS. The kinds are the locks
+ * of a server, mutex in all of them. For sem, NUM-LOCKS is the number of
+ * permits of one semaphore, which lets that many requests update one counter
+ * at once. Fewer locks or permits mean more contention.
+ */
+
+#ifdef __cplusplus
+#define SYNC_ALIGNAS(n) alignas(n)
+#else
+#define SYNC_ALIGNAS(n) _Alignas(n)
+#endif
+
+/* Shared state if the SYNC environment variable is not set. */
+#define DEFAULT_SYNC "mutex:1:1000"
+
+/* A lock of the given type and its counter, on their own cache line. */
+#define DEFINE_SYNC_SHARD(lock_type)                                           \
+  struct sync_shard {                                                          \
+    SYNC_ALIGNAS(64) lock_type lock;                                           \
+    uint64_t count;                                                            \
+  }
+
+/* Index of the kind in the kinds given to parse_sync(). */
+static size_t sync_kind;
+static uint32_t sync_num_locks;
+static uint64_t sync_hold_ns;
+
+/* Number of connections so far, a connection uses the lock of its number. */
+static uint32_t sync_num_conns;
+
+/*
+ * Parses the SYNC environment variable, with one of num_kinds kinds. Returns
+ * false if it is malformed.
+ */
+static inline bool parse_sync(const char *str, const char *const *kinds,
+                              size_t num_kinds) {
+  char kind[16], rest;
+
+  if (sscanf(str, "%15[a-z]:%" SCNu32 ":%" SCNu64 "%c", kind, &sync_num_locks,
+             &sync_hold_ns, &rest) != 3 ||
+      sync_num_locks == 0)
+    return false;
+
+  for (sync_kind = 0; sync_kind < num_kinds; sync_kind++) {
+    if (strcmp(kind, kinds[sync_kind]) == 0)
+      return true;
+  }
+  return false;
+}
+
+/* Returns the number of a new connection. */
+static inline uint32_t sync_next_conn(void) {
+  return __atomic_fetch_add(&sync_num_conns, 1, __ATOMIC_RELAXED);
+}
+
+/* Spins for HOLD-NS, the caller holds the lock of a counter. */
+static inline void hold_lock(void) {
+  uint64_t deadline_ns = get_current_ns() + sync_hold_ns;
+  while (get_current_ns() < deadline_ns)
+    ;
+}
+
+#endif
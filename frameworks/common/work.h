@@ -0,0 +1,100 @@
+#ifndef ASYNC_BENCH_WORK_H
+#define ASYNC_BENCH_WORK_H
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "clock.h"
+
+/*
+ * The service time model of the C and C++ hello-work servers. It is shared, so
+ * that every framework spins for the same distribution of service times.
+ */
+
+#ifdef __cplusplus
+#define WORK_THREAD_LOCAL thread_local
+#else
+#define WORK_THREAD_LOCAL _Thread_local
+#endif
+
+/* Service time of a request if the WORK environment variable is not set. */
+#define DEFAULT_WORK "exp:10000"
+
+/*
+ * Distribution of the service time of a request, taken from the WORK
+ * environment variable: fixed:<NS>, exp:<MEAN-NS> or
+ * bimodal:<NS>:<LONG-NS>:<LONG-SHARE>.
+ */
+static enum { WORK_FIXED, WORK_EXP, WORK_BIMODAL } work_kind;
+static double work_ns, work_long_ns, work_long_share;
+
+/* State of the xorshift64* generator of the thread, seeded on first use. */
+static WORK_THREAD_LOCAL uint64_t work_rng;
+
+/* Parses the WORK environment variable. Returns false if it is malformed. */
+static inline bool parse_work(const char *str) {
+  char rest;
+
+  if (sscanf(str, "fixed:%lf%c", &work_ns, &rest) == 1 && work_ns >= 0) {
+    work_kind = WORK_FIXED;
+    return true;
+  }
+  if (sscanf(str, "exp:%lf%c", &work_ns, &rest) == 1 && work_ns >= 0) {
+    work_kind = WORK_EXP;
+    return true;
+  }
+  if (sscanf(str, "bimodal:%lf:%lf:%lf%c", &work_ns, &work_long_ns,
+             &work_long_share, &rest) == 3 &&
+      work_ns >= 0 && work_long_ns >= 0 && work_long_share >= 0 &&
+      work_long_share <= 1) {
+    work_kind = WORK_BIMODAL;
+    return true;
+  }
+  return false;
+}
+
+/* Returns a uniformly distributed number in (0, 1]. */
+static inline double work_random_uniform(void) {
+  uint64_t x = work_rng;
+
+  if (x == 0)
+    x = (get_current_ns() ^ (uint64_t)(uintptr_t)&work_rng) | 1;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  work_rng = x;
+  return (double)(((x * 0x2545f4914f6cdd1dull) >> 11) + 1) * 0x1.0p-53;
+}
+
+static inline double work_draw_ns(void) {
+  switch (work_kind) {
+  case WORK_EXP:
+    return -work_ns * log(work_random_uniform());
+  case WORK_BIMODAL:
+    return work_random_uniform() <= work_long_share ? work_long_ns : work_ns;
+  case WORK_FIXED:
+  default:
+    return work_ns;
+  }
+}
+
+/*
+ * Spins for the service time of num_requests requests, so that the handler is
+ * CPU-bound and keeps its thread busy.
+ */
+static inline void do_work(size_t num_requests) {
+  double total_ns = 0;
+  uint64_t deadline_ns;
+
+  for (size_t i = 0; i < num_requests; i++)
+    total_ns += work_draw_ns();
+
+  deadline_ns = get_current_ns() + (uint64_t)total_ns;
+  while (get_current_ns() < deadline_ns)
+    ;
+}
+
+#endif
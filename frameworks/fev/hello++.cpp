@@ -5,12 +5,27 @@
 #include <charconv>
 #include <chrono>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <iterator>
+#include <memory>
 #include <system_error>
 
 #include <fev/fev++.hpp>
+#include <fev/fev.h>
+
+#include "cpus.h"
+#include "requests.h"
+
+#ifdef WITH_WORK
+#include "work.h"
+#endif
+
+#ifdef WITH_SYNC
+#include "sync.h"
+#endif
 
 #define RESPONSE "HTTP/1.1 200 OK\nContent-Length: 12\n\nHello world!"
 #define LISTEN_BACKLOG 1024
@@ -18,10 +33,94 @@
 
 namespace {
 
+constexpr std::size_t response_size = sizeof(RESPONSE) - 1;
+constexpr std::size_t buffer_size = 1024;
+
+// Most responses written at once.
+constexpr std::size_t max_batch = REQUEST_MAX_BATCH(buffer_size);
+
 struct sockaddr_in server_addr;
 
+// The responses to a batch of pipelined requests are written with one write.
+// fev sockets have no vectored write, so the responses are laid out one after
+// another.
+char responses[max_batch * response_size];
+
+#ifdef WITH_SYNC
+// Kinds of SYNC, a fev mutex per counter or one fev semaphore.
+const char *const sync_kinds[] = {"mutex", "sem"};
+enum { sync_kind_mutex, sync_kind_sem };
+
+DEFINE_SYNC_SHARD(fev_mutex *);
+
+std::unique_ptr<sync_shard[]> sync_shards;
+fev_sem *sync_sem;
+
+void init_sync() {
+  std::size_t num_shards = sync_kind == sync_kind_mutex ? sync_num_locks : 1;
+
+  if (sync_kind == sync_kind_sem && sync_num_locks > INT32_MAX) {
+    std::cerr << "Too many permits in SYNC\n";
+    std::exit(1);
+  }
+
+  sync_shards = std::make_unique<sync_shard[]>(num_shards);
+  for (std::size_t i = 0; i < num_shards; i++) {
+    if (fev_mutex_create(&sync_shards[i].lock) != 0) {
+      std::cerr << "Creating mutex failed\n";
+      std::exit(1);
+    }
+  }
+
+  if (sync_kind == sync_kind_sem &&
+      fev_sem_create(&sync_sem, static_cast<std::int32_t>(sync_num_locks)) !=
+          0) {
+    std::cerr << "Creating semaphore failed\n";
+    std::exit(1);
+  }
+}
+
+// Updates the shared state once for each of num_requests requests.
+void do_sync(std::uint32_t conn_no, std::size_t num_requests) {
+  for (std::size_t i = 0; i < num_requests; i++) {
+    if (sync_kind == sync_kind_mutex) {
+      auto &shard = sync_shards[conn_no % sync_num_locks];
+      fev_mutex_lock(shard.lock);
+      hold_lock();
+      shard.count++;
+      fev_mutex_unlock(shard.lock);
+    } else {
+      fev_sem_wait(sync_sem);
+      hold_lock();
+      __atomic_add_fetch(&sync_shards[0].count, 1, __ATOMIC_RELAXED);
+      fev_sem_post(sync_sem);
+    }
+  }
+}
+#endif
+
+// Restricts the process to a list of CPUs such as 0-5,12-17, as taken by
+// taskset -c. libfev starts its workers itself, they inherit the CPUs.
+void restrict_cpus(const char *arg) {
+  cpu_list list{};
+
+  if (!cpus_parse(&list, arg)) {
+    std::cerr << "Parsing CPU list failed\n";
+    std::exit(1);
+  }
+  if (!cpus_restrict(&list)) {
+    std::cerr << "Restricting to CPU list failed\n";
+    std::exit(1);
+  }
+  std::free(list.cpus);
+}
+
 void hello(fev::socket &&socket) try {
-  char buffer[1024];
+  char buffer[buffer_size];
+  std::uint8_t end_state = 0;
+#ifdef WITH_SYNC
+  auto conn_no = sync_next_conn();
+#endif
 
   for (;;) {
 
@@ -35,14 +134,28 @@ void hello(fev::socket &&socket) try {
     if (num_read == 0)
       break;
 
+    std::size_t num_responses = count_requests(buffer, num_read, &end_state);
+    if (num_responses == 0)
+      continue;
+
+#ifdef WITH_WORK
+    do_work(num_responses);
+#endif
+
+#ifdef WITH_SYNC
+    do_sync(conn_no, num_responses);
+#endif
+
+    std::size_t size = num_responses * response_size;
+
 #ifdef WITH_TIMEOUT
     std::size_t num_written = socket.try_write_for(
-        RESPONSE, sizeof(RESPONSE) - 1, std::chrono::seconds(TIMEOUT_SECS));
+        responses, size, std::chrono::seconds(TIMEOUT_SECS));
 #else
-    std::size_t num_written = socket.write(RESPONSE, sizeof(RESPONSE) - 1);
+    std::size_t num_written = socket.write(responses, size);
 #endif
 
-    if (num_written != sizeof(RESPONSE) - 1) {
+    if (num_written != size) {
       std::cerr << "Writing to socket failed\n";
       std::exit(1);
     }
@@ -69,8 +182,9 @@ void acceptor() {
 int main(int argc, char **argv) {
   // Parse arguments.
 
-  if (argc != 4) {
-    std::cerr << "Usage: " << argv[0] << " <HOST-IPV4> <PORT> <NUM-WORKERS>\n";
+  if (argc != 4 && argc != 5) {
+    std::cerr << "Usage: " << argv[0]
+              << " <HOST-IPV4> <PORT> <NUM-WORKERS> [<CPU-LIST>]\n";
     return 1;
   }
 
@@ -92,6 +206,29 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  if (argc == 5)
+    restrict_cpus(argv[4]);
+
+#ifdef WITH_WORK
+  const char *work_arg = std::getenv("WORK");
+  if (work_arg == nullptr)
+    work_arg = DEFAULT_WORK;
+  if (!parse_work(work_arg)) {
+    std::cerr << "Failed to parse WORK '" << work_arg << "'\n";
+    return 1;
+  }
+#endif
+
+#ifdef WITH_SYNC
+  auto sync_arg = std::getenv("SYNC");
+  if (!parse_sync(sync_arg != nullptr ? sync_arg : DEFAULT_SYNC, sync_kinds,
+                  std::size(sync_kinds))) {
+    std::cerr << "Parsing SYNC failed\n";
+    return 1;
+  }
+  init_sync();
+#endif
+
   // Initialize server address.
 
   server_addr.sin_family = AF_INET;
@@ -101,6 +238,11 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  // Initialize responses.
+
+  for (std::size_t i = 0; i < max_batch; i++)
+    std::memcpy(&responses[i * response_size], RESPONSE, response_size);
+
   // Run.
 
   fev::sched_attr sched_attr{};
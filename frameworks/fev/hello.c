@@ -1,7 +1,9 @@
 #include <arpa/inet.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <netinet/in.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,15 +13,106 @@
 
 #include <fev/fev.h>
 
+#include "cpus.h"
+#include "requests.h"
+
+#ifdef WITH_WORK
+#include "work.h"
+#endif
+
+#ifdef WITH_SYNC
+#include "sync.h"
+#endif
+
 #define RESPONSE "HTTP/1.1 200 OK\nContent-Length: 12\n\nHello world!"
+#define RESPONSE_SIZE (sizeof(RESPONSE) - 1)
 #define LISTEN_BACKLOG 1024
 #define TIMEOUT_SECS 5
+#define BUF_SIZE 1024
+
+/* Most responses written at once. */
+#define MAX_BATCH REQUEST_MAX_BATCH(BUF_SIZE)
 
 static struct sockaddr_in server_addr;
 
+/*
+ * The responses to a batch of pipelined requests are written with one write.
+ * fev sockets have no vectored write, so the responses are laid out one after
+ * another.
+ */
+static char responses[MAX_BATCH * RESPONSE_SIZE];
+
+#ifdef WITH_SYNC
+/* Kinds of SYNC, a fev mutex per counter or one fev semaphore. */
+static const char *const sync_kinds[] = {"mutex", "sem"};
+enum { SYNC_MUTEX, SYNC_SEM };
+
+static DEFINE_SYNC_SHARD(struct fev_mutex *) *sync_shards;
+static struct fev_sem *sync_sem;
+
+static int init_sync(void) {
+  size_t num_shards = sync_kind == SYNC_MUTEX ? sync_num_locks : 1;
+  int err;
+
+  if (sync_kind == SYNC_SEM && sync_num_locks > INT32_MAX)
+    return -EINVAL;
+
+  sync_shards = aligned_alloc(_Alignof(struct sync_shard),
+                              num_shards * sizeof(*sync_shards));
+  if (sync_shards == NULL)
+    return -ENOMEM;
+
+  for (size_t i = 0; i < num_shards; i++) {
+    err = fev_mutex_create(&sync_shards[i].lock);
+    if (err != 0)
+      return err;
+    sync_shards[i].count = 0;
+  }
+
+  if (sync_kind == SYNC_SEM)
+    return fev_sem_create(&sync_sem, (int32_t)sync_num_locks);
+  return 0;
+}
+
+/* Updates the shared state once for each of num_requests requests. */
+static void do_sync(uint32_t conn_no, uint32_t num_requests) {
+  for (uint32_t i = 0; i < num_requests; i++) {
+    if (sync_kind == SYNC_MUTEX) {
+      struct sync_shard *shard = &sync_shards[conn_no % sync_num_locks];
+
+      fev_mutex_lock(shard->lock);
+      hold_lock();
+      shard->count++;
+      fev_mutex_unlock(shard->lock);
+    } else {
+      fev_sem_wait(sync_sem);
+      hold_lock();
+      __atomic_add_fetch(&sync_shards[0].count, 1, __ATOMIC_RELAXED);
+      fev_sem_post(sync_sem);
+    }
+  }
+}
+#endif
+
+/*
+ * Restricts the process to a list of CPUs such as 0-5,12-17, as taken by
+ * taskset -c. libfev starts its workers itself, they inherit the CPUs.
+ */
+static bool restrict_cpus(const char *str) {
+  struct cpu_list list = {NULL, 0};
+  bool ok = cpus_parse(&list, str) && cpus_restrict(&list);
+
+  free(list.cpus);
+  return ok;
+}
+
 static void *hello(void *arg) {
-  char buffer[1024];
+  char buffer[BUF_SIZE];
   struct fev_socket *socket = arg;
+  uint8_t end_state = 0;
+#ifdef WITH_SYNC
+  uint32_t conn_no = sync_next_conn();
+#endif
 
 #ifdef WITH_TIMEOUT
   const struct timespec ts = {
@@ -30,6 +123,8 @@ static void *hello(void *arg) {
 
   for (;;) {
     ssize_t num_read, num_written;
+    uint32_t num_responses;
+    size_t size;
 
 #ifdef WITH_TIMEOUT
     num_read = fev_socket_try_read_for(socket, buffer, sizeof(buffer), &ts);
@@ -45,14 +140,27 @@ static void *hello(void *arg) {
       break;
     }
 
+    num_responses = count_requests(buffer, (size_t)num_read, &end_state);
+    if (num_responses == 0)
+      continue;
+
+#ifdef WITH_WORK
+    do_work(num_responses);
+#endif
+
+#ifdef WITH_SYNC
+    do_sync(conn_no, num_responses);
+#endif
+
+    size = num_responses * RESPONSE_SIZE;
+
 #ifdef WITH_TIMEOUT
-    num_written =
-        fev_socket_try_write_for(socket, RESPONSE, sizeof(RESPONSE) - 1, &ts);
+    num_written = fev_socket_try_write_for(socket, responses, size, &ts);
 #else
-    num_written = fev_socket_write(socket, RESPONSE, sizeof(RESPONSE) - 1);
+    num_written = fev_socket_write(socket, responses, size);
 #endif
 
-    if (num_written != sizeof(RESPONSE) - 1) {
+    if (num_written != (ssize_t)size) {
       fputs("Writing to socket failed\n", stderr);
       exit(1);
     }
@@ -144,11 +252,18 @@ int main(int argc, char **argv) {
   uint32_t num_workers;
   uint16_t port;
   int err, ret = 1;
+#ifdef WITH_WORK
+  const char *work;
+#endif
+#ifdef WITH_SYNC
+  const char *sync_arg;
+#endif
 
   /* Parse arguments. */
 
-  if (argc != 4) {
-    fprintf(stderr, "Usage: %s <HOST-IPV4> <PORT> <NUM-WORKERS>\n", argv[0]);
+  if (argc != 4 && argc != 5) {
+    fprintf(stderr, "Usage: %s <HOST-IPV4> <PORT> <NUM-WORKERS> [<CPU-LIST>]\n",
+            argv[0]);
     return 1;
   }
 
@@ -164,6 +279,33 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  if (argc == 5 && !restrict_cpus(argv[4])) {
+    fputs("Restricting to CPU list failed\n", stderr);
+    return 1;
+  }
+
+#ifdef WITH_WORK
+  work = getenv("WORK");
+  if (!parse_work(work != NULL ? work : DEFAULT_WORK)) {
+    fputs("Parsing WORK failed\n", stderr);
+    return 1;
+  }
+#endif
+
+#ifdef WITH_SYNC
+  sync_arg = getenv("SYNC");
+  if (!parse_sync(sync_arg != NULL ? sync_arg : DEFAULT_SYNC, sync_kinds,
+                  sizeof(sync_kinds) / sizeof(sync_kinds[0]))) {
+    fputs("Parsing SYNC failed\n", stderr);
+    return 1;
+  }
+  err = init_sync();
+  if (err != 0) {
+    fprintf(stderr, "Initializing SYNC failed: %s\n", strerror(-err));
+    return 1;
+  }
+#endif
+
   /* Initialize server address. */
 
   server_addr.sin_family = AF_INET;
@@ -173,6 +315,11 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  /* Initialize responses. */
+
+  for (size_t i = 0; i < MAX_BATCH; i++)
+    memcpy(&responses[i * RESPONSE_SIZE], RESPONSE, RESPONSE_SIZE);
+
   /* Initialize scheduler. */
 
   err = fev_sched_attr_create(&attr);
@@ -0,0 +1,149 @@
+package main
+
+import (
+	"bufio"
+	"fmt"
+	"log"
+	"net"
+	"os"
+	"runtime"
+	"strconv"
+	"sync"
+	"sync/atomic"
+	"time"
+)
+
+var response = []byte("HTTP/1.1 200 OK\nContent-Length: 12\n\nHello world!")
+
+// Shared state if the SYNC environment variable is not set.
+const defaultSync = "mutex:1:1000"
+
+// A lock and its counter, padded to their own cache line.
+type syncShard struct {
+	mutex sync.Mutex
+	count uint64
+	_     [64 - 16]byte
+}
+
+// Every request updates a shared counter, as taken from the SYNC environment
+// variable described in frameworks/common/sync.h. mutex guards each counter
+// with a sync.Mutex, and sem guards one counter with a buffered channel as the
+// semaphore.
+var (
+	syncShards []syncShard
+	syncSem    chan struct{}
+	syncHold   time.Duration
+	numConns   uint32
+)
+
+func parseSync(arg string) bool {
+	var kind, rest string
+	var numLocks uint32
+	var holdNs int64
+
+	n, _ := fmt.Sscanf(arg, "mutex:%d:%d%s", &numLocks, &holdNs, &rest)
+	if n == 2 {
+		kind = "mutex"
+	} else if n, _ = fmt.Sscanf(arg, "sem:%d:%d%s", &numLocks, &holdNs, &rest); n == 2 {
+		kind = "sem"
+	}
+	if kind == "" || numLocks == 0 || holdNs < 0 {
+		return false
+	}
+
+	syncHold = time.Duration(holdNs)
+	if kind == "mutex" {
+		syncShards = make([]syncShard, numLocks)
+	} else {
+		syncShards = make([]syncShard, 1)
+		syncSem = make(chan struct{}, numLocks)
+	}
+	return true
+}
+
+func holdLock() {
+	deadline := time.Now().Add(syncHold)
+	for time.Now().Before(deadline) {
+	}
+}
+
+// Updates the shared state for a request of the connection connNo.
+func doSync(connNo uint32) {
+	if syncSem == nil {
+		shard := &syncShards[connNo%uint32(len(syncShards))]
+		shard.mutex.Lock()
+		holdLock()
+		shard.count++
+		shard.mutex.Unlock()
+	} else {
+		syncSem <- struct{}{}
+		holdLock()
+		atomic.AddUint64(&syncShards[0].count, 1)
+		<-syncSem
+	}
+}
+
+func hello(conn net.Conn) {
+	reader := bufio.NewReader(conn)
+	buf := make([]byte, 1024)
+	connNo := atomic.AddUint32(&numConns, 1)
+
+	for {
+		_, err := reader.Read(buf)
+		if err != nil {
+			log.Printf("Reading failed: %s", err)
+			break
+		}
+
+		doSync(connNo)
+
+		numWritten, err := conn.Write(response)
+		if err != nil {
+			log.Printf("Writing failed: %s", err)
+			break
+		}
+		if numWritten != len(response) {
+			log.Fatalln("Writing failed")
+		}
+	}
+
+	conn.Close()
+}
+
+func main() {
+	if len(os.Args) != 4 {
+		log.Fatalf("Usage: %s <HOST-IPV4> <PORT> <GOMAXPROCS>", os.Args[0])
+	}
+
+	// TODO: Add some validation.
+	host := os.Args[1]
+	port := os.Args[2]
+
+	maxProcs, err := strconv.Atoi(os.Args[3])
+	if err != nil {
+		log.Fatalf("Failed to parse max procs: %s", err)
+	}
+
+	syncArg, ok := os.LookupEnv("SYNC")
+	if !ok {
+		syncArg = defaultSync
+	}
+	if !parseSync(syncArg) {
+		log.Fatalf("Failed to parse SYNC '%s'", syncArg)
+	}
+
+	runtime.GOMAXPROCS(maxProcs)
+
+	l, err := net.Listen("tcp", host+":"+port)
+	if err != nil {
+		log.Fatalf("Listening failed: %s", err)
+	}
+
+	for {
+		conn, err := l.Accept()
+		if err != nil {
+			log.Fatalf("Accepting failed: %s", err)
+		}
+		go hello(conn)
+	}
+}
@@ -1,70 +1,213 @@
 #include <assert.h>
 #include <inttypes.h>
 #include <pthread.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <uv.h>
 
+#include "cpus.h"
+#include "requests.h"
+
+#ifdef WITH_WORK
+#include "work.h"
+#endif
+
 #define RESPONSE "HTTP/1.1 200 OK\nContent-Length: 12\n\nHello world!"
 #define LISTEN_BACKLOG 1024
+#define TIMEOUT_SECS 5
 #define BUF_SIZE 1024
 
+/* Number of clients allocated at once when the free list of a loop is empty. */
+#define CLIENTS_PER_CHUNK 256
+
+/* Most responses written at once. */
+#define MAX_BATCH REQUEST_MAX_BATCH(BUF_SIZE)
+
 static struct sockaddr_in server_addr;
 
+/* CPUs the workers are pinned to. */
+static struct cpu_list cpus;
+
 static _Thread_local uv_loop_t *cur_loop;
 
-static const uv_buf_t response_buf[] = {{
-    .base = RESPONSE,
-    .len = sizeof(RESPONSE) - 1,
-}};
+/* The responses to a batch of pipelined requests are written with writev(). */
+static uv_buf_t response_bufs[MAX_BATCH];
 
-static void on_close(uv_handle_t *handle) { free(handle); }
+/*
+ * A client embeds everything a connection needs, so that nothing is allocated
+ * per read or write. Clients are taken from a free list of the loop and
+ * returned to it once all their handles are closed.
+ */
+struct client {
+  uv_tcp_t tcp;
 
-static void on_write(uv_write_t *req, int status) {
-  if (status != 0) {
-    fprintf(stderr, "Writing failed: %s\n", uv_strerror(status));
-  }
+#ifdef WITH_TIMEOUT
+  /* Closes the connection if the current read or write takes too long. */
+  uv_timer_t timer;
+#endif
 
-  free(req);
-}
+  /* The only write in flight, later responses wait until it completes. */
+  uv_write_t write_req;
+  bool writing;
 
-static void on_read(uv_stream_t *client, ssize_t num_read,
-                    const uv_buf_t *buf) {
-  free(buf->base);
+  /* Number of responses to write after the write in flight. */
+  uint32_t num_pending;
+
+  /* Number of handles that are not closed yet. */
+  uint8_t num_handles;
 
-  if (num_read > 0) {
-    uv_write_t *req = malloc(sizeof(*req));
-    if (req == NULL) {
-      fputs("Allocating memory for write req failed\n", stderr);
+  /* Number of matched bytes of REQUEST_END at the end of the last read. */
+  uint8_t end_state;
+
+  /* The next client in the free list. */
+  struct client *next_free;
+
+  char buf[BUF_SIZE];
+};
+
+static _Thread_local struct client *free_clients;
+
+static struct client *alloc_client(void) {
+  struct client *client;
+
+  if (free_clients == NULL) {
+    struct client *chunk = malloc(CLIENTS_PER_CHUNK * sizeof(*chunk));
+    if (chunk == NULL) {
+      fputs("Allocating memory for clients failed\n", stderr);
       exit(1);
     }
 
-    uv_write(req, client, response_buf, 1, on_write);
+    for (size_t i = 0; i < CLIENTS_PER_CHUNK; i++) {
+      chunk[i].next_free = free_clients;
+      free_clients = &chunk[i];
+    }
+  }
+
+  client = free_clients;
+  free_clients = client->next_free;
+  return client;
+}
+
+static void on_close(uv_handle_t *handle) {
+  struct client *client = handle->data;
+
+  if (--client->num_handles == 0) {
+    client->next_free = free_clients;
+    free_clients = client;
+  }
+}
+
+static void close_client(struct client *client) {
+  if (uv_is_closing((uv_handle_t *)&client->tcp))
     return;
+
+  uv_close((uv_handle_t *)&client->tcp, on_close);
+#ifdef WITH_TIMEOUT
+  uv_close((uv_handle_t *)&client->timer, on_close);
+#endif
+}
+
+#ifdef WITH_TIMEOUT
+static void on_timeout(uv_timer_t *timer) { close_client(timer->data); }
+
+/* Gives the next read or write of the client TIMEOUT_SECS to complete. */
+static void restart_timer(struct client *client) {
+  int ret = uv_timer_start(&client->timer, on_timeout,
+                           (uint64_t)TIMEOUT_SECS * 1000, /*repeat=*/0);
+  if (ret != 0) {
+    fprintf(stderr, "Starting timer failed: %s\n", uv_strerror(ret));
+    exit(1);
   }
+}
+#endif
+
+static void on_write(uv_write_t *req, int status);
+
+static void start_write(struct client *client) {
+  uint32_t num_responses =
+      client->num_pending < MAX_BATCH ? client->num_pending : MAX_BATCH;
+  int ret;
+
+  client->num_pending -= num_responses;
+  client->writing = true;
+
+  ret = uv_write(&client->write_req, (uv_stream_t *)&client->tcp,
+                 response_bufs, num_responses, on_write);
+  if (ret != 0) {
+    fprintf(stderr, "Writing failed: %s\n", uv_strerror(ret));
+    exit(1);
+  }
+}
+
+static void on_write(uv_write_t *req, int status) {
+  struct client *client = req->data;
+
+  client->writing = false;
+
+  if (status != 0) {
+    if (status != UV_ECANCELED)
+      fprintf(stderr, "Writing failed: %s\n", uv_strerror(status));
+    close_client(client);
+    return;
+  }
+
+#ifdef WITH_TIMEOUT
+  restart_timer(client);
+#endif
+
+  if (client->num_pending != 0)
+    start_write(client);
+}
+
+static void on_read(uv_stream_t *stream, ssize_t num_read,
+                    const uv_buf_t *buf) {
+  struct client *client = stream->data;
+  uint32_t num_responses;
 
   if (num_read < 0) {
     if (num_read != UV_EOF)
       fprintf(stderr, "Reading failed: %s\n", uv_strerror((int)num_read));
-
-    uv_close((uv_handle_t *)client, on_close);
+    close_client(client);
+    return;
   }
+
+#ifdef WITH_TIMEOUT
+  if (num_read > 0)
+    restart_timer(client);
+#endif
+
+  num_responses =
+      count_requests(buf->base, (size_t)num_read, &client->end_state);
+  if (num_responses == 0)
+    return;
+
+#ifdef WITH_WORK
+  do_work(num_responses);
+#endif
+
+  client->num_pending += num_responses;
+  if (!client->writing)
+    start_write(client);
 }
 
+/* Reads always go to the buffer of the client, each is handled at once. */
 static void alloc_buffer(uv_handle_t *handle, size_t suggested_size,
                          uv_buf_t *buf) {
-  (void)handle;
+  struct client *client = handle->data;
+
   (void)suggested_size;
 
-  buf->base = malloc(BUF_SIZE);
-  buf->len = BUF_SIZE;
+  buf->base = client->buf;
+  buf->len = sizeof(client->buf);
 }
 
 static void on_new_connection(uv_stream_t *server, int status) {
-  uv_tcp_t *client;
+  struct client *client;
   int ret;
 
   if (status < 0) {
@@ -72,26 +215,39 @@ static void on_new_connection(uv_stream_t *server, int status) {
     exit(1);
   }
 
-  client = malloc(sizeof(*client));
-  if (client == NULL) {
-    fputs("Allocating memory for client failed\n", stderr);
-    exit(1);
-  }
+  client = alloc_client();
+  client->writing = false;
+  client->num_pending = 0;
+  client->num_handles = 1;
+  client->end_state = 0;
 
-  ret = uv_tcp_init(cur_loop, client);
+  ret = uv_tcp_init(cur_loop, &client->tcp);
   if (ret != 0) {
     fprintf(stderr, "Initializing tcp connection failed: %s\n",
             uv_strerror(ret));
     exit(1);
   }
+  client->tcp.data = client;
+  client->write_req.data = client;
 
-  ret = uv_accept(server, (uv_stream_t *)client);
+  ret = uv_accept(server, (uv_stream_t *)&client->tcp);
   if (ret != 0) {
     fprintf(stderr, "Accepting failed: %s\n", uv_strerror(ret));
     exit(1);
   }
 
-  ret = uv_read_start((uv_stream_t *)client, alloc_buffer, on_read);
+#ifdef WITH_TIMEOUT
+  ret = uv_timer_init(cur_loop, &client->timer);
+  if (ret != 0) {
+    fprintf(stderr, "Initializing timer failed: %s\n", uv_strerror(ret));
+    exit(1);
+  }
+  client->timer.data = client;
+  client->num_handles++;
+  restart_timer(client);
+#endif
+
+  ret = uv_read_start((uv_stream_t *)&client->tcp, alloc_buffer, on_read);
   if (ret != 0) {
     fprintf(stderr, "Starting to read failed: %s\n", uv_strerror(ret));
     exit(1);
@@ -153,11 +309,15 @@ int main(int argc, char **argv) {
   const char *host;
   uint16_t port;
   size_t num_threads;
+#ifdef WITH_WORK
+  const char *work;
+#endif
 
   /* Parse arguments. */
 
-  if (argc != 4) {
-    fprintf(stderr, "Usage: %s <HOST-IPV4> <PORT> <NUM-THREADS>\n", argv[0]);
+  if (argc != 4 && argc != 5) {
+    fprintf(stderr, "Usage: %s <HOST-IPV4> <PORT> <NUM-THREADS> [<CPU-LIST>]\n",
+            argv[0]);
     return 1;
   }
 
@@ -173,10 +333,30 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  if (argc == 5 && !cpus_parse(&cpus, argv[4])) {
+    fputs("Parsing CPU list failed\n", stderr);
+    return 1;
+  }
+
+#ifdef WITH_WORK
+  work = getenv("WORK");
+  if (!parse_work(work != NULL ? work : DEFAULT_WORK)) {
+    fputs("Parsing WORK failed\n", stderr);
+    return 1;
+  }
+#endif
+
   /* Initialize server address. */
 
   uv_ip4_addr(host, port, &server_addr);
 
+  /* Initialize responses. */
+
+  for (size_t i = 0; i < MAX_BATCH; i++) {
+    response_bufs[i].base = RESPONSE;
+    response_bufs[i].len = sizeof(RESPONSE) - 1;
+  }
+
   /* Run and wait. */
 
   assert(num_threads <= SIZE_MAX / sizeof(*threads));
@@ -187,7 +367,18 @@ int main(int argc, char **argv) {
   }
 
   for (size_t i = 0; i < num_threads; i++) {
-    int ret = pthread_create(&threads[i], /*attr=*/NULL, &worker, /*arg=*/NULL);
+    pthread_attr_t attr;
+    int ret;
+
+    pthread_attr_init(&attr);
+    ret = cpus_set_attr(&cpus, i, &attr);
+    if (ret != 0) {
+      fprintf(stderr, "Setting thread affinity failed: %s\n", strerror(ret));
+      return 1;
+    }
+
+    ret = pthread_create(&threads[i], &attr, &worker, /*arg=*/NULL);
+    pthread_attr_destroy(&attr);
     if (ret != 0) {
       fprintf(stderr, "Creating thread failed: %s\n", strerror(ret));
       return 1;
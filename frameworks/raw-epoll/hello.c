@@ -13,19 +13,98 @@
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "cpus.h"
+#include "requests.h"
+
+#ifdef WITH_WORK
+#include "work.h"
+#endif
+
 #define RESPONSE "HTTP/1.1 200 OK\nContent-Length: 12\n\nHello world!"
 #define LISTEN_BACKLOG 1024
 #define MAX_EVENTS 64
+#define TIMEOUT_SECS 5
+#define BUF_SIZE 1024
+
+/* Most responses written at once. */
+#define MAX_BATCH REQUEST_MAX_BATCH(BUF_SIZE)
+
+#ifdef WITH_SHARED
+/*
+ * All threads wait on one epoll instance that holds the listener and all the
+ * clients. Waiters of one instance are woken one at a time, and EPOLLONESHOT
+ * gives each ready fd to one thread, which rearms it when done.
+ */
+#define SERVER_EVENTS (EPOLLIN | EPOLLONESHOT)
+#define CLIENT_EVENTS (EPOLLRDHUP | EPOLLONESHOT)
+#else
+/* Each thread has its own listener and epoll instance. */
+#define SERVER_EVENTS (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP | EPOLLET)
+#define CLIENT_EVENTS                                                          \
+  (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLERR | EPOLLHUP | EPOLLET)
+#endif
+
+#if defined(WITH_TIMEOUT) && defined(WITH_SHARED)
+#error "The timer wheels are per thread, connections must not move between them"
+#endif
 
 static struct sockaddr_in server_addr;
 
+/* CPUs the workers are pinned to. */
+static struct cpu_list cpus;
+
+/* The responses to a batch of pipelined requests are written with writev(). */
+static struct iovec response_iovs[MAX_BATCH];
+
 struct socket_data {
   int fd;
   bool reading;
+
+  /* Number of matched bytes of REQUEST_END at the end of the last read. */
+  uint8_t end_state;
+
+  /* Number of responses to write. */
+  uint32_t num_responses;
+
+#ifdef WITH_TIMEOUT
+  /*
+   * The connection is closed if the current read or write does not complete by
+   * the deadline. The deadline moves forward without touching the wheel, the
+   * connection is moved to its new slot only once the old one expires.
+   */
+  uint64_t deadline_ms;
+  struct socket_data *timer_next, **timer_pprev;
+#endif
+};
+
+#ifdef WITH_TIMEOUT
+#define TIMEOUT_MS ((uint64_t)TIMEOUT_SECS * 1000)
+
+/*
+ * A hashed timer wheel of a thread. A connection with the deadline D is in the
+ * slot of the tick ceil(D / TICK_MS). The wheel turns once in more than
+ * TIMEOUT_SECS, so a connection is visited at most once per deadline.
+ */
+#define TICK_MS 128
+#define NUM_SLOTS 64
+
+struct timer_wheel {
+  struct socket_data *slots[NUM_SLOTS];
+
+  /* The next tick to expire, and the time of the last epoll_wait() return. */
+  uint64_t tick;
+  uint64_t now_ms;
+
+  size_t num_timers;
 };
 
+static _Thread_local struct timer_wheel wheel;
+#endif
+
 static int open_listening_socket(void) {
   int fd, ret;
 
@@ -47,11 +126,13 @@ static int open_listening_socket(void) {
     exit(1);
   }
 
+#ifndef WITH_SHARED
   ret = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &(int){1}, sizeof(int));
   if (ret != 0) {
     perror("Setting SO_REUSEPORT failed");
     exit(1);
   }
+#endif
 
   ret = bind(fd, (struct sockaddr *)&server_addr, sizeof(server_addr));
   if (ret != 0) {
@@ -68,7 +149,91 @@ static int open_listening_socket(void) {
   return fd;
 }
 
-static void handle_accept_event(int epoll_fd, int server_fd) {
+#ifdef WITH_TIMEOUT
+static uint64_t get_coarse_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void insert_timer(struct socket_data *data) {
+  uint64_t tick = (data->deadline_ms + TICK_MS - 1) / TICK_MS;
+  struct socket_data **slot = &wheel.slots[tick % NUM_SLOTS];
+
+  data->timer_next = *slot;
+  data->timer_pprev = slot;
+  if (*slot != NULL)
+    (*slot)->timer_pprev = &data->timer_next;
+  *slot = data;
+}
+
+static void remove_timer(struct socket_data *data) {
+  *data->timer_pprev = data->timer_next;
+  if (data->timer_next != NULL)
+    data->timer_next->timer_pprev = data->timer_pprev;
+}
+
+/* Returns the epoll_wait() timeout until the next tick, if there are timers. */
+static int next_timeout(void) {
+  if (wheel.num_timers == 0)
+    return -1;
+  if (wheel.tick * TICK_MS <= wheel.now_ms)
+    return 0;
+  return (int)(wheel.tick * TICK_MS - wheel.now_ms);
+}
+
+/*
+ * Closes the connections whose deadline has passed and moves those whose
+ * deadline has been pushed forward.
+ */
+static void expire_timers(void) {
+  for (; wheel.tick * TICK_MS <= wheel.now_ms; wheel.tick++) {
+    struct socket_data **slot = &wheel.slots[wheel.tick % NUM_SLOTS];
+    struct socket_data *data = *slot;
+
+    *slot = NULL;
+    while (data != NULL) {
+      struct socket_data *next = data->timer_next;
+
+      if (data->deadline_ms <= wheel.now_ms) {
+        close(data->fd);
+        free(data);
+        wheel.num_timers--;
+      } else {
+        insert_timer(data);
+      }
+      data = next;
+    }
+  }
+}
+#endif
+
+static void close_client(struct socket_data *data) {
+#ifdef WITH_TIMEOUT
+  remove_timer(data);
+  wheel.num_timers--;
+#endif
+  close(data->fd);
+  free(data);
+}
+
+#ifdef WITH_SHARED
+/* Hands the fd back to the epoll instance, after which it is no longer ours. */
+static void rearm(int epoll_fd, struct socket_data *data, uint32_t events) {
+  struct epoll_event event;
+
+  event.events = events;
+  event.data.ptr = data;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, data->fd, &event) != 0) {
+    perror("Rearming fd failed");
+    exit(1);
+  }
+}
+#endif
+
+static void handle_accept_event(int epoll_fd, struct socket_data *server_data) {
+  int server_fd = server_data->fd;
+
   for (;;) {
     struct epoll_event event;
     struct socket_data *data;
@@ -90,9 +255,20 @@ static void handle_accept_event(int epoll_fd, int server_fd) {
 
     data->fd = client_fd;
     data->reading = true;
-
-    event.events =
-        EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLERR | EPOLLHUP | EPOLLET;
+    data->end_state = 0;
+    data->num_responses = 0;
+
+#ifdef WITH_TIMEOUT
+    data->deadline_ms = wheel.now_ms + TIMEOUT_MS;
+    insert_timer(data);
+    wheel.num_timers++;
+#endif
+
+#ifdef WITH_SHARED
+    event.events = EPOLLIN | CLIENT_EVENTS;
+#else
+    event.events = CLIENT_EVENTS;
+#endif
     event.data.ptr = data;
 
     ret = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &event);
@@ -101,9 +277,13 @@ static void handle_accept_event(int epoll_fd, int server_fd) {
       exit(1);
     }
   }
+
+#ifdef WITH_SHARED
+  rearm(epoll_fd, server_data, SERVER_EVENTS);
+#endif
 }
 
-static void handle_client_event(struct socket_data *data) {
+static void handle_client_event(int epoll_fd, struct socket_data *data) {
   int fd = data->fd;
   bool reading = data->reading;
 
@@ -113,45 +293,62 @@ static void handle_client_event(struct socket_data *data) {
     goto do_write;
 
 do_read : {
-  uint8_t buf[1024];
+  uint8_t buf[BUF_SIZE];
   ssize_t num_read = read(fd, buf, sizeof(buf));
   if (num_read <= 0) {
     if (num_read < 0 && errno == EAGAIN)
       goto out;
     goto done;
   }
+#ifdef WITH_TIMEOUT
+  data->deadline_ms = wheel.now_ms + TIMEOUT_MS;
+#endif
+  data->num_responses =
+      count_requests(buf, (size_t)num_read, &data->end_state);
+  if (data->num_responses == 0)
+    goto do_read;
+#ifdef WITH_WORK
+  do_work(data->num_responses);
+#endif
   reading = false;
   goto do_write;
 }
 
 do_write : {
-  ssize_t num_written = write(fd, RESPONSE, sizeof(RESPONSE) - 1);
+  uint32_t num_responses = data->num_responses;
+  ssize_t num_written = writev(fd, response_iovs, (int)num_responses);
   if (num_written < 0 && errno == EAGAIN)
     goto out;
-  if (num_written != sizeof(RESPONSE) - 1) {
+  if (num_written != (ssize_t)(num_responses * (sizeof(RESPONSE) - 1))) {
     fputs("Write failed\n", stderr);
     exit(1);
   }
+#ifdef WITH_TIMEOUT
+  data->deadline_ms = wheel.now_ms + TIMEOUT_MS;
+#endif
   reading = true;
   goto do_read;
 }
 
 out:
   data->reading = reading;
+#ifdef WITH_SHARED
+  rearm(epoll_fd, data, (reading ? EPOLLIN : EPOLLOUT) | CLIENT_EVENTS);
+#else
+  (void)epoll_fd;
+#endif
   return;
 
 done:
-  close(fd);
-  free(data);
+  close_client(data);
 }
 
-static void *worker(void *arg) {
+/* Opens a listener and an epoll instance watching it, returns the latter. */
+static int open_poller(int *server_fd_ptr) {
   struct epoll_event event;
   struct socket_data *data;
   int server_fd, epoll_fd, ret;
 
-  (void)arg;
-
   server_fd = open_listening_socket();
 
   data = malloc(sizeof(*data));
@@ -162,6 +359,8 @@ static void *worker(void *arg) {
 
   data->fd = server_fd;
   data->reading = true;
+  data->end_state = 0;
+  data->num_responses = 0;
 
   /* Initialize epoll instance. */
 
@@ -171,7 +370,7 @@ static void *worker(void *arg) {
     exit(1);
   }
 
-  event.events = EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP | EPOLLET;
+  event.events = SERVER_EVENTS;
   event.data.ptr = data;
   ret = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &event);
   if (ret != 0) {
@@ -179,35 +378,77 @@ static void *worker(void *arg) {
     exit(1);
   }
 
+  *server_fd_ptr = server_fd;
+  return epoll_fd;
+}
+
+#ifdef WITH_SHARED
+static int shared_server_fd, shared_epoll_fd;
+#endif
+
+static void *worker(void *arg) {
+  int server_fd, epoll_fd;
+
+  (void)arg;
+
+#ifdef WITH_SHARED
+  server_fd = shared_server_fd;
+  epoll_fd = shared_epoll_fd;
+#else
+  epoll_fd = open_poller(&server_fd);
+#endif
+
+#ifdef WITH_TIMEOUT
+  wheel.now_ms = get_coarse_ms();
+  wheel.tick = wheel.now_ms / TICK_MS + 1;
+#endif
+
   /* Loop. */
 
   for (;;) {
     struct epoll_event events[MAX_EVENTS];
     int n;
 
+#ifdef WITH_TIMEOUT
+    /* Wait until the next tick of the wheel. */
+    n = epoll_wait(epoll_fd, events, MAX_EVENTS, next_timeout());
+#else
     /* Wait indefinitely. */
     n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+#endif
     if (n < 0) {
       perror("epoll_wait() failed");
       exit(1);
     }
 
+#ifdef WITH_TIMEOUT
+    wheel.now_ms = get_coarse_ms();
+#endif
+
     for (int i = 0; i < n; ++i) {
       struct epoll_event *event = &events[i];
       struct socket_data *data = event->data.ptr;
 
       if ((event->events & (EPOLLRDHUP | EPOLLERR | EPOLLHUP)) != 0) {
-        close(data->fd);
-        free(data);
+        if (data->fd == server_fd) {
+          fputs("Server socket failed\n", stderr);
+          exit(1);
+        }
+        close_client(data);
         continue;
       }
 
       if (data->fd == server_fd) {
-        handle_accept_event(epoll_fd, server_fd);
+        handle_accept_event(epoll_fd, data);
       } else {
-        handle_client_event(data);
+        handle_client_event(epoll_fd, data);
       }
     }
+
+#ifdef WITH_TIMEOUT
+    /* After the events, so that none of them refers to a closed connection. */
+    expire_timers();
+#endif
   }
 }
 
@@ -216,11 +457,15 @@ int main(int argc, char **argv) {
   const char *host;
   uint16_t port;
   size_t num_threads;
+#ifdef WITH_WORK
+  const char *work;
+#endif
 
   /* Parse arguments. */
 
-  if (argc != 4) {
-    fprintf(stderr, "Usage: %s <HOST-IPV4> <PORT> <NUM-THREADS>\n", argv[0]);
+  if (argc != 4 && argc != 5) {
+    fprintf(stderr, "Usage: %s <HOST-IPV4> <PORT> <NUM-THREADS> [<CPU-LIST>]\n",
+            argv[0]);
     return 1;
   }
 
@@ -236,6 +481,19 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  if (argc == 5 && !cpus_parse(&cpus, argv[4])) {
+    fputs("Parsing CPU list failed\n", stderr);
+    return 1;
+  }
+
+#ifdef WITH_WORK
+  work = getenv("WORK");
+  if (!parse_work(work != NULL ? work : DEFAULT_WORK)) {
+    fputs("Parsing WORK failed\n", stderr);
+    return 1;
+  }
+#endif
+
   /* Initialize server address. */
 
   server_addr.sin_family = AF_INET;
@@ -245,6 +503,19 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  /* Initialize responses. */
+
+  for (size_t i = 0; i < MAX_BATCH; i++) {
+    response_iovs[i].iov_base = RESPONSE;
+    response_iovs[i].iov_len = sizeof(RESPONSE) - 1;
+  }
+
+#ifdef WITH_SHARED
+  /* Initialize the listener and epoll instance shared by all threads. */
+
+  shared_epoll_fd = open_poller(&shared_server_fd);
+#endif
+
   /* Run and wait. */
 
   assert(num_threads <= SIZE_MAX / sizeof(*threads));
@@ -255,7 +526,18 @@ int main(int argc, char **argv) {
   }
 
   for (size_t i = 0; i < num_threads; i++) {
-    int ret = pthread_create(&threads[i], /*attr=*/NULL, &worker, /*arg=*/NULL);
+    pthread_attr_t attr;
+    int ret;
+
+    pthread_attr_init(&attr);
+    ret = cpus_set_attr(&cpus, i, &attr);
+    if (ret != 0) {
+      fprintf(stderr, "Setting thread affinity failed: %s\n", strerror(ret));
+      return 1;
+    }
+
+    ret = pthread_create(&threads[i], &attr, &worker, /*arg=*/NULL);
+    pthread_attr_destroy(&attr);
     if (ret != 0) {
       fprintf(stderr, "Creating thread failed: %s\n", strerror(ret));
       return 1;
@@ -0,0 +1,654 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "cpus.h"
+#include "requests.h"
+
+#define RESPONSE "HTTP/1.1 200 OK\nContent-Length: 12\n\nHello world!"
+#define RESPONSE_SIZE (sizeof(RESPONSE) - 1)
+#define LISTEN_BACKLOG 1024
+#define TIMEOUT_SECS 5
+#define BUF_SIZE 1024
+
+/* Most responses written at once. */
+#define MAX_BATCH REQUEST_MAX_BATCH(BUF_SIZE)
+
+/* Sizes of the rings of a thread, NUM_BUFS must be a power of two. */
+#define SQ_ENTRIES 1024
+#define CQ_ENTRIES 16384
+#define NUM_BUFS 4096
+#define BUF_GROUP 0
+
+/* Maximum number of connections of a thread, also limited by RLIMIT_NOFILE. */
+#define MAX_CONNS 65536
+
+/*
+ * The user data of a request is the fixed file index of its connection and the
+ * operation.
+ */
+enum op { OP_ACCEPT, OP_RECV, OP_WRITE, OP_TIMEOUT, OP_CANCEL, OP_CLOSE };
+
+#define USER_DATA(index, op) ((uint64_t)(index) << 8 | (op))
+#define USER_DATA_INDEX(user_data) ((uint32_t)((user_data) >> 8))
+#define USER_DATA_OP(user_data) ((enum op)((user_data) & 0xff))
+
+static struct sockaddr_in server_addr;
+
+/* CPUs the workers are pinned to. */
+static struct cpu_list cpus;
+
+/* Size of the fixed file table of a thread. */
+static unsigned max_conns;
+
+/*
+ * The responses to a batch of pipelined requests are written with one write
+ * from a registered buffer, so the responses are laid out one after another.
+ */
+static char responses[MAX_BATCH * RESPONSE_SIZE];
+
+#ifdef WITH_TIMEOUT
+/* Timeout linked to every receive and write. */
+static const struct __kernel_timespec timeout = {
+    .tv_sec = TIMEOUT_SECS,
+    .tv_nsec = 0,
+};
+#endif
+
+/*
+ * A connection is closed only once none of its requests is in flight, so that
+ * its fixed file index is not reused under them.
+ */
+struct conn {
+  bool receiving;
+  bool writing;
+  bool closing;
+
+  /* Number of matched bytes of REQUEST_END at the end of the last receive. */
+  uint8_t end_state;
+
+  /* Number of responses to write after the write in flight. */
+  uint32_t num_pending;
+
+  /* Size of the write in flight. */
+  uint32_t write_size;
+};
+
+/* The ring of a thread, used without liburing. */
+struct worker {
+  int ring_fd;
+
+  /* Submission queue. */
+  unsigned *sq_khead;
+  unsigned *sq_ktail;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned sq_tail;
+  unsigned sq_submitted;
+  struct io_uring_sqe *sqes;
+
+  /* Completion queue. */
+  unsigned *cq_khead;
+  unsigned *cq_ktail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+
+  /* Provided buffers the kernel receives into. */
+  struct io_uring_buf_ring *buf_ring;
+  uint8_t *bufs;
+  uint16_t buf_tail;
+
+  int server_fd;
+
+  /* Connections, indexed by their fixed file index. */
+  struct conn *conns;
+};
+
+static int open_listening_socket(void) {
+  int fd, ret;
+
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("Opening server socket failed");
+    exit(1);
+  }
+
+  ret = setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int));
+  if (ret != 0) {
+    perror("Setting SO_REUSEADDR failed");
+    exit(1);
+  }
+
+  ret = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &(int){1}, sizeof(int));
+  if (ret != 0) {
+    perror("Setting SO_REUSEPORT failed");
+    exit(1);
+  }
+
+  ret = bind(fd, (struct sockaddr *)&server_addr, sizeof(server_addr));
+  if (ret != 0) {
+    perror("Binding name to server socket failed");
+    exit(1);
+  }
+
+  ret = listen(fd, LISTEN_BACKLOG);
+  if (ret != 0) {
+    perror("Listening failed");
+    exit(1);
+  }
+
+  return fd;
+}
+
+static int io_uring_register(int fd, unsigned opcode, const void *arg,
+                             unsigned nr_args) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void *map_ring(int fd, size_t size, off_t offset) {
+  void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, offset);
+  if (ptr == MAP_FAILED) {
+    perror("Mapping ring failed");
+    exit(1);
+  }
+  return ptr;
+}
+
+static void init_ring(struct worker *worker) {
+  struct io_uring_params params;
+  unsigned *sq_array;
+  uint8_t *sq_ptr, *cq_ptr;
+  int fd;
+
+  /* The ring is used by its thread only, which takes the task work itself. */
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER |
+                 IORING_SETUP_COOP_TASKRUN;
+  params.cq_entries = CQ_ENTRIES;
+  fd = (int)syscall(__NR_io_uring_setup, SQ_ENTRIES, &params);
+  if (fd < 0) {
+    perror("Setting up io_uring failed");
+    exit(1);
+  }
+
+  sq_ptr = map_ring(fd,
+                    params.sq_off.array + params.sq_entries * sizeof(*sq_array),
+                    IORING_OFF_SQ_RING);
+  cq_ptr = map_ring(fd,
+                    params.cq_off.cqes +
+                        params.cq_entries * sizeof(struct io_uring_cqe),
+                    IORING_OFF_CQ_RING);
+
+  worker->ring_fd = fd;
+  worker->sq_khead = (unsigned *)(sq_ptr + params.sq_off.head);
+  worker->sq_ktail = (unsigned *)(sq_ptr + params.sq_off.tail);
+  worker->sq_mask = *(unsigned *)(sq_ptr + params.sq_off.ring_mask);
+  worker->sq_entries = params.sq_entries;
+  worker->sq_tail = *worker->sq_ktail;
+  worker->sq_submitted = worker->sq_tail;
+  worker->sqes = map_ring(fd, params.sq_entries * sizeof(struct io_uring_sqe),
+                          IORING_OFF_SQES);
+  worker->cq_khead = (unsigned *)(cq_ptr + params.cq_off.head);
+  worker->cq_ktail = (unsigned *)(cq_ptr + params.cq_off.tail);
+  worker->cq_mask = *(unsigned *)(cq_ptr + params.cq_off.ring_mask);
+  worker->cqes = (struct io_uring_cqe *)(cq_ptr + params.cq_off.cqes);
+
+  /* The SQ array maps each entry to the SQE of the same index. */
+  sq_array = (unsigned *)(sq_ptr + params.sq_off.array);
+  for (unsigned i = 0; i < params.sq_entries; i++)
+    sq_array[i] = i;
+}
+
+static void register_resources(struct worker *worker) {
+  struct io_uring_buf_reg buf_reg;
+  struct iovec iov;
+  int *fds, ret;
+
+  /* A sparse file table, accepted connections are installed directly. */
+
+  fds = malloc(max_conns * sizeof(*fds));
+  if (fds == NULL) {
+    fputs("Allocating file table failed\n", stderr);
+    exit(1);
+  }
+  for (unsigned i = 0; i < max_conns; i++)
+    fds[i] = -1;
+
+  ret = io_uring_register(worker->ring_fd, IORING_REGISTER_FILES, fds,
+                          max_conns);
+  if (ret != 0) {
+    perror("Registering files failed");
+    exit(1);
+  }
+  free(fds);
+
+  /* The responses. */
+
+  iov.iov_base = responses;
+  iov.iov_len = sizeof(responses);
+  ret = io_uring_register(worker->ring_fd, IORING_REGISTER_BUFFERS, &iov, 1);
+  if (ret != 0) {
+    perror("Registering buffers failed");
+    exit(1);
+  }
+
+  /* The ring of provided buffers, all of them are given to the kernel. */
+
+  worker->buf_ring = mmap(NULL, NUM_BUFS * sizeof(struct io_uring_buf),
+                          PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                          -1, 0);
+  worker->bufs = malloc(NUM_BUFS * BUF_SIZE);
+  if (worker->buf_ring == MAP_FAILED || worker->bufs == NULL) {
+    fputs("Allocating buffers failed\n", stderr);
+    exit(1);
+  }
+
+  memset(&buf_reg, 0, sizeof(buf_reg));
+  buf_reg.ring_addr = (uint64_t)(uintptr_t)worker->buf_ring;
+  buf_reg.ring_entries = NUM_BUFS;
+  buf_reg.bgid = BUF_GROUP;
+  ret = io_uring_register(worker->ring_fd, IORING_REGISTER_PBUF_RING,
+                          &buf_reg, 1);
+  if (ret != 0) {
+    perror("Registering buffer ring failed");
+    exit(1);
+  }
+
+  for (uint16_t bid = 0; bid < NUM_BUFS; bid++) {
+    struct io_uring_buf *buf = &worker->buf_ring->bufs[bid];
+
+    buf->addr = (uint64_t)(uintptr_t)(worker->bufs + (size_t)bid * BUF_SIZE);
+    buf->len = BUF_SIZE;
+    buf->bid = bid;
+  }
+  worker->buf_tail = NUM_BUFS;
+  __atomic_store_n(&worker->buf_ring->tail, worker->buf_tail,
+                   __ATOMIC_RELEASE);
+}
+
+/* Gives the buffer back to the kernel. */
+static void recycle_buf(struct worker *worker, uint16_t bid) {
+  struct io_uring_buf *buf =
+      &worker->buf_ring->bufs[worker->buf_tail & (NUM_BUFS - 1)];
+
+  buf->addr = (uint64_t)(uintptr_t)(worker->bufs + (size_t)bid * BUF_SIZE);
+  buf->len = BUF_SIZE;
+  buf->bid = bid;
+  worker->buf_tail++;
+  __atomic_store_n(&worker->buf_ring->tail, worker->buf_tail,
+                   __ATOMIC_RELEASE);
+}
+
+/*
+ * Submits the queued SQEs in one io_uring_enter() call and waits for at least
+ * wait_nr completions.
+ */
+static void submit_and_wait(struct worker *worker, unsigned wait_nr) {
+  unsigned to_submit = worker->sq_tail - worker->sq_submitted;
+  int ret;
+
+  __atomic_store_n(worker->sq_ktail, worker->sq_tail, __ATOMIC_RELEASE);
+  do {
+    ret = (int)syscall(__NR_io_uring_enter, worker->ring_fd, to_submit,
+                       wait_nr, wait_nr != 0 ? IORING_ENTER_GETEVENTS : 0,
+                       NULL, 0);
+  } while (ret < 0 && errno == EINTR);
+  if (ret < 0) {
+    perror("Entering io_uring failed");
+    exit(1);
+  }
+  worker->sq_submitted += (unsigned)ret;
+}
+
+/*
+ * Makes room for num_sqes SQEs, so that a linked pair is not split between two
+ * submissions.
+ */
+static void reserve_sqes(struct worker *worker, unsigned num_sqes) {
+  unsigned head = __atomic_load_n(worker->sq_khead, __ATOMIC_ACQUIRE);
+  if (worker->sq_tail - head + num_sqes > worker->sq_entries)
+    submit_and_wait(worker, 0);
+}
+
+/* Returns a cleared SQE, there must be room for it. */
+static struct io_uring_sqe *get_sqe(struct worker *worker) {
+  struct io_uring_sqe *sqe = &worker->sqes[worker->sq_tail & worker->sq_mask];
+  worker->sq_tail++;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+#ifdef WITH_TIMEOUT
+static void prep_link_timeout(struct worker *worker, uint32_t index) {
+  struct io_uring_sqe *sqe = get_sqe(worker);
+
+  sqe->opcode = IORING_OP_LINK_TIMEOUT;
+  sqe->addr = (uint64_t)(uintptr_t)&timeout;
+  sqe->len = 1;
+  sqe->user_data = USER_DATA(index, OP_TIMEOUT);
+}
+#endif
+
+static void start_accept(struct worker *worker) {
+  struct io_uring_sqe *sqe;
+
+  reserve_sqes(worker, 1);
+  sqe = get_sqe(worker);
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = worker->server_fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->file_index = IORING_FILE_INDEX_ALLOC;
+  sqe->user_data = USER_DATA(0, OP_ACCEPT);
+}
+
+/*
+ * Starts receiving into the provided buffers. Without timeouts, one multishot
+ * receive serves the whole connection, a timeout needs a receive per read.
+ */
+static void start_recv(struct worker *worker, uint32_t index) {
+  struct io_uring_sqe *sqe;
+
+  reserve_sqes(worker, 2);
+  sqe = get_sqe(worker);
+  sqe->opcode = IORING_OP_RECV;
+  sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+  sqe->fd = (int)index;
+  sqe->buf_group = BUF_GROUP;
+  sqe->user_data = USER_DATA(index, OP_RECV);
+#ifdef WITH_TIMEOUT
+  sqe->flags |= IOSQE_IO_LINK;
+  prep_link_timeout(worker, index);
+#else
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+#endif
+
+  worker->conns[index].receiving = true;
+}
+
+static void start_write(struct worker *worker, uint32_t index) {
+  struct conn *conn = &worker->conns[index];
+  uint32_t num_responses =
+      conn->num_pending < MAX_BATCH ? conn->num_pending : MAX_BATCH;
+  struct io_uring_sqe *sqe;
+
+  conn->num_pending -= num_responses;
+  conn->write_size = num_responses * (uint32_t)RESPONSE_SIZE;
+  conn->writing = true;
+
+  reserve_sqes(worker, 2);
+  sqe = get_sqe(worker);
+  sqe->opcode = IORING_OP_WRITE_FIXED;
+  sqe->flags = IOSQE_FIXED_FILE;
+  sqe->fd = (int)index;
+  sqe->addr = (uint64_t)(uintptr_t)responses;
+  sqe->len = conn->write_size;
+  sqe->buf_index = 0;
+  sqe->user_data = USER_DATA(index, OP_WRITE);
+#ifdef WITH_TIMEOUT
+  sqe->flags |= IOSQE_IO_LINK;
+  prep_link_timeout(worker, index);
+#endif
+}
+
+/*
+ * Closes the connection once its requests have completed, a receive still in
+ * flight is canceled first.
+ */
+static void close_conn(struct worker *worker, uint32_t index) {
+  struct conn *conn = &worker->conns[index];
+  struct io_uring_sqe *sqe;
+
+  if (conn->receiving && !conn->closing) {
+    reserve_sqes(worker, 1);
+    sqe = get_sqe(worker);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->fd = (int)index;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_FD_FIXED |
+                        IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = USER_DATA(index, OP_CANCEL);
+  }
+  conn->closing = true;
+
+  if (conn->receiving || conn->writing)
+    return;
+
+  reserve_sqes(worker, 1);
+  sqe = get_sqe(worker);
+  sqe->opcode = IORING_OP_CLOSE;
+  sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+  sqe->file_index = index + 1;
+  sqe->user_data = USER_DATA(index, OP_CLOSE);
+}
+
+static void handle_accept(struct worker *worker,
+                          const struct io_uring_cqe *cqe) {
+  struct conn *conn;
+  uint32_t index;
+
+  if (cqe->res < 0) {
+    fprintf(stderr, "Accepting connection failed: %s\n", strerror(-cqe->res));
+    exit(1);
+  }
+
+  index = (uint32_t)cqe->res;
+  conn = &worker->conns[index];
+  memset(conn, 0, sizeof(*conn));
+  start_recv(worker, index);
+
+  if ((cqe->flags & IORING_CQE_F_MORE) == 0)
+    start_accept(worker);
+}
+
+static void handle_recv(struct worker *worker, const struct io_uring_cqe *cqe) {
+  uint32_t index = USER_DATA_INDEX(cqe->user_data);
+  struct conn *conn = &worker->conns[index];
+
+  if (cqe->res > 0) {
+    uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    uint32_t num_responses =
+        count_requests(worker->bufs + (size_t)bid * BUF_SIZE,
+                       (size_t)cqe->res, &conn->end_state);
+
+    recycle_buf(worker, bid);
+    conn->num_pending += num_responses;
+    if (!conn->writing && !conn->closing && conn->num_pending != 0)
+      start_write(worker, index);
+  }
+
+  if ((cqe->flags & IORING_CQE_F_MORE) != 0)
+    return;
+  conn->receiving = false;
+
+  /* A multishot receive also stops when the kernel runs out of buffers. */
+  if (!conn->closing && (cqe->res > 0 || cqe->res == -ENOBUFS)) {
+    start_recv(worker, index);
+    return;
+  }
+
+  close_conn(worker, index);
+}
+
+static void handle_write(struct worker *worker,
+                         const struct io_uring_cqe *cqe) {
+  uint32_t index = USER_DATA_INDEX(cqe->user_data);
+  struct conn *conn = &worker->conns[index];
+
+  conn->writing = false;
+
+  /* The peer is gone or the write timed out. */
+  if (cqe->res < 0) {
+    close_conn(worker, index);
+    return;
+  }
+
+  if ((uint32_t)cqe->res != conn->write_size) {
+    fputs("Writing to socket failed\n", stderr);
+    exit(1);
+  }
+
+  if (conn->closing)
+    close_conn(worker, index);
+  else if (conn->num_pending != 0)
+    start_write(worker, index);
+}
+
+static void *worker_main(void *arg) {
+  struct worker worker;
+
+  (void)arg;
+
+  memset(&worker, 0, sizeof(worker));
+  worker.server_fd = open_listening_socket();
+  worker.conns = calloc(max_conns, sizeof(*worker.conns));
+  if (worker.conns == NULL) {
+    fputs("Allocating connections failed\n", stderr);
+    exit(1);
+  }
+
+  init_ring(&worker);
+  register_resources(&worker);
+  start_accept(&worker);
+
+  /* Loop. The SQEs queued while handling completions are submitted at once. */
+
+  for (;;) {
+    unsigned head, tail;
+
+    submit_and_wait(&worker, 1);
+
+    head = *worker.cq_khead;
+    tail = __atomic_load_n(worker.cq_ktail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      const struct io_uring_cqe *cqe = &worker.cqes[head & worker.cq_mask];
+
+      switch (USER_DATA_OP(cqe->user_data)) {
+      case OP_ACCEPT:
+        handle_accept(&worker, cqe);
+        break;
+      case OP_RECV:
+        handle_recv(&worker, cqe);
+        break;
+      case OP_WRITE:
+        handle_write(&worker, cqe);
+        break;
+      case OP_TIMEOUT:
+      case OP_CANCEL:
+      case OP_CLOSE:
+        break;
+      }
+    }
+    __atomic_store_n(worker.cq_khead, head, __ATOMIC_RELEASE);
+  }
+}
+
+int main(int argc, char **argv) {
+  struct rlimit rlimit;
+  pthread_t *threads;
+  const char *host;
+  uint16_t port;
+  size_t num_threads;
+
+  /* Parse arguments. */
+
+  if (argc != 4 && argc != 5) {
+    fprintf(stderr, "Usage: %s <HOST-IPV4> <PORT> <NUM-THREADS> [<CPU-LIST>]\n",
+            argv[0]);
+    return 1;
+  }
+
+  host = argv[1];
+
+  if (sscanf(argv[2], "%" SCNu16, &port) != 1) {
+    fputs("Parsing port failed\n", stderr);
+    return 1;
+  }
+
+  if (sscanf(argv[3], "%zu", &num_threads) != 1) {
+    fputs("Parsing number of threads failed\n", stderr);
+    return 1;
+  }
+
+  if (argc == 5 && !cpus_parse(&cpus, argv[4])) {
+    fputs("Parsing CPU list failed\n", stderr);
+    return 1;
+  }
+
+  /* The kernel limits the fixed file table by RLIMIT_NOFILE. */
+
+  if (getrlimit(RLIMIT_NOFILE, &rlimit) != 0) {
+    perror("Getting RLIMIT_NOFILE failed");
+    return 1;
+  }
+  max_conns = rlimit.rlim_cur < MAX_CONNS ? (unsigned)rlimit.rlim_cur
+                                           : MAX_CONNS;
+
+  /* Initialize server address. */
+
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_port = htons(port);
+  if (inet_aton(host, &server_addr.sin_addr) != 1) {
+    fprintf(stderr, "Converting host IPv4 '%s' failed\n", host);
+    return 1;
+  }
+
+  /* Initialize responses. */
+
+  for (size_t i = 0; i < MAX_BATCH; i++)
+    memcpy(&responses[i * RESPONSE_SIZE], RESPONSE, RESPONSE_SIZE);
+
+  /* Run and wait. */
+
+  assert(num_threads <= SIZE_MAX / sizeof(*threads));
+  threads = malloc(num_threads * sizeof(*threads));
+  if (threads == NULL) {
+    fputs("Allocating memory for threads failed\n", stderr);
+    return 1;
+  }
+
+  for (size_t i = 0; i < num_threads; i++) {
+    pthread_attr_t attr;
+    int ret;
+
+    pthread_attr_init(&attr);
+    ret = cpus_set_attr(&cpus, i, &attr);
+    if (ret != 0) {
+      fprintf(stderr, "Setting thread affinity failed: %s\n", strerror(ret));
+      return 1;
+    }
+
+    ret = pthread_create(&threads[i], &attr, &worker_main, /*arg=*/NULL);
+    pthread_attr_destroy(&attr);
+    if (ret != 0) {
+      fprintf(stderr, "Creating thread failed: %s\n", strerror(ret));
+      return 1;
+    }
+  }
+
+  for (size_t i = 0; i < num_threads; i++) {
+    int ret = pthread_join(threads[i], /*ret_val=*/NULL);
+    if (ret != 0) {
+      fprintf(stderr, "Joining thread failed: %s\n", strerror(ret));
+      return 1;
+    }
+  }
+
+  return 0;
+}
@@ -1,8 +1,12 @@
 #include <arpa/inet.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <netinet/in.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,15 +14,91 @@
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "requests.h"
+
+#ifdef WITH_WORK
+#include "work.h"
+#endif
+
+#ifdef WITH_SYNC
+#include "sync.h"
+#endif
+
 #define RESPONSE "HTTP/1.1 200 OK\nContent-Length: 12\n\nHello world!"
 #define LISTEN_BACKLOG 1024
 #define TIMEOUT_SECS 5
+#define BUF_SIZE 1024
+
+/* Most responses written at once. */
+#define MAX_BATCH REQUEST_MAX_BATCH(BUF_SIZE)
+
+/* The responses to a batch of pipelined requests are written with writev(). */
+static struct iovec response_iovs[MAX_BATCH];
+
+#ifdef WITH_SYNC
+/* Kinds of SYNC, a pthread mutex per counter or one semaphore. */
+static const char *const sync_kinds[] = {"mutex", "sem"};
+enum { SYNC_MUTEX, SYNC_SEM };
+
+static DEFINE_SYNC_SHARD(pthread_mutex_t) *sync_shards;
+static sem_t sync_sem;
+
+static bool init_sync(void) {
+  size_t num_shards = sync_kind == SYNC_MUTEX ? sync_num_locks : 1;
+
+  if (sync_kind == SYNC_SEM && sync_num_locks > SEM_VALUE_MAX)
+    return false;
+
+  sync_shards = aligned_alloc(_Alignof(struct sync_shard),
+                              num_shards * sizeof(*sync_shards));
+  if (sync_shards == NULL)
+    return false;
+
+  for (size_t i = 0; i < num_shards; i++) {
+    if (pthread_mutex_init(&sync_shards[i].lock, /*attr=*/NULL) != 0)
+      return false;
+    sync_shards[i].count = 0;
+  }
+
+  return sync_kind != SYNC_SEM ||
+         sem_init(&sync_sem, /*pshared=*/0, sync_num_locks) == 0;
+}
+
+/* Updates the shared state once for each of num_requests requests. */
+static void do_sync(uint32_t conn_no, uint32_t num_requests) {
+  for (uint32_t i = 0; i < num_requests; i++) {
+    if (sync_kind == SYNC_MUTEX) {
+      struct sync_shard *shard = &sync_shards[conn_no % sync_num_locks];
+
+      pthread_mutex_lock(&shard->lock);
+      hold_lock();
+      shard->count++;
+      pthread_mutex_unlock(&shard->lock);
+    } else {
+      while (sem_wait(&sync_sem) != 0) {
+        if (errno != EINTR) {
+          perror("Waiting on semaphore failed");
+          exit(1);
+        }
+      }
+      hold_lock();
+      __atomic_add_fetch(&sync_shards[0].count, 1, __ATOMIC_RELAXED);
+      sem_post(&sync_sem);
+    }
+  }
+}
+#endif
 
 static void *worker(void *arg) {
-  char buffer[1024];
+  char buffer[BUF_SIZE];
   int client_fd = (int)(intptr_t)arg;
+  uint8_t end_state = 0;
+#ifdef WITH_SYNC
+  uint32_t conn_no = sync_next_conn();
+#endif
 
 #ifdef WITH_TIMEOUT
   struct timeval tv;
@@ -42,6 +122,7 @@ static void *worker(void *arg) {
 
   for (;;) {
     ssize_t num_read, num_written;
+    uint32_t num_responses;
 
     num_read = read(client_fd, buffer, sizeof(buffer));
     if (num_read <= 0) {
@@ -50,8 +131,20 @@ static void *worker(void *arg) {
       break;
     }
 
-    num_written = write(client_fd, RESPONSE, sizeof(RESPONSE) - 1);
-    if (num_written != sizeof(RESPONSE) - 1) {
+    num_responses = count_requests(buffer, (size_t)num_read, &end_state);
+    if (num_responses == 0)
+      continue;
+
+#ifdef WITH_WORK
+    do_work(num_responses);
+#endif
+
+#ifdef WITH_SYNC
+    do_sync(conn_no, num_responses);
+#endif
+
+    num_written = writev(client_fd, response_iovs, (int)num_responses);
+    if (num_written != (ssize_t)(num_responses * (sizeof(RESPONSE) - 1))) {
       fputs("Writing to socket failed\n", stderr);
       break;
     }
@@ -67,6 +160,12 @@ int main(int argc, char **argv) {
   const char *host;
   uint16_t port;
   int server_fd, ret;
+#ifdef WITH_WORK
+  const char *work;
+#endif
+#ifdef WITH_SYNC
+  const char *sync_arg;
+#endif
 
   /* Parse arguments. */
 
@@ -82,6 +181,27 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+#ifdef WITH_WORK
+  work = getenv("WORK");
+  if (!parse_work(work != NULL ? work : DEFAULT_WORK)) {
+    fputs("Parsing WORK failed\n", stderr);
+    return 1;
+  }
+#endif
+
+#ifdef WITH_SYNC
+  sync_arg = getenv("SYNC");
+  if (!parse_sync(sync_arg != NULL ? sync_arg : DEFAULT_SYNC, sync_kinds,
+                  sizeof(sync_kinds) / sizeof(sync_kinds[0]))) {
+    fputs("Parsing SYNC failed\n", stderr);
+    return 1;
+  }
+  if (!init_sync()) {
+    fputs("Initializing SYNC failed\n", stderr);
+    return 1;
+  }
+#endif
+
   /* Initialize server address. */
 
   memset(&server_addr, 0, sizeof(server_addr));
@@ -92,6 +212,13 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  /* Initialize responses. */
+
+  for (size_t i = 0; i < MAX_BATCH; i++) {
+    response_iovs[i].iov_base = RESPONSE;
+    response_iovs[i].iov_len = sizeof(RESPONSE) - 1;
+  }
+
   /* Initialize server socket. */
 
   server_fd = socket(AF_INET, SOCK_STREAM, 0);
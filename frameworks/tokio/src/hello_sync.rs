@@ -0,0 +1,130 @@
+use std::env;
+use std::net::{Ipv4Addr, SocketAddrV4};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+use tokio::net::TcpListener;
+use tokio::prelude::*;
+use tokio::runtime::Builder;
+use tokio::sync::{Mutex, Semaphore};
+
+static RESPONSE: &[u8] = b"HTTP/1.1 200 OK\nContent-Length: 12\n\nHello world!";
+
+// Shared state if the SYNC environment variable is not set.
+static DEFAULT_SYNC: &str = "mutex:1:1000";
+
+// A lock and its counter, on their own cache line.
+#[repr(align(64))]
+struct Shard(Mutex<u64>);
+
+enum SyncKind {
+    Mutex(Vec<Shard>),
+    Semaphore(Semaphore, AtomicU64),
+}
+
+// Every request updates a shared counter, as taken from the SYNC environment variable described in
+// frameworks/common/sync.h. mutex guards each counter with an async mutex, and sem guards one
+// counter with an async semaphore.
+struct SyncState {
+    kind: SyncKind,
+    hold: Duration,
+}
+
+impl SyncState {
+    fn parse(arg: &str) -> Option<SyncState> {
+        let mut parts = arg.split(':');
+        let kind = parts.next()?;
+        let num_locks = parts.next()?.parse::<usize>().ok().filter(|&n| n != 0)?;
+        let hold = Duration::from_nanos(parts.next()?.parse::<u64>().ok()?);
+        if parts.next().is_some() {
+            return None;
+        }
+
+        let kind = match kind {
+            "mutex" => SyncKind::Mutex((0..num_locks).map(|_| Shard(Mutex::new(0))).collect()),
+            "sem" => SyncKind::Semaphore(Semaphore::new(num_locks), AtomicU64::new(0)),
+            _ => return None,
+        };
+        Some(SyncState { kind, hold })
+    }
+
+    fn hold_lock(&self) {
+        let deadline = Instant::now() + self.hold;
+        while Instant::now() < deadline {}
+    }
+
+    // Updates the shared state for a request of the connection conn_no.
+    async fn update(&self, conn_no: usize) {
+        match &self.kind {
+            SyncKind::Mutex(shards) => {
+                let mut count = shards[conn_no % shards.len()].0.lock().await;
+                self.hold_lock();
+                *count += 1;
+            }
+            SyncKind::Semaphore(semaphore, count) => {
+                let _permit = semaphore.acquire().await;
+                self.hold_lock();
+                count.fetch_add(1, Ordering::Relaxed);
+            }
+        }
+    }
+}
+
+fn main() {
+    let ip = env::args().nth(1).unwrap().parse::<Ipv4Addr>().unwrap();
+    let port = env::args().nth(2).unwrap().parse::<u16>().unwrap();
+    let addr = SocketAddrV4::new(ip, port);
+
+    let num_threads = env::args().nth(3).unwrap().parse::<usize>().unwrap();
+
+    let sync_arg = env::var("SYNC").unwrap_or_else(|_| DEFAULT_SYNC.to_string());
+    let sync = match SyncState::parse(&sync_arg) {
+        Some(sync) => Arc::new(sync),
+        None => panic!("Failed to parse SYNC '{}'", sync_arg),
+    };
+
+    Builder::new()
+        .threaded_scheduler()
+        .enable_all()
+        .core_threads(num_threads)
+        .build()
+        .unwrap()
+        .block_on(async {
+            let mut listener = TcpListener::bind(&addr).await.unwrap();
+            for conn_no in 0.. {
+                let (mut stream, _) = listener.accept().await.unwrap();
+                let sync = sync.clone();
+                tokio::spawn(async move {
+                    let mut buf = [0u8; 1024];
+                    loop {
+                        let read_future = stream.read(&mut buf);
+                        let num_read = match read_future.await {
+                            Err(e) => {
+                                eprintln!("Reading failed: {:?}", e);
+                                return;
+                            }
+                            Ok(n) => n,
+                        };
+                        if num_read == 0 {
+                            return;
+                        }
+
+                        sync.update(conn_no).await;
+
+                        let write_future = stream.write(RESPONSE);
+                        match write_future.await {
+                            Err(e) => {
+                                eprintln!("Writing failed: {:?}", e);
+                                return;
+                            }
+                            Ok(n) => {
+                                if n != RESPONSE.len() {
+                                    panic!("Writing failed")
+                                }
+                            }
+                        }
+                    }
+                });
+            }
+        });
+}
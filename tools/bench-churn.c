@@ -0,0 +1,624 @@
+/*
+ * Copyright 2020 Patryk Stefanski
+ *
+ * Licensed under the Apache License, Version 2.0, <LICENSE-APACHE or
+ * http://apache.org/licenses/LICENSE-2.0> or the MIT license <LICENSE-MIT or
+ * http://opensource.org/licenses/MIT>, at your option. This file may not be
+ * copied, modified, or distributed except according to those terms.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cpus.h"
+#include "hist.h"
+
+#define LIKELY(e) __builtin_expect((e), 1)
+#define UNLIKELY(e) __builtin_expect((e), 0)
+#define UNREACHABLE() __builtin_unreachable()
+
+#define MAX_EVENTS 64
+
+/* The hello servers answer each request terminated by an empty line. */
+#define REQUEST "GET / HTTP/1.1\r\n\r\n"
+#define RESPONSE "HTTP/1.1 200 OK\nContent-Length: 12\n\nHello world!"
+#define REQUEST_SIZE (sizeof(REQUEST) - 1)
+#define RESPONSE_SIZE (sizeof(RESPONSE) - 1)
+
+/*
+ * A slot opens a connection, sends one request, waits for the response and closes the connection,
+ * then starts over with a new connection.
+ */
+struct slot {
+  /* Non-blocking socket file descriptor of the current connection, -1 if there is none. */
+  int sock_fd;
+
+  /* Set until the connection is established. */
+  bool connecting;
+
+  /* Number of bytes of the response not received yet. */
+  uint32_t num_pending;
+
+  /* Number of connections completed so far. */
+  uint32_t num_conns;
+
+  /* The time of the connect() call of the current connection. */
+  uint64_t start_ns;
+};
+
+/* Server address we are going to connect to. */
+static const char *host;
+static uint16_t port;
+static struct sockaddr_in server_addr;
+
+/* CPUs the workers are pinned to, one worker per CPU in turn, empty if not pinned. */
+static struct cpu_list worker_cpus;
+
+/* Number of workers (threads). */
+static uint32_t num_workers = 1;
+
+/* Number of concurrent connections (slots) per worker. */
+static uint32_t num_slots = 1;
+
+/* Number of connections opened by each slot. */
+static uint32_t num_conns = 1;
+
+/* Duration of the run in milliseconds, 0 if the run is limited by num_conns instead. */
+static uint32_t duration_ms = 0;
+
+/* If true, connections are reset with SO_LINGER, so that they do not stay in TIME_WAIT. */
+static bool reset;
+
+/* Number of significant bits of the latency histograms. */
+static uint32_t precision = 7;
+
+/* Start and end of the measurement, shared by all workers. */
+static uint64_t start_ns;
+static uint64_t stop_ns = UINT64_MAX;
+
+/* Statistics of a single worker, on its own cache lines, merged after all workers finish. */
+struct worker_stats {
+  /* Histogram of connection latencies. */
+  struct hist hist;
+} __attribute__((aligned(64)));
+
+static struct worker_stats *stats;
+
+/* Quantiles reported in the results, as fractions num / den. */
+static const struct {
+  uint64_t num, den;
+} quantiles[] = {
+    {1, 2}, {9, 10}, {95, 100}, {99, 100}, {995, 1000}, {999, 1000}, {9995, 10000}, {9999, 10000},
+};
+
+#define NUM_QUANTILES (sizeof(quantiles) / sizeof(quantiles[0]))
+
+/* A barrier to start worker_run() loop at the same time. */
+static pthread_barrier_t start_barrier;
+
+/* A barrier to stop measuring the time. */
+static pthread_barrier_t end_barrier;
+
+/* Measured time in nanoseconds. */
+static uint64_t time_diff;
+
+static void print_help(const char *prog_name)
+{
+  fprintf(
+      stderr,
+      "Usage: %s [OPTIONS] <HOST-IPV4> <PORT>\n"
+      "\n"
+      "Each connection sends one request and is closed after the response.\n"
+      "\n"
+      "Options:\n"
+      "  -c, --num-conns   <N>    Number of concurrent connections per worker (default 1)\n"
+      "  -C, --cpus        <LIST> Pin worker i to the i-th CPU of a list such as 0-5,12-17\n"
+      "  -l, --reset              Close connections with RST instead of FIN, which avoids\n"
+      "                           running out of ports due to TIME_WAIT\n"
+      "  -P, --precision   <N>    Number of significant bits of latency histograms (default 7)\n"
+      "  -r, --num-reqs    <N>    Number of connections opened by each concurrent connection\n"
+      "                           one after another (default 1)\n"
+      "  -t, --duration    <N>    Run for N milliseconds instead of a number of connections\n"
+      "  -w, --num-workers <N>    Number of worker threads (default 1)\n",
+      prog_name);
+  exit(1);
+}
+
+static void parse_u32_option(const char *what, uint32_t *p)
+{
+  uint32_t value;
+  if (sscanf(optarg, "%" SCNu32, &value) != 1) {
+    fprintf(stderr, "Parsing %s failed\n", what);
+    exit(1);
+  }
+  if (value < 1) {
+    fprintf(stderr, "%s must be at least 1\n", what);
+    exit(1);
+  }
+  *p = value;
+}
+
+static void parse_options(int argc, char *const *argv)
+{
+  const char *prog_name = argv[0];
+
+  for (;;) {
+    static const struct option long_options[] = {
+        {"num-conns", required_argument, NULL, 'c'},
+        {"cpus", required_argument, NULL, 'C'},
+        {"reset", no_argument, NULL, 'l'},
+        {"precision", required_argument, NULL, 'P'},
+        {"num-reqs", required_argument, NULL, 'r'},
+        {"duration", required_argument, NULL, 't'},
+        {"num-workers", required_argument, NULL, 'w'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int option_index;
+    int c = getopt_long(argc, argv, "hC:c:lP:r:t:w:", long_options, &option_index);
+    if (c == -1)
+      break;
+
+    switch (c) {
+    default:
+    case 'h':
+      print_help(prog_name);
+      UNREACHABLE();
+    case 'c':
+      parse_u32_option("number of connections", &num_slots);
+      break;
+    case 'C':
+      if (!cpus_parse(&worker_cpus, optarg)) {
+        fputs("Parsing CPU list failed\n", stderr);
+        exit(1);
+      }
+      break;
+    case 'l':
+      reset = true;
+      break;
+    case 'P':
+      parse_u32_option("precision", &precision);
+      if (precision > HIST_MAX_PRECISION) {
+        fprintf(stderr, "precision must be at most %d\n", HIST_MAX_PRECISION);
+        exit(1);
+      }
+      break;
+    case 'r':
+      parse_u32_option("number of requests", &num_conns);
+      break;
+    case 't':
+      parse_u32_option("duration", &duration_ms);
+      break;
+    case 'w':
+      parse_u32_option("number of workers", &num_workers);
+      break;
+    }
+  }
+
+  /* Slots never run out of connections in a timed run. */
+  if (duration_ms != 0)
+    num_conns = UINT32_MAX;
+
+  argc -= optind;
+  argv += optind;
+
+  if (argc != 2) {
+    print_help(prog_name);
+    UNREACHABLE();
+  }
+
+  host = argv[0];
+
+  if (sscanf(argv[1], "%" SCNu16, &port) != 1) {
+    fputs("Parsing port failed\n", stderr);
+    exit(1);
+  }
+}
+
+/* Hot path helpers. */
+
+#define GEN_ERR(name, msg)                                                                         \
+  __attribute__((cold, noinline, noreturn)) static void name(void)                                 \
+  {                                                                                                \
+    fputs(msg "\n", stderr);                                                                       \
+    exit(1);                                                                                       \
+  }
+
+#define GEN_PERROR(name, msg)                                                                      \
+  __attribute__((cold, noinline, noreturn)) static void name(void)                                 \
+  {                                                                                                \
+    perror(msg);                                                                                   \
+    exit(1);                                                                                       \
+  }
+
+GEN_ERR(conn_closed_err, "Connection closed before the response")
+GEN_ERR(unexpected_data_err, "Received more data than the response")
+GEN_ERR(write_err, "Writing failed")
+
+GEN_PERROR(socket_err, "Opening client socket failed")
+GEN_PERROR(connect_err, "Connecting to the server failed")
+GEN_PERROR(linger_err, "Setting SO_LINGER failed")
+GEN_PERROR(epoll_ctl_err, "Adding socket to epoll failed")
+GEN_PERROR(read_err, "Reading failed")
+GEN_PERROR(epoll_wait_err, "Waiting for events failed")
+
+__attribute__((cold, noinline, noreturn)) static void sock_err(int err)
+{
+  fprintf(stderr, "Connecting to the server failed: %s\n", strerror(err));
+  exit(1);
+}
+
+__attribute__((always_inline)) static inline uint64_t get_current_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  const uint64_t nsecs_per_sec = 1000 * 1000 * 1000;
+  return (uint64_t)ts.tv_sec * nsecs_per_sec + (uint64_t)ts.tv_nsec;
+}
+
+/* Returns the timeout until the end of a timed run, or NULL to wait indefinitely. */
+__attribute__((always_inline)) static inline struct timespec *stop_timeout(struct timespec *ts)
+{
+  const uint64_t nsecs_per_sec = 1000 * 1000 * 1000;
+  uint64_t cur_ns, timeout_ns;
+
+  if (LIKELY(stop_ns == UINT64_MAX))
+    return NULL;
+
+  cur_ns = get_current_ns();
+  timeout_ns = stop_ns > cur_ns ? stop_ns - cur_ns : 0;
+  ts->tv_sec = (time_t)(timeout_ns / nsecs_per_sec);
+  ts->tv_nsec = (long)(timeout_ns % nsecs_per_sec);
+  return ts;
+}
+
+/* Returns true if a timed run has ended. */
+__attribute__((always_inline)) static inline bool stopped(void)
+{
+  return UNLIKELY(stop_ns != UINT64_MAX) && get_current_ns() >= stop_ns;
+}
+
+/*
+ * Starts a non-blocking connect. The socket is registered for both directions, edge-triggered, so
+ * that one epoll_ctl() call covers the whole connection: EPOLLOUT reports the established
+ * connection, EPOLLIN the response. Closing the socket removes it from the epoll instance.
+ */
+__attribute__((always_inline)) static inline void open_conn(int poller_fd, struct slot *slot)
+{
+  struct epoll_event ev;
+  int sock_fd;
+
+  sock_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (UNLIKELY(sock_fd < 0))
+    socket_err();
+
+  if (reset) {
+    const struct linger linger = {.l_onoff = 1, .l_linger = 0};
+    if (UNLIKELY(setsockopt(sock_fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger)) != 0))
+      linger_err();
+  }
+
+  slot->sock_fd = sock_fd;
+  slot->connecting = true;
+  slot->num_pending = RESPONSE_SIZE;
+  slot->start_ns = get_current_ns();
+
+  if (connect(sock_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) != 0 &&
+      UNLIKELY(errno != EINPROGRESS))
+    connect_err();
+
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  ev.data.ptr = slot;
+  if (UNLIKELY(epoll_ctl(poller_fd, EPOLL_CTL_ADD, sock_fd, &ev) != 0))
+    epoll_ctl_err();
+}
+
+/* Sends the request once the connection is established. */
+__attribute__((always_inline)) static inline void handle_connected(struct slot *slot)
+{
+  ssize_t num_written;
+  int err;
+
+  if (UNLIKELY(getsockopt(slot->sock_fd, SOL_SOCKET, SO_ERROR, &err, &(socklen_t){sizeof(err)}) !=
+               0))
+    connect_err();
+  if (UNLIKELY(err != 0))
+    sock_err(err);
+
+  slot->connecting = false;
+
+  num_written = write(slot->sock_fd, REQUEST, REQUEST_SIZE);
+  if (UNLIKELY(num_written != REQUEST_SIZE))
+    write_err();
+}
+
+/* Returns true if the whole response has been received. */
+__attribute__((always_inline)) static inline bool handle_readable(struct slot *slot)
+{
+  char buf[128];
+
+  for (;;) {
+    ssize_t num_read = read(slot->sock_fd, buf, sizeof(buf));
+    if (num_read < 0) {
+      if (UNLIKELY(errno != EAGAIN))
+        read_err();
+      return false;
+    }
+    if (UNLIKELY(num_read == 0))
+      conn_closed_err();
+    if (UNLIKELY((size_t)num_read > slot->num_pending))
+      unexpected_data_err();
+
+    slot->num_pending -= (uint32_t)num_read;
+    if (slot->num_pending == 0)
+      return true;
+  }
+}
+
+/* Align to 64 bytes to minimize instruction-cache. */
+__attribute__((aligned(64), noinline)) static void worker_run(int poller_fd, struct slot *slots,
+                                                              struct hist *hist)
+{
+  struct epoll_event events[MAX_EVENTS];
+  size_t num_alive_slots = num_slots;
+
+  for (uint32_t i = 0; i < num_slots; i++)
+    open_conn(poller_fd, &slots[i]);
+
+  while (num_alive_slots > 0) {
+    struct timespec ts;
+    int n;
+
+    n = epoll_pwait2(poller_fd, events, MAX_EVENTS, stop_timeout(&ts), /*sigmask=*/NULL);
+    if (UNLIKELY(n < 0))
+      epoll_wait_err();
+
+    /* In a timed run, all slots stop together and the connections in progress are dropped. */
+    if (stopped())
+      break;
+
+    for (int i = 0; i < n; i++) {
+      struct slot *slot = events[i].data.ptr;
+      uint32_t revents = events[i].events;
+
+      /* A connect error is reported by SO_ERROR, a reset after the response is not an error. */
+      if (slot->connecting) {
+        if ((revents & (EPOLLOUT | EPOLLERR | EPOLLHUP)) == 0)
+          continue;
+        handle_connected(slot);
+      }
+
+      if ((revents & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) == 0 || !handle_readable(slot))
+        continue;
+
+      hist_record(hist, get_current_ns() - slot->start_ns);
+      close(slot->sock_fd);
+      slot->sock_fd = -1;
+
+      if (++slot->num_conns == num_conns) {
+        --num_alive_slots;
+        continue;
+      }
+
+      open_conn(poller_fd, slot);
+    }
+  }
+}
+
+/*
+ * Waits until all workers are initialized. The start and the end of a timed run must be seen by all
+ * of them before they start, so they wait for the serial thread to set them.
+ */
+static void start_barrier_wait(void)
+{
+  if (pthread_barrier_wait(&start_barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+    start_ns = get_current_ns();
+    if (duration_ms != 0)
+      stop_ns = start_ns + (uint64_t)duration_ms * 1000 * 1000;
+  }
+
+  pthread_barrier_wait(&start_barrier);
+}
+
+static void *worker(void *arg)
+{
+  struct slot *slots;
+  struct hist *hist;
+  uint32_t thread_no;
+  int poller_fd;
+
+  thread_no = (uint32_t)(uintptr_t)arg;
+
+  /* The histogram is allocated here to be first touched by this thread. */
+
+  hist = &stats[thread_no].hist;
+  if (UNLIKELY(!hist_init(hist, precision))) {
+    fputs("Allocating memory for histogram failed\n", stderr);
+    exit(1);
+  }
+
+  poller_fd = epoll_create1(0);
+  if (UNLIKELY(poller_fd < 0)) {
+    perror("Creating epoll instance failed");
+    exit(1);
+  }
+
+  /* Align to 64 to avoid false sharing. */
+  slots = aligned_alloc(64, (size_t)num_slots * sizeof(*slots));
+  if (UNLIKELY(slots == NULL)) {
+    fputs("Allocating memory for connections failed\n", stderr);
+    exit(1);
+  }
+  for (uint32_t i = 0; i < num_slots; i++) {
+    slots[i].sock_fd = -1;
+    slots[i].num_conns = 0;
+  }
+
+  /* Wait for all threads to finish the initialization and start counting the time. */
+
+  start_barrier_wait();
+
+  /* Start the hot loop. */
+
+  worker_run(poller_fd, slots, hist);
+
+  /* The connections in progress at the end of a timed run are still open. */
+
+  for (uint32_t i = 0; i < num_slots; i++) {
+    if (slots[i].sock_fd >= 0)
+      close(slots[i].sock_fd);
+  }
+
+  /* Wait for all threads to finish the work. */
+
+  pthread_barrier_wait(&end_barrier);
+
+  /* Calculate the taken time. */
+
+  if (thread_no == 0)
+    time_diff = duration_ms != 0 ? stop_ns - start_ns : get_current_ns() - start_ns;
+
+  close(poller_fd);
+  free(slots);
+
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  pthread_t *threads;
+  struct hist *hist;
+  uint64_t q[NUM_QUANTILES];
+  double secs;
+  int err;
+
+  parse_options(argc, argv);
+
+  /* Initialize server address. */
+
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_port = htons(port);
+  if (inet_aton(host, &server_addr.sin_addr) != 1) {
+    fprintf(stderr, "Converting host IPv4 '%s' failed\n", host);
+    return 1;
+  }
+
+  /* Prepare statistics. Align to 64 to avoid false sharing. */
+
+  stats = aligned_alloc(64, (size_t)num_workers * sizeof(*stats));
+  if (UNLIKELY(stats == NULL)) {
+    fputs("Allocating memory for statistics failed\n", stderr);
+    return 1;
+  }
+
+  /* Initialize barriers. */
+
+  err = pthread_barrier_init(&start_barrier, /*attr=*/NULL, num_workers);
+  if (UNLIKELY(err != 0)) {
+    fprintf(stderr, "Creating barrier failed: %s\n", strerror(err));
+    return 1;
+  }
+
+  err = pthread_barrier_init(&end_barrier, /*attr=*/NULL, num_workers);
+  if (UNLIKELY(err != 0)) {
+    fprintf(stderr, "Creating barrier failed: %s\n", strerror(err));
+    return 1;
+  }
+
+  /* Run workers. */
+
+  threads = malloc((size_t)num_workers * sizeof(*threads));
+  if (UNLIKELY(threads == NULL)) {
+    fputs("Allocating memory for threads failed\n", stderr);
+    return 1;
+  }
+
+  for (uint32_t i = 0; i < num_workers; i++) {
+    void *arg = (void *)(uintptr_t)i;
+    pthread_attr_t attr;
+    int err;
+
+    /* A pinned worker starts on its CPU, so that its memory is allocated near it. */
+    pthread_attr_init(&attr);
+    err = cpus_set_attr(&worker_cpus, i, &attr);
+    if (UNLIKELY(err != 0)) {
+      fprintf(stderr, "Setting thread affinity failed: %s\n", strerror(err));
+      return 1;
+    }
+
+    err = pthread_create(&threads[i], &attr, worker, arg);
+    pthread_attr_destroy(&attr);
+    if (UNLIKELY(err != 0)) {
+      fprintf(stderr, "Creating thread failed: %s\n", strerror(err));
+      return 1;
+    }
+  }
+
+  for (uint32_t i = 0; i < num_workers; i++) {
+    int err = pthread_join(threads[i], /*retval=*/NULL);
+    if (UNLIKELY(err != 0)) {
+      fprintf(stderr, "Joining thread failed: %s\n", strerror(err));
+      return 1;
+    }
+  }
+
+  /* Merge statistics of all workers. */
+
+  hist = &stats[0].hist;
+  for (uint32_t i = 1; i < num_workers; i++) {
+    if (!hist_merge(hist, &stats[i].hist)) {
+      fputs("Overflow in the calculation of mean\n", stderr);
+      return 1;
+    }
+  }
+
+  /* Calculate and print results. */
+
+  if (UNLIKELY(hist->count == 0)) {
+    fputs("No connection was completed\n", stderr);
+    return 1;
+  }
+
+  if (hist->count > UINT64_MAX / 9999) {
+    fputs("Overflow in the calculation of quantiles\n", stderr);
+    return 1;
+  }
+
+  for (size_t i = 0; i < NUM_QUANTILES; i++)
+    q[i] = hist_value_at_rank(hist, hist->count * quantiles[i].num / quantiles[i].den);
+
+  secs = (double)time_diff / 1e9;
+  printf("%" PRIu64 " connections in %.2lfs, rate: %.2lf conn/s\n\n", hist->count, secs,
+         (double)hist->count / secs);
+
+  printf("Connect + first response latency [ns]:\n"
+         "  mean:     %" PRIu64 "\n"
+         "  min:      %" PRIu64 "\n"
+         "  max:      %" PRIu64 "\n"
+         "  median:   %" PRIu64 "\n"
+         "  q 0.9:    %" PRIu64 "\n"
+         "  q 0.95:   %" PRIu64 "\n"
+         "  q 0.99:   %" PRIu64 "\n"
+         "  q 0.995:  %" PRIu64 "\n"
+         "  q 0.999:  %" PRIu64 "\n"
+         "  q 0.9995: %" PRIu64 "\n"
+         "  q 0.9999: %" PRIu64 "\n",
+         hist->sum / hist->count, hist->min, hist->max, q[0], q[1], q[2], q[3], q[4], q[5], q[6],
+         q[7]);
+
+  return 0;
+}
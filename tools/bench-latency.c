@@ -12,7 +12,11 @@
 #include <errno.h>
 #include <getopt.h>
 #include <inttypes.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <math.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -21,30 +25,110 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/epoll.h>
-#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
-#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "connect.h"
+#include "cpus.h"
+#include "hist.h"
+#include "proc.h"
+#include "report.h"
+#include "sort.h"
+#include "tsc.h"
+#include "uring.h"
+#include "weights.h"
+#include "wheel.h"
+
 #define LIKELY(e) __builtin_expect((e), 1)
 #define UNLIKELY(e) __builtin_expect((e), 0)
 #define UNREACHABLE() __builtin_unreachable()
+#define CONTAINER_OF(ptr, type, member) ((type *)((char *)(ptr)-offsetof(type, member)))
 
 #define MAX_EVENTS 64
-#define REQUEST "Hello!!!"
+
+/* The hello servers answer each request terminated by an empty line. */
+#define REQUEST "GET / HTTP/1.1\r\n\r\n"
+
+#define NUM_EXTREMES 10
+
+/* Parts of the latency measured with kernel timestamps, see worker_run_timestamping(). */
+enum part {
+  PART_SEND,
+  PART_SERVER,
+  PART_WAKEUP,
+  NUM_PARTS,
+};
+
+/* The timer wheel has 1024 slots of ~65us, so one rotation takes ~67ms. */
+#define WHEEL_SLOTS_LOG2 10
+#define WHEEL_TICK_SHIFT 16
+
+/* Size of a receive buffer, the same as the stack buffer of the epoll engine. */
+#define URING_BUF_SIZE 128
+#define URING_MAX_BUFS 32768
+#define URING_BGID 0
+
+/* The lowest bits of user_data in io_uring requests tell which operation completed. */
+#define URING_TAG_RECV 0u
+#define URING_TAG_WRITE 1u
+#define URING_TAG_MASK 3u
+
+/* The TSC is calibrated for 200ms, a drift above 50ppm by the end of the run is reported. */
+#define TSC_CALIBRATION_MS 200
+#define MAX_TSC_DRIFT_PPM 50
+
+enum engine {
+  ENGINE_EPOLL,
+  ENGINE_IO_URING,
+};
 
 struct conn {
   /* Non-blocking socket file descriptor. */
   int sock_fd;
 
-  /* Non-blocking timer file descriptor. */
-  int timer_fd;
+  /* Index of the socket in the registered files (io_uring engine only). */
+  int file_index;
+
+  /* Timer of the next request in the worker's timer wheel. */
+  struct wheel_timer timer;
 
-  /* Subarray of the global latencies array of size num_reqs assigned to this connection. */
+  /*
+   * Subarray of the worker's latencies of size num_reqs assigned to this connection. Used only if
+   * exact quantiles were requested.
+   */
   uint64_t *latencies;
 
-  /* The last time a write() operation was performed. */
-  uint64_t last_write_ns;
+  /*
+   * The time from which the latency of the outstanding request is measured. In the closed-loop mode
+   * this is the time of the write() call, in the constant-rate mode this is the time at which the
+   * request was scheduled to be sent.
+   */
+  uint64_t start_ns;
+
+  /* The time at which the next request is scheduled to be sent (constant-rate mode only). */
+  uint64_t next_ns;
+
+  /*
+   * The delay before the next request in the closed-loop mode and the interval between requests in
+   * the constant-rate mode, both scaled by the weight of the connection.
+   */
+  uint64_t delay_ns;
+  uint64_t interval_ns;
+
+  /* The time of the last response, valid once the connection is done. */
+  uint64_t end_ns;
+
+  /*
+   * The time of the write() call and the kernel transmit timestamp of the outstanding request, 0 if
+   * not received yet (timestamping mode only).
+   */
+  uint64_t write_ns;
+  uint64_t tx_ns;
 
   /* Number of performed requests so far. */
   uint32_t num_reqs;
@@ -53,11 +137,57 @@ struct conn {
   bool reading;
 };
 
+/* Latency statistics of a single worker, merged after all workers finish. */
+struct worker_stats {
+  /* Histogram of latencies. */
+  struct hist hist;
+
+  /* The lowest latencies in ascending order, padded with UINT64_MAX. */
+  uint64_t best[NUM_EXTREMES];
+
+  /* The highest latencies in descending order, padded with 0. */
+  uint64_t worst[NUM_EXTREMES];
+
+  /* Latencies of all connections of the worker, num_conns * num_reqs of them, if exact is set. */
+  uint64_t *latencies;
+
+  /* Histograms of the parts of the latency and the number of requests without timestamps. */
+  struct hist parts[NUM_PARTS];
+  uint64_t num_untimed;
+} __attribute__((aligned(64)));
+
 /* Server address we are going to connect to. */
 static const char *host;
 static uint16_t port;
 static struct sockaddr_in server_addr;
 
+/* CPUs the workers are pinned to, one worker per CPU in turn, empty if not pinned. */
+static struct cpu_list worker_cpus;
+
+/* How the connections are opened. */
+static struct connect_config connect_config = {.wave_size = CONNECT_DEFAULT_WAVE};
+
+/* Number of connections established by all workers, for the progress readout. */
+static uint64_t num_connected;
+
+/* Number of idle connections of all workers, which stay open but send no requests. */
+static uint32_t num_idle;
+
+/* PID of the server whose memory usage is reported, 0 if none. */
+static uint32_t server_pid;
+
+/* Memory usage of a process in KiB, as reported by /proc/<pid>/smaps_rollup. */
+struct mem_usage {
+  uint64_t rss;
+  uint64_t pss;
+};
+
+/* Memory usage of the server before the connections are opened and after they are set up. */
+static struct mem_usage mem_before, mem_after;
+
+/* CPU time of the server threads at the start and at the end of the measurement. */
+static struct proc_threads server_before, server_after;
+
 /* Number of workers (threads). */
 static uint32_t num_workers = 1;
 
@@ -67,18 +197,121 @@ static uint32_t num_conns = 1;
 /* Number of requests per connection. */
 static uint32_t num_reqs = 1;
 
+/* Duration of the run in milliseconds, 0 if the run is limited by num_reqs instead. */
+static uint32_t duration_ms = 0;
+
+/* I/O engine used by the workers. */
+static enum engine engine = ENGINE_EPOLL;
+
 /* Delay between requests of a single connection. */
-static struct itimerspec delay = {
-    .it_interval = {.tv_sec = 0, .tv_nsec = 0},
-    .it_value = {.tv_sec = 0, .tv_nsec = 1000 * 1000}, /* 1ms */
+static uint64_t delay_ns = 1000 * 1000; /* 1ms */
+
+/*
+ * Requests per second of all connections in the constant-rate (open-loop) mode. If 0, the
+ * closed-loop mode is used, in which the next request is sent the delay after the response.
+ */
+static uint64_t rate;
+
+/* Interval between requests of a single connection in the constant-rate mode. */
+static uint64_t rate_interval_ns;
+
+/*
+ * Distribution of the load over the connections. The weight of a connection divides its delay or
+ * its interval between requests.
+ */
+static struct weights weights;
+static const char *load_name = "uniform";
+
+/* Requests answered on each connection, indexed by rank. */
+static struct conn_load *conn_loads;
+
+/* The time the requests are scheduled from in the constant-rate mode, also the start of a run. */
+static uint64_t rate_start_ns;
+
+/* The end of a timed run, shared by all workers. */
+static uint64_t stop_ns = UINT64_MAX;
+
+/* Number of significant bits of the latency histograms. */
+static uint32_t precision = 7;
+
+/*
+ * If true, all latencies are kept and the quantiles are computed exactly instead of from the
+ * histograms. The memory usage grows with the number of requests.
+ */
+static bool exact;
+
+/* File the merged latency histogram is written to, NULL if none. */
+static const char *hist_output_path;
+
+/* If true, time is read from the invariant TSC instead of CLOCK_MONOTONIC. */
+static bool use_tsc;
+static struct tsc_clock tsc_clock;
+
+/*
+ * If true, the kernel timestamps the requests and responses (SO_TIMESTAMPING), and the latency is
+ * split into parts. The kernel timestamps are in CLOCK_REALTIME, get_current_ns() is ahead of them
+ * by realtime_offset_ns.
+ */
+static bool timestamping;
+static uint64_t realtime_offset_ns;
+
+/* If true, the memory of the workers is backed by transparent huge pages if possible. */
+static bool huge_pages;
+
+/*
+ * Statistics of each worker. They are allocated by the workers themselves, so that the pages
+ * written on the hot path are local to the NUMA node of the worker.
+ */
+static struct worker_stats **stats;
+
+/* Format of the results. */
+static enum report_format format = REPORT_TEXT;
+
+/* If true, the non-empty buckets of the latency histograms are included in json and csv results. */
+static bool report_buckets;
+
+/*
+ * Quantiles reported in the results, as fractions num / den. The text results show those with a
+ * label only, json and csv all of them.
+ */
+static const struct {
+  const char *name, *label;
+  uint64_t num, den;
+} quantiles[] = {
+    {"0.1", NULL, 1, 10},
+    {"0.25", NULL, 1, 4},
+    {"0.5", "median", 1, 2},
+    {"0.75", NULL, 3, 4},
+    {"0.9", "q 0.9", 9, 10},
+    {"0.95", "q 0.95", 95, 100},
+    {"0.99", "q 0.99", 99, 100},
+    {"0.995", "q 0.995", 995, 1000},
+    {"0.999", "q 0.999", 999, 1000},
+    {"0.9995", "q 0.9995", 9995, 10000},
+    {"0.9999", "q 0.9999", 9999, 10000},
+    {"0.99999", NULL, 99999, 100000},
 };
 
-/* Latencies array. The connections will put here measured latencies. */
-static uint64_t *latencies;
+#define NUM_QUANTILES (sizeof(quantiles) / sizeof(quantiles[0]))
+
+/* The largest denominator of the quantiles, the counts must not overflow when multiplied by it. */
+#define MAX_QUANTILE_DEN 100000
+
+/* Latency statistics of a single worker, kept for the results before they are merged. */
+struct worker_summary {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint64_t num_untimed;
+};
 
 /* A barrier to start worker_run() loop at the same time. */
 static pthread_barrier_t start_barrier;
 
+/* A barrier to end the measurement, after which the workers sort their exact latencies. */
+static pthread_barrier_t end_barrier;
+
 static void print_help(const char *prog_name)
 {
   fprintf(
@@ -87,9 +320,35 @@ static void print_help(const char *prog_name)
       "\n"
       "Options:\n"
       "  -c, --num-conns   <N>    Number of connections per worker (default 1)\n"
+      "  -C, --cpus        <LIST> Pin worker i to the i-th CPU of a list such as 0-5,12-17\n"
       "  -d, --delay       <N>    Delay in nanoseconds before sending request (default 1000000)\n"
+      "  -e, --engine      <NAME> I/O engine: epoll or io_uring (default epoll)\n"
+      "  -f, --format      <NAME> Results as text, json or csv (default text)\n"
+      "  -B, --buckets            Include the non-empty histogram buckets in json and csv results\n"
+      "  -H, --hist-output <FILE> Write the latency histogram to FILE, see hist-merge\n"
+      "  -k, --timestamps         Split the latency into the client send path, the server and the\n"
+      "                           client wakeup with kernel timestamps (epoll engine only)\n"
+      "  -I, --idle        <N>    Number of idle connections in total, kept open next to the\n"
+      "                           active ones after one request each (default 0)\n"
+      "  -L, --huge-pages         Back the memory of the workers with transparent huge pages\n"
+      "  -l, --load        <DIST> Spread of the load over the connections: uniform, zipf:<S> or\n"
+      "                           hot:<SHARE>, hot connections have no delay, requires -t\n"
+      "                           (default uniform)\n"
+      "  -M, --server-pid  <PID>  Report the memory usage of the server process with all\n"
+      "                           connections open and the CPU time of its threads\n"
+      "  -P, --precision   <N>    Number of significant bits of latency histograms (default 7)\n"
+      "  -R, --rate        <N>    Send N requests per second in total at a constant rate and\n"
+      "                           measure latency from the scheduled send time (open-loop)\n"
       "  -r, --num-reqs    <N>    Number of requests per connection (default 1)\n"
-      "  -w, --num-workers <N>    Number of worker threads (default 1)\n",
+      "  -t, --duration    <N>    Run for N milliseconds instead of a number of requests\n"
+      "  -T, --tsc                Read time from the TSC calibrated at startup instead of\n"
+      "                           CLOCK_MONOTONIC, if the TSC is invariant\n"
+      "  -s, --source      <A>    Local IPv4 addresses to connect from, comma-separated, ranges\n"
+      "                           as A-B, each adds about 28k ports (default any)\n"
+      "  -A, --reuse-addr         Set SO_REUSEADDR and IP_BIND_ADDRESS_NO_PORT on bound sockets\n"
+      "  -W, --wave        <N>    Connections opened at once by each worker (default 128)\n"
+      "  -w, --num-workers <N>    Number of worker threads (default 1)\n"
+      "  -x, --exact              Keep all latencies and compute exact quantiles\n",
       prog_name);
   exit(1);
 }
@@ -108,6 +367,18 @@ static void parse_u32_option(const char *what, uint32_t *p)
   *p = value;
 }
 
+static void parse_engine_option(enum engine *p)
+{
+  if (strcmp(optarg, "epoll") == 0) {
+    *p = ENGINE_EPOLL;
+  } else if (strcmp(optarg, "io_uring") == 0) {
+    *p = ENGINE_IO_URING;
+  } else {
+    fprintf(stderr, "Unknown engine '%s'\n", optarg);
+    exit(1);
+  }
+}
+
 static void parse_options(int argc, char *const *argv)
 {
   const char *prog_name = argv[0];
@@ -115,14 +386,33 @@ static void parse_options(int argc, char *const *argv)
   for (;;) {
     static const struct option long_options[] = {
         {"num-conns", required_argument, NULL, 'c'},
+        {"cpus", required_argument, NULL, 'C'},
         {"delay", required_argument, NULL, 'd'},
+        {"engine", required_argument, NULL, 'e'},
+        {"format", required_argument, NULL, 'f'},
+        {"buckets", no_argument, NULL, 'B'},
+        {"hist-output", required_argument, NULL, 'H'},
+        {"timestamps", no_argument, NULL, 'k'},
+        {"idle", required_argument, NULL, 'I'},
+        {"huge-pages", no_argument, NULL, 'L'},
+        {"load", required_argument, NULL, 'l'},
+        {"server-pid", required_argument, NULL, 'M'},
+        {"precision", required_argument, NULL, 'P'},
+        {"rate", required_argument, NULL, 'R'},
         {"num-reqs", required_argument, NULL, 'r'},
+        {"duration", required_argument, NULL, 't'},
+        {"tsc", no_argument, NULL, 'T'},
+        {"source", required_argument, NULL, 's'},
+        {"reuse-addr", no_argument, NULL, 'A'},
+        {"wave", required_argument, NULL, 'W'},
         {"num-workers", required_argument, NULL, 'w'},
+        {"exact", no_argument, NULL, 'x'},
         {"help", no_argument, NULL, 'h'},
         {NULL, 0, NULL, 0},
     };
     int option_index;
-    int c = getopt_long(argc, argv, "hc:d:r:w:", long_options, &option_index);
+    int c = getopt_long(argc, argv, "hABC:c:d:e:f:H:I:kLl:M:P:R:r:s:Tt:W:w:x", long_options,
+                        &option_index);
     if (c == -1)
       break;
 
@@ -134,12 +424,86 @@ static void parse_options(int argc, char *const *argv)
     case 'c':
       parse_u32_option("number of connections", &num_conns);
       break;
+    case 'C':
+      if (!cpus_parse(&worker_cpus, optarg)) {
+        fputs("Parsing CPU list failed\n", stderr);
+        exit(1);
+      }
+      break;
     case 'r':
       parse_u32_option("number of requests", &num_reqs);
       break;
+    case 't':
+      parse_u32_option("duration", &duration_ms);
+      break;
     case 'w':
       parse_u32_option("number of workers", &num_workers);
       break;
+    case 's':
+      if (!connect_add_sources(&connect_config, optarg)) {
+        fputs("Parsing source addresses failed\n", stderr);
+        exit(1);
+      }
+      break;
+    case 'A':
+      connect_config.reuse_addr = true;
+      break;
+    case 'W':
+      parse_u32_option("wave size", &connect_config.wave_size);
+      break;
+    case 'P':
+      parse_u32_option("precision", &precision);
+      if (precision > HIST_MAX_PRECISION) {
+        fprintf(stderr, "precision must be at most %d\n", HIST_MAX_PRECISION);
+        exit(1);
+      }
+      break;
+    case 'x':
+      exact = true;
+      break;
+    case 'e':
+      parse_engine_option(&engine);
+      break;
+    case 'f':
+      if (!report_parse_format(optarg, &format)) {
+        fprintf(stderr, "Unknown format '%s'\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'B':
+      report_buckets = true;
+      break;
+    case 'H':
+      hist_output_path = optarg;
+      break;
+    case 'I':
+      parse_u32_option("number of idle connections", &num_idle);
+      break;
+    case 'k':
+      timestamping = true;
+      break;
+    case 'L':
+      huge_pages = true;
+      break;
+    case 'l':
+      if (!weights_parse(&weights, optarg)) {
+        fputs("Parsing load distribution failed\n", stderr);
+        exit(1);
+      }
+      load_name = optarg;
+      break;
+    case 'T':
+      use_tsc = true;
+      break;
+    case 'M':
+      parse_u32_option("server PID", &server_pid);
+      break;
+    case 'R':
+      if (sscanf(optarg, "%" SCNu64, &rate) != 1 || rate < 1) {
+        fputs("Parsing rate failed\n", stderr);
+        exit(1);
+      }
+      break;
     case 'd': {
       long ns;
       if (sscanf(optarg, "%li", &ns) != 1) {
@@ -150,13 +514,41 @@ static void parse_options(int argc, char *const *argv)
         fputs("Delay cannot be negative\n", stderr);
         exit(1);
       }
-      delay.it_value.tv_sec = ns / (1000 * 1000 * 1000);
-      delay.it_value.tv_nsec = ns % (1000 * 1000 * 1000);
+      delay_ns = (uint64_t)ns;
       break;
     }
     }
   }
 
+  /* A constant rate cannot be infinite. */
+  if (weights.kind == WEIGHTS_HOT && rate != 0) {
+    fputs("Hot connections require the closed-loop mode\n", stderr);
+    exit(1);
+  }
+
+  /*
+   * The weights only change the pace of the connections, with a fixed number of requests each
+   * the load would not be skewed, only the run of the light connections stretched.
+   */
+  if (weights.kind != WEIGHTS_UNIFORM && duration_ms == 0) {
+    fputs("A load distribution requires a timed run (--duration)\n", stderr);
+    exit(1);
+  }
+
+  if (timestamping && engine != ENGINE_EPOLL) {
+    fputs("Timestamps require the epoll engine\n", stderr);
+    exit(1);
+  }
+
+  /* Exact latencies are preallocated for num_reqs requests per connection. */
+  if (duration_ms != 0) {
+    if (exact) {
+      fputs("Exact quantiles cannot be computed in a timed run\n", stderr);
+      exit(1);
+    }
+    num_reqs = UINT32_MAX;
+  }
+
   argc -= optind;
   argv += optind;
 
@@ -195,174 +587,794 @@ GEN_ERR(read_err, "Reading failed")
 GEN_ERR(write_err, "Writing failed")
 
 GEN_PERROR(epoll_wait_err, "Waiting for events failed")
-GEN_PERROR(timerfd_settime_err, "Setting timer fd failed");
+
+__attribute__((cold, noinline, noreturn)) static void uring_err(const char *msg, int err)
+{
+  fprintf(stderr, "%s: %s\n", msg, strerror(-err));
+  exit(1);
+}
 
 __attribute__((always_inline)) static inline uint64_t get_current_ns(void)
 {
+  if (use_tsc)
+    return tsc_now_ns(&tsc_clock);
+
   struct timespec ts;
   clock_gettime(CLOCK_MONOTONIC, &ts);
   const uint64_t nsecs_per_sec = 1000 * 1000 * 1000;
   return (uint64_t)ts.tv_sec * nsecs_per_sec + (uint64_t)ts.tv_nsec;
 }
 
+__attribute__((always_inline)) static inline void send_request(struct conn *conn)
+{
+  ssize_t num_written;
+
+  conn->reading = true;
+
+  num_written = write(conn->sock_fd, REQUEST, sizeof(REQUEST) - 1);
+  if (UNLIKELY(num_written != sizeof(REQUEST) - 1))
+    write_err();
+}
+
+__attribute__((always_inline)) static inline void
+record_latency(struct worker_stats *stats, struct conn *conn, uint64_t latency)
+{
+  hist_record(&stats->hist, latency);
+
+  if (UNLIKELY(latency < stats->best[NUM_EXTREMES - 1])) {
+    size_t i = NUM_EXTREMES - 1;
+    for (; i > 0 && stats->best[i - 1] > latency; i--)
+      stats->best[i] = stats->best[i - 1];
+    stats->best[i] = latency;
+  }
+
+  if (UNLIKELY(latency > stats->worst[NUM_EXTREMES - 1])) {
+    size_t i = NUM_EXTREMES - 1;
+    for (; i > 0 && stats->worst[i - 1] < latency; i--)
+      stats->worst[i] = stats->worst[i - 1];
+    stats->worst[i] = latency;
+  }
+
+  if (exact)
+    conn->latencies[conn->num_reqs] = latency;
+}
+
+/*
+ * Schedules the next request of a connection in the worker's timer wheel. In the constant-rate mode
+ * the schedule does not depend on when the response arrived, so a stalled server does not lower
+ * the offered load, and the time spent waiting for the connection to become free is included in
+ * the latency. Returns true if the request is already late and should be sent immediately.
+ */
+__attribute__((always_inline)) static inline bool schedule_request(struct wheel *wheel,
+                                                                   struct conn *conn,
+                                                                   uint64_t cur_ns)
+{
+  uint64_t next_ns;
+
+  if (rate == 0) {
+    wheel_add(wheel, &conn->timer, cur_ns + conn->delay_ns);
+    return false;
+  }
+
+  next_ns = conn->next_ns;
+  if (next_ns <= cur_ns)
+    return true;
+
+  wheel_add(wheel, &conn->timer, next_ns);
+  return false;
+}
+
+/* Sets the time from which the latency of the request that is about to be sent is measured. */
+__attribute__((always_inline)) static inline void start_request(struct conn *conn)
+{
+  if (rate != 0) {
+    conn->start_ns = conn->next_ns;
+    conn->next_ns += conn->interval_ns;
+  } else {
+    conn->start_ns = get_current_ns();
+  }
+}
+
+/*
+ * Returns the timeout until the next deadline in the wheel or the end of a timed run, whichever
+ * comes first, or NULL if there is neither.
+ */
+__attribute__((always_inline)) static inline struct timespec *
+next_timeout(const struct wheel *wheel, struct timespec *ts)
+{
+  const uint64_t nsecs_per_sec = 1000 * 1000 * 1000;
+  uint64_t deadline_ns, cur_ns, timeout_ns;
+
+  deadline_ns = wheel_next_deadline(wheel);
+  if (stop_ns < deadline_ns)
+    deadline_ns = stop_ns;
+  if (deadline_ns == UINT64_MAX)
+    return NULL;
+
+  cur_ns = get_current_ns();
+  timeout_ns = deadline_ns > cur_ns ? deadline_ns - cur_ns : 0;
+  ts->tv_sec = (time_t)(timeout_ns / nsecs_per_sec);
+  ts->tv_nsec = (long)(timeout_ns % nsecs_per_sec);
+  return ts;
+}
+
+/* Returns true if a timed run has ended. */
+__attribute__((always_inline)) static inline bool stopped(void)
+{
+  return UNLIKELY(stop_ns != UINT64_MAX) && get_current_ns() >= stop_ns;
+}
+
 /* Align to 64 bytes to minimize instruction-cache. */
-__attribute__((aligned(64), noinline)) static void worker_run(int poller_fd)
+__attribute__((aligned(64), noinline)) static void worker_run(int poller_fd, struct wheel *wheel,
+                                                              struct worker_stats *stats)
 {
   struct epoll_event events[MAX_EVENTS];
   size_t num_alive_conns = num_conns;
 
   while (num_alive_conns > 0) {
+    struct wheel_timer *timer, *next;
+    struct timespec ts;
     int n;
 
-    n = epoll_wait(poller_fd, events, MAX_EVENTS, -1);
+    /* The wheel is the only timing source, so the delays cost no syscalls. */
+    n = epoll_pwait2(poller_fd, events, MAX_EVENTS, next_timeout(wheel, &ts), /*sigmask=*/NULL);
     if (UNLIKELY(n < 0))
       epoll_wait_err();
 
+    /* In a timed run, all connections stop together and the requests in flight are dropped. */
+    if (stopped())
+      break;
+
     for (int i = 0; i < n; i++) {
-      void *ptr = events[i].data.ptr;
+      char buf[128];
+      struct conn *conn = events[i].data.ptr;
       uint32_t revents = events[i].events;
+      ssize_t num_read;
+      uint64_t cur_ns, start_ns;
 
       if (UNLIKELY((revents & (EPOLLRDHUP | EPOLLERR | EPOLLHUP)) != 0))
         conn_err();
 
-      if (((uintptr_t)ptr & 1) == 0) {
-        char buf[128];
-        struct conn *conn = ptr;
-        ssize_t num_read;
-        uint64_t cur_ns, last_write_ns;
-        int err;
+      num_read = read(conn->sock_fd, buf, sizeof(buf));
+      if (num_read <= 0) {
+        if (UNLIKELY(errno != EAGAIN))
+          read_err();
+        continue;
+      }
+
+      cur_ns = get_current_ns();
+
+      /* We shouldn't get two read events after sending one request. */
+      if (UNLIKELY(!conn->reading))
+        unexpected_read_event_err();
+      conn->reading = false;
+
+      /*
+       * If start_ns is 0, this is the response to the request that was made in worker(), which we
+       * will ignore in the latencies.
+       */
+      start_ns = conn->start_ns;
+      if (LIKELY(start_ns != 0)) {
+        assert(conn->num_reqs < num_reqs);
+        record_latency(stats, conn, cur_ns - start_ns);
+        conn->num_reqs++;
+
+        /* Are we done? */
+        if (UNLIKELY(conn->num_reqs == num_reqs)) {
+          conn->end_ns = cur_ns;
+          close(conn->sock_fd);
+          --num_alive_conns;
+          continue;
+        }
+      }
+
+      if (schedule_request(wheel, conn, cur_ns)) {
+        start_request(conn);
+        send_request(conn);
+      }
+    }
+
+    /* Send the requests whose time has come. */
+    if (wheel->num_timers == 0)
+      continue;
+    for (timer = wheel_expire(wheel, get_current_ns()); timer != NULL; timer = next) {
+      struct conn *conn = CONTAINER_OF(timer, struct conn, timer);
+      next = timer->next;
+      start_request(conn);
+      send_request(conn);
+    }
+  }
+}
+
+/* Returns the software timestamp in a message converted to get_current_ns() time, or 0 if none. */
+static uint64_t get_timestamp(struct msghdr *msg)
+{
+  const uint64_t nsecs_per_sec = 1000 * 1000 * 1000;
+
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+    struct scm_timestamping tss;
+
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPING)
+      continue;
+
+    memcpy(&tss, CMSG_DATA(cmsg), sizeof(tss));
+    return (uint64_t)tss.ts[0].tv_sec * nsecs_per_sec + (uint64_t)tss.ts[0].tv_nsec -
+           realtime_offset_ns;
+  }
+  return 0;
+}
+
+/*
+ * Reads the transmit timestamps from the error queue of the connection. They are queued while the
+ * request is written, so the latest one belongs to the outstanding request.
+ */
+static void read_tx_timestamps(struct conn *conn)
+{
+  for (;;) {
+    char control[256];
+    struct msghdr msg = {.msg_control = control, .msg_controllen = sizeof(control)};
+    uint64_t tx_ns;
+
+    if (recvmsg(conn->sock_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      if (UNLIKELY(errno != EAGAIN))
+        read_err();
+      return;
+    }
+
+    tx_ns = get_timestamp(&msg);
+    if (tx_ns != 0)
+      conn->tx_ns = tx_ns;
+  }
+}
+
+/*
+ * Records the parts of the latency of a response read at cur_ns and received by the kernel at
+ * rx_ns: the client send path from write() to the transmit timestamp, the server from then until
+ * the receive timestamp (both loopback hops included), and the wakeup of the client until read()
+ * returned.
+ */
+static void record_parts(struct worker_stats *stats, const struct conn *conn, uint64_t rx_ns,
+                         uint64_t cur_ns)
+{
+  uint64_t write_ns = conn->write_ns, tx_ns = conn->tx_ns;
+
+  /* Timestamps may be missing, or out of order if CLOCK_REALTIME was stepped. */
+  if (tx_ns == 0 || rx_ns == 0 || tx_ns < write_ns || rx_ns < tx_ns || cur_ns < rx_ns) {
+    stats->num_untimed++;
+    return;
+  }
+
+  hist_record(&stats->parts[PART_SEND], tx_ns - write_ns);
+  hist_record(&stats->parts[PART_SERVER], rx_ns - tx_ns);
+  hist_record(&stats->parts[PART_WAKEUP], cur_ns - rx_ns);
+}
+
+__attribute__((always_inline)) static inline void send_timestamped_request(struct conn *conn)
+{
+  conn->tx_ns = 0;
+  conn->write_ns = get_current_ns();
+  send_request(conn);
+}
+
+/*
+ * The version of worker_run() with kernel timestamps. Responses are read with recvmsg() to get
+ * their receive timestamps, and the transmit timestamps are read from the error queue, whose
+ * entries are also reported as EPOLLERR. The extra syscalls add to the measured latency, so this
+ * mode is for finding where the time goes rather than for the totals.
+ */
+__attribute__((noinline)) static void worker_run_timestamping(int poller_fd, struct wheel *wheel,
+                                                              struct worker_stats *stats)
+{
+  struct epoll_event events[MAX_EVENTS];
+  size_t num_alive_conns = num_conns;
+
+  while (num_alive_conns > 0) {
+    struct wheel_timer *timer, *next;
+    struct timespec ts;
+    int n;
+
+    n = epoll_pwait2(poller_fd, events, MAX_EVENTS, next_timeout(wheel, &ts), /*sigmask=*/NULL);
+    if (UNLIKELY(n < 0))
+      epoll_wait_err();
+
+    if (stopped())
+      break;
+
+    for (int i = 0; i < n; i++) {
+      char buf[128], control[256];
+      struct iovec iov = {.iov_base = buf, .iov_len = sizeof(buf)};
+      struct msghdr msg = {
+          .msg_iov = &iov,
+          .msg_iovlen = 1,
+          .msg_control = control,
+          .msg_controllen = sizeof(control),
+      };
+      struct conn *conn = events[i].data.ptr;
+      uint32_t revents = events[i].events;
+      ssize_t num_read;
+      uint64_t cur_ns, start_ns;
+
+      if (UNLIKELY((revents & (EPOLLRDHUP | EPOLLHUP)) != 0))
+        conn_err();
+
+      read_tx_timestamps(conn);
+
+      num_read = recvmsg(conn->sock_fd, &msg, /*flags=*/0);
+      if (num_read <= 0) {
+        if (UNLIKELY(errno != EAGAIN))
+          read_err();
+        continue;
+      }
+
+      cur_ns = get_current_ns();
+
+      if (UNLIKELY(!conn->reading))
+        unexpected_read_event_err();
+      conn->reading = false;
+
+      start_ns = conn->start_ns;
+      if (LIKELY(start_ns != 0)) {
+        assert(conn->num_reqs < num_reqs);
+        record_latency(stats, conn, cur_ns - start_ns);
+        record_parts(stats, conn, get_timestamp(&msg), cur_ns);
+        conn->num_reqs++;
+
+        if (UNLIKELY(conn->num_reqs == num_reqs)) {
+          conn->end_ns = cur_ns;
+          close(conn->sock_fd);
+          --num_alive_conns;
+          continue;
+        }
+      }
+
+      if (schedule_request(wheel, conn, cur_ns)) {
+        start_request(conn);
+        send_timestamped_request(conn);
+      }
+    }
+
+    if (wheel->num_timers == 0)
+      continue;
+    for (timer = wheel_expire(wheel, get_current_ns()); timer != NULL; timer = next) {
+      struct conn *conn = CONTAINER_OF(timer, struct conn, timer);
+      next = timer->next;
+      start_request(conn);
+      send_timestamped_request(conn);
+    }
+  }
+}
+
+/* Per-worker io_uring state. */
+struct uring_worker {
+  struct uring ring;
+  struct uring_buf_ring buf_ring;
+
+  /* Registered buffer with the request, it must be writable to be registered. */
+  char request[sizeof(REQUEST)];
+};
+
+__attribute__((always_inline)) static inline void uring_queue(struct uring *ring,
+                                                              struct io_uring_sqe **sqe)
+{
+  *sqe = uring_get_sqe(ring);
+  if (UNLIKELY(*sqe == NULL))
+    uring_err("Submitting requests failed", -EBUSY);
+}
+
+__attribute__((always_inline)) static inline void uring_queue_recv(struct uring *ring,
+                                                                   struct conn *conn)
+{
+  struct io_uring_sqe *sqe;
+
+  uring_queue(ring, &sqe);
+  uring_prep_recv_multishot(sqe, conn->file_index, URING_BGID,
+                            (uint64_t)(uintptr_t)conn | URING_TAG_RECV);
+}
+
+__attribute__((always_inline)) static inline void uring_send_request(struct uring_worker *uw,
+                                                                     struct conn *conn)
+{
+  struct io_uring_sqe *sqe;
+
+  conn->reading = true;
+
+  /* Only failed writes post completions. */
+  uring_queue(&uw->ring, &sqe);
+  uring_prep_write_fixed(sqe, conn->file_index, uw->request, sizeof(REQUEST) - 1, /*buf_index=*/0,
+                         (uint64_t)(uintptr_t)conn | URING_TAG_WRITE);
+  sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+}
+
+/*
+ * The io_uring version of worker_run(). Responses are received by one multishot recv per
+ * connection into provided buffers, and the requests are written from a registered buffer to
+ * registered files. All requests queued while processing completions are submitted with one
+ * io_uring_enter() call, which also waits for the next completions or the next deadline in the
+ * timer wheel.
+ */
+__attribute__((aligned(64), noinline)) static void
+worker_run_io_uring(struct uring_worker *uw, struct wheel *wheel, struct worker_stats *stats)
+{
+  struct uring *ring = &uw->ring;
+  size_t num_alive_conns = num_conns;
+
+  while (num_alive_conns > 0) {
+    struct wheel_timer *timer, *next;
+    struct timespec ts;
+    unsigned head, tail;
+    int ret;
+
+    ret = uring_submit_and_wait_timeout(ring, 1, next_timeout(wheel, &ts));
+    if (UNLIKELY(ret < 0))
+      uring_err("Waiting for completions failed", ret);
+
+    if (stopped())
+      break;
+
+    head = uring_cq_head(ring);
+    tail = uring_cq_tail(ring);
+
+    for (; head != tail; head++) {
+      struct io_uring_cqe *cqe = uring_cqe(ring, head);
+      struct conn *conn = (void *)(uintptr_t)(cqe->user_data & ~(uint64_t)URING_TAG_MASK);
+      uint32_t tag = (uint32_t)(cqe->user_data & URING_TAG_MASK);
+      int res = cqe->res;
 
-        num_read = read(conn->sock_fd, buf, sizeof(buf));
-        if (num_read <= 0) {
-          if (UNLIKELY(errno != EAGAIN))
+      if (LIKELY(tag == URING_TAG_RECV)) {
+        uint64_t cur_ns, start_ns;
+
+        if (UNLIKELY(res <= 0)) {
+          if (res == 0)
+            conn_err();
+          if (UNLIKELY(res != -ENOBUFS))
             read_err();
+
+          /* All buffers were in use, which terminated the multishot recv. */
+          uring_queue_recv(ring, conn);
           continue;
         }
 
         cur_ns = get_current_ns();
 
-        /* We shouldn't get two read events after sending one request. */
+        uring_buf_ring_recycle(&uw->buf_ring, (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+
+        /* We shouldn't get two responses after sending one request. */
         if (UNLIKELY(!conn->reading))
           unexpected_read_event_err();
         conn->reading = false;
 
-        /*
-         * If last_write_ns is 0, this is the response to the request that was made in worker(),
-         * which we will ignore in the latencies.
-         */
-        last_write_ns = conn->last_write_ns;
-        if (LIKELY(last_write_ns != 0)) {
+        /* The response to the request that was made in worker() is ignored. */
+        start_ns = conn->start_ns;
+        if (LIKELY(start_ns != 0)) {
           assert(conn->num_reqs < num_reqs);
-          uint64_t latency = cur_ns - last_write_ns;
-          conn->latencies[conn->num_reqs] = latency;
+          record_latency(stats, conn, cur_ns - start_ns);
           conn->num_reqs++;
 
           /* Are we done? */
           if (UNLIKELY(conn->num_reqs == num_reqs)) {
+            conn->end_ns = cur_ns;
             close(conn->sock_fd);
-            close(conn->timer_fd);
             --num_alive_conns;
             continue;
           }
         }
 
-        err = timerfd_settime(conn->timer_fd, 0, &delay, NULL);
-        if (UNLIKELY(err < 0))
-          timerfd_settime_err();
+        if (UNLIKELY((cqe->flags & IORING_CQE_F_MORE) == 0))
+          uring_queue_recv(ring, conn);
+
+        if (schedule_request(wheel, conn, cur_ns)) {
+          start_request(conn);
+          uring_send_request(uw, conn);
+        }
       } else {
-        struct conn *conn = (void *)((uintptr_t)ptr & ~(uintptr_t)1u);
-        ssize_t num_written;
+        write_err();
+      }
+    }
 
-        conn->last_write_ns = get_current_ns();
-        conn->reading = true;
+    uring_cq_advance(ring, head);
 
-        /* Send a request. */
-        num_written = write(conn->sock_fd, REQUEST, sizeof(REQUEST) - 1);
-        if (UNLIKELY(num_written != sizeof(REQUEST) - 1))
-          write_err();
-      }
+    /* Queue the requests whose time has come, they are submitted with the next wait. */
+    if (wheel->num_timers == 0)
+      continue;
+    for (timer = wheel_expire(wheel, get_current_ns()); timer != NULL; timer = next) {
+      struct conn *conn = CONTAINER_OF(timer, struct conn, timer);
+      next = timer->next;
+      start_request(conn);
+      uring_send_request(uw, conn);
     }
   }
 }
 
-static void *worker(void *arg)
+static void uring_worker_init(struct uring_worker *uw, struct conn *conns)
 {
-  struct conn *conns;
-  uint64_t *lat;
-  uint32_t thread_no;
-  int poller_fd;
+  struct iovec iov;
+  uint32_t num_bufs;
+  int *fds;
+  int err;
 
-  thread_no = (uint32_t)(uintptr_t)arg;
-  lat = latencies + (size_t)thread_no * (size_t)num_conns * (size_t)num_reqs;
+  /* Each connection has at most one recv and one failed write in flight. */
+  err = uring_init(&uw->ring, num_conns < 4096 ? num_conns : 4096, 2 * num_conns,
+                   IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN);
+  if (err == -EINVAL)
+    err = uring_init(&uw->ring, num_conns < 4096 ? num_conns : 4096, 2 * num_conns, 0);
+  if (UNLIKELY(err < 0))
+    uring_err("Creating io_uring instance failed", err);
+
+  /* Each connection waits for at most one response. */
+  for (num_bufs = 1; num_bufs < num_conns && num_bufs < URING_MAX_BUFS; num_bufs *= 2)
+    ;
+  err = uring_buf_ring_init(&uw->ring, &uw->buf_ring, URING_BGID, (uint16_t)num_bufs,
+                            URING_BUF_SIZE);
+  if (UNLIKELY(err < 0))
+    uring_err("Registering buffer ring failed", err);
+
+  memcpy(uw->request, REQUEST, sizeof(REQUEST));
+  iov.iov_base = uw->request;
+  iov.iov_len = sizeof(REQUEST) - 1;
+  err = uring_register_buffers(&uw->ring, &iov, 1);
+  if (UNLIKELY(err < 0))
+    uring_err("Registering request buffer failed", err);
+
+  fds = malloc((size_t)num_conns * sizeof(*fds));
+  if (UNLIKELY(fds == NULL)) {
+    fputs("Allocating memory for file descriptors failed\n", stderr);
+    exit(1);
+  }
+  for (uint32_t i = 0; i < num_conns; i++) {
+    conns[i].file_index = (int)i;
+    fds[i] = conns[i].sock_fd;
+  }
+  err = uring_register_files(&uw->ring, fds, num_conns);
+  if (UNLIKELY(err < 0))
+    uring_err("Registering files failed", err);
+  free(fds);
+
+  /* Start receiving. */
+  for (uint32_t i = 0; i < num_conns; i++)
+    uring_queue_recv(&uw->ring, &conns[i]);
+  err = uring_submit_and_wait(&uw->ring, 0);
+  if (UNLIKELY(err < 0))
+    uring_err("Submitting requests failed", err);
+}
+
+static void uring_worker_destroy(struct uring_worker *uw)
+{
+  /* Closing the ring drops the references to the registered sockets. */
+  uring_destroy(&uw->ring);
+  uring_buf_ring_destroy(&uw->buf_ring);
+}
+
+static void read_mem_usage(struct mem_usage *usage)
+{
+  char path[64], line[256];
+  FILE *file;
 
-  poller_fd = epoll_create1(0);
-  if (UNLIKELY(poller_fd < 0)) {
-    perror("Creating epoll instance failed");
+  snprintf(path, sizeof(path), "/proc/%" PRIu32 "/smaps_rollup", server_pid);
+  file = fopen(path, "r");
+  if (UNLIKELY(file == NULL)) {
+    perror("Opening smaps_rollup of the server failed");
     exit(1);
   }
 
-  /* Align to 64 to avoid false sharing. */
-  conns = aligned_alloc(64, (size_t)num_conns * sizeof(*conns));
-  if (UNLIKELY(conns == NULL)) {
-    fputs("Allocating memory for connections failed\n", stderr);
+  usage->rss = 0;
+  usage->pss = 0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    sscanf(line, "Rss: %" SCNu64 " kB", &usage->rss);
+    sscanf(line, "Pss: %" SCNu64 " kB", &usage->pss);
+  }
+
+  fclose(file);
+}
+
+/*
+ * Opens the share of the idle connections of a worker. Each of them does one request and waits for
+ * the response, so that the server has fully set up the connection (accepted it, allocated the
+ * session and the buffers) before its memory is measured. Returns the sockets.
+ */
+static int *open_idle_conns(uint32_t thread_no, size_t *num_fds)
+{
+  size_t share = num_idle / num_workers, rest = num_idle % num_workers, first_no;
+  int *fds;
+  int err;
+
+  *num_fds = share + (thread_no < rest);
+  first_no = (size_t)num_workers * num_conns + thread_no * share +
+             (thread_no < rest ? thread_no : rest);
+
+  fds = malloc((*num_fds != 0 ? *num_fds : 1) * sizeof(*fds));
+  if (UNLIKELY(fds == NULL)) {
+    fputs("Allocating memory for idle sockets failed\n", stderr);
     exit(1);
   }
 
-  /* Initialize connections. */
+  err = connect_all(&connect_config, fds, *num_fds, first_no, &num_connected);
+  if (UNLIKELY(err != 0)) {
+    fprintf(stderr, "Connecting to the server failed: %s\n", strerror(-err));
+    exit(1);
+  }
 
-  for (uint32_t i = 0; i < num_conns; i++, lat += (size_t)num_reqs) {
-    struct epoll_event ev;
-    struct conn *conn = &conns[i];
-    int sock_fd, timer_fd, err;
+  for (size_t i = 0; i < *num_fds; i++) {
+    if (UNLIKELY(write(fds[i], REQUEST, sizeof(REQUEST) - 1) != sizeof(REQUEST) - 1))
+      write_err();
+  }
+
+  for (size_t i = 0; i < *num_fds; i++) {
+    struct pollfd pfd = {.fd = fds[i], .events = POLLIN};
+    char buf[128];
 
-    sock_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (UNLIKELY(sock_fd < 0)) {
-      perror("Opening client socket failed");
+    if (UNLIKELY(poll(&pfd, 1, -1) != 1 || read(fds[i], buf, sizeof(buf)) <= 0)) {
+      fputs("Waiting for the response on an idle connection failed\n", stderr);
       exit(1);
     }
+  }
+
+  return fds;
+}
+
+static void read_server_threads(struct proc_threads *threads)
+{
+  if (UNLIKELY(!proc_read_threads(server_pid, threads))) {
+    perror("Reading the threads of the server failed");
+    exit(1);
+  }
+}
+
+/* Returns the delay scaled down by the weight of the connection of the given rank. */
+static uint64_t conn_delay(uint64_t delay, size_t rank)
+{
+  double weight = weights_get(&weights, rank), scaled;
+
+  if (isinf(weight))
+    return 0;
+
+  /* The lightest connections of a steep Zipf distribution practically never send. */
+  scaled = (double)delay / weight;
+  return scaled < 1e18 ? (uint64_t)scaled : (uint64_t)1e18;
+}
+
+/*
+ * Allocates zeroed memory for the calling worker and writes every page, so that the pages are
+ * placed on the NUMA node of the worker and faulted in before the measurement starts.
+ */
+static void *alloc_worker_memory(size_t size)
+{
+  void *p = mmap(/*addr=*/NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                 /*fd=*/-1, /*offset=*/0);
+  if (UNLIKELY(p == MAP_FAILED))
+    return NULL;
+
+  /* Transparent huge pages may be disabled, then the region stays backed by normal pages. */
+  if (huge_pages)
+    madvise(p, size, MADV_HUGEPAGE);
+
+  memset(p, 0, size);
+  return p;
+}
 
-    err = connect(sock_fd, (struct sockaddr *)&server_addr, sizeof(server_addr));
-    if (UNLIKELY(err < 0)) {
-      perror("Connecting to the server failed");
+static void *worker(void *arg)
+{
+  struct worker_stats *worker_stats;
+  struct uring_worker uw;
+  struct wheel wheel;
+  struct conn *conns;
+  int *fds, *idle_fds;
+  size_t num_idle_fds;
+  uint64_t *lat = NULL;
+  uint32_t thread_no;
+  int poller_fd = -1, err;
+
+  thread_no = (uint32_t)(uintptr_t)arg;
+
+  /* Initialize statistics, they are allocated here to be first touched by this thread. */
+
+  worker_stats = alloc_worker_memory(sizeof(*worker_stats));
+  if (UNLIKELY(worker_stats == NULL)) {
+    fputs("Allocating memory for statistics failed\n", stderr);
+    exit(1);
+  }
+  stats[thread_no] = worker_stats;
+
+  if (exact) {
+    lat = alloc_worker_memory((size_t)num_conns * (size_t)num_reqs * sizeof(*lat));
+    if (UNLIKELY(lat == NULL)) {
+      fputs("Allocating memory for latencies failed\n", stderr);
       exit(1);
     }
+    worker_stats->latencies = lat;
+  }
 
-    err = ioctl(sock_fd, FIONBIO, &(int){1});
-    if (UNLIKELY(err < 0)) {
-      perror("ioctl() on client socket failed");
+  for (size_t i = 0; timestamping && i < NUM_PARTS; i++) {
+    if (UNLIKELY(!hist_init(&worker_stats->parts[i], precision))) {
+      fputs("Allocating memory for histogram failed\n", stderr);
       exit(1);
     }
+  }
+
+  if (UNLIKELY(!hist_init(&worker_stats->hist, precision))) {
+    fputs("Allocating memory for histogram failed\n", stderr);
+    exit(1);
+  }
+  for (size_t i = 0; i < NUM_EXTREMES; i++) {
+    worker_stats->best[i] = UINT64_MAX;
+    worker_stats->worst[i] = 0;
+  }
 
-    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
-    if (UNLIKELY(timer_fd < 0)) {
-      perror("Creating timer failed");
+  if (engine == ENGINE_EPOLL) {
+    poller_fd = epoll_create1(0);
+    if (UNLIKELY(poller_fd < 0)) {
+      perror("Creating epoll instance failed");
       exit(1);
     }
+  }
+
+  conns = alloc_worker_memory((size_t)num_conns * sizeof(*conns));
+  if (UNLIKELY(conns == NULL)) {
+    fputs("Allocating memory for connections failed\n", stderr);
+    exit(1);
+  }
+
+  /* Open the connections in waves, they are spread over the source addresses of all workers. */
+
+  fds = malloc((size_t)num_conns * sizeof(*fds));
+  if (UNLIKELY(fds == NULL)) {
+    fputs("Allocating memory for sockets failed\n", stderr);
+    exit(1);
+  }
+
+  err = connect_all(&connect_config, fds, num_conns, (size_t)thread_no * num_conns, &num_connected);
+  if (UNLIKELY(err != 0)) {
+    fprintf(stderr, "Connecting to the server failed: %s\n", strerror(-err));
+    exit(1);
+  }
+
+  /* Initialize connections. */
+
+  for (uint32_t i = 0; i < num_conns; i++) {
+    struct epoll_event ev;
+    struct conn *conn = &conns[i];
+    size_t rank = (size_t)i * num_workers + thread_no;
+    int sock_fd = fds[i];
 
     conn->sock_fd = sock_fd;
-    conn->timer_fd = timer_fd;
+    conn->file_index = -1;
     conn->latencies = lat;
-    conn->last_write_ns = 0;
+    if (exact)
+      lat += (size_t)num_reqs;
+    conn->start_ns = 0;
+    conn->next_ns = 0;
+    conn->delay_ns = conn_delay(delay_ns, rank);
+    conn->interval_ns = conn_delay(rate_interval_ns, rank);
+    if (conn->interval_ns == 0)
+      conn->interval_ns = 1;
+    conn->end_ns = 0;
     conn->num_reqs = 0;
     conn->reading = true;
 
+    if (engine != ENGINE_EPOLL)
+      continue;
+
+    if (timestamping) {
+      const int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE |
+                        SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_TSONLY;
+      if (UNLIKELY(setsockopt(sock_fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) != 0)) {
+        perror("Enabling timestamping failed");
+        exit(1);
+      }
+    }
+
     ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
     ev.data.ptr = conn;
-    err = epoll_ctl(poller_fd, EPOLL_CTL_ADD, sock_fd, &ev);
-    if (UNLIKELY(err < 0)) {
+    if (UNLIKELY(epoll_ctl(poller_fd, EPOLL_CTL_ADD, sock_fd, &ev) < 0)) {
       perror("Adding client socket to poller failed");
       exit(1);
     }
-
-    ev.events = EPOLLIN | EPOLLET;
-    ev.data.ptr = (void *)((uintptr_t)conn | 1u);
-    err = epoll_ctl(poller_fd, EPOLL_CTL_ADD, timer_fd, &ev);
-    if (UNLIKELY(err < 0)) {
-      perror("Adding client timer to poller failed");
-      exit(1);
-    }
   }
 
+  free(fds);
+
+  if (engine == ENGINE_IO_URING)
+    uring_worker_init(&uw, conns);
+
   /* Send first requests, which are later ignored. */
 
   for (uint32_t i = 0; i < num_conns; i++) {
@@ -374,17 +1386,126 @@ static void *worker(void *arg)
       write_err();
   }
 
-  /* Wait for all threads to finish the initialization. */
+  /* Open the idle connections. */
+
+  idle_fds = open_idle_conns(thread_no, &num_idle_fds);
+
+  /* Wait for all threads to finish the initialization, then all connections are set up. */
+
+  if (pthread_barrier_wait(&start_barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+    if (server_pid != 0) {
+      read_mem_usage(&mem_after);
+      read_server_threads(&server_before);
+    }
+    rate_start_ns = get_current_ns();
+    if (duration_ms != 0)
+      stop_ns = rate_start_ns + (uint64_t)duration_ms * 1000 * 1000;
+  }
+
+  /*
+   * In the constant-rate mode, spread the first requests of all connections evenly over one
+   * interval on the global timeline, which requires all workers to see rate_start_ns. A timed run
+   * requires all workers to see stop_ns.
+   */
+
+  if (rate != 0 || duration_ms != 0)
+    pthread_barrier_wait(&start_barrier);
+
+  if (rate != 0) {
+    const uint64_t nsecs_per_sec = 1000 * 1000 * 1000;
+
+    for (uint32_t i = 0; i < num_conns; i++) {
+      uint64_t conn_no = (uint64_t)thread_no * num_conns + i;
+      conns[i].next_ns = rate_start_ns + conn_no * nsecs_per_sec / rate;
+    }
+  }
+
+  /*
+   * Initialize the timer wheel. The default timer slack of 50us would delay the wake-ups for the
+   * deadlines, which in the constant-rate mode adds to the measured latency.
+   */
+
+  if (UNLIKELY(!wheel_init(&wheel, WHEEL_SLOTS_LOG2, WHEEL_TICK_SHIFT, get_current_ns()))) {
+    fputs("Allocating memory for timer wheel failed\n", stderr);
+    exit(1);
+  }
 
-  pthread_barrier_wait(&start_barrier);
+  if (UNLIKELY(prctl(PR_SET_TIMERSLACK, 1UL) != 0)) {
+    perror("Setting timer slack failed");
+    exit(1);
+  }
 
   /* Start the hot loop. */
 
-  worker_run(poller_fd);
+  if (engine == ENGINE_IO_URING) {
+    worker_run_io_uring(&uw, &wheel, worker_stats);
+    uring_worker_destroy(&uw);
+  } else {
+    if (timestamping)
+      worker_run_timestamping(poller_fd, &wheel, worker_stats);
+    else
+      worker_run(poller_fd, &wheel, worker_stats);
+  }
+
+  wheel_destroy(&wheel);
+
+  for (size_t i = 0; i < num_idle_fds; i++)
+    close(idle_fds[i]);
+  free(idle_fds);
+
+  /* The connections of a timed run are still open. */
+
+  if (duration_ms != 0) {
+    for (uint32_t i = 0; i < num_conns; i++)
+      close(conns[i].sock_fd);
+  }
+
+  /* The ranks are dealt out to the workers in turn. */
+
+  for (uint32_t i = 0; i < num_conns; i++) {
+    const struct conn *conn = &conns[i];
+    struct conn_load *load = &conn_loads[(size_t)i * num_workers + thread_no];
+
+    load->num_reqs = conn->num_reqs;
+    load->time_ns = (duration_ms != 0 ? stop_ns : conn->end_ns) - rate_start_ns;
+  }
+
+  if (pthread_barrier_wait(&end_barrier) == PTHREAD_BARRIER_SERIAL_THREAD && server_pid != 0)
+    read_server_threads(&server_after);
+
+  /* Each worker sorts its own latencies, in parallel and in the memory of its NUMA node. */
+
+  if (exact)
+    sort_u64(worker_stats->latencies, (size_t)num_conns * (size_t)num_reqs);
 
   return NULL;
 }
 
+static void print_parts(const struct worker_stats *stats)
+{
+  static const char *const names[NUM_PARTS] = {
+      [PART_SEND] = "send:",
+      [PART_SERVER] = "server:",
+      [PART_WAKEUP] = "wakeup:",
+  };
+
+  printf("\nParts of latency [ns] (%" PRIu64 " requests without timestamps):\n"
+         "  %-9s%10s %10s %10s %10s %10s %10s\n",
+         stats->num_untimed, "", "mean", "median", "q 0.99", "q 0.999", "q 0.9999", "max");
+  for (size_t p = 0; p < NUM_PARTS; p++) {
+    const struct hist *hist = &stats->parts[p];
+
+    if (hist->count == 0 || hist->count > UINT64_MAX / 9999)
+      continue;
+    printf("  %-9s%10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+           " %10" PRIu64 "\n",
+           names[p], hist->sum / hist->count, hist_value_at_rank(hist, hist->count / 2),
+           hist_value_at_rank(hist, hist->count * 99 / 100),
+           hist_value_at_rank(hist, hist->count * 999 / 1000),
+           hist_value_at_rank(hist, hist->count * 9999 / 10000), hist->max);
+  }
+}
+
 static int cmp_u64(const void *a, const void *b)
 {
   uint64_t lhs = *(uint64_t *)a;
@@ -396,15 +1517,214 @@ static int cmp_u64(const void *a, const void *b)
   return 0;
 }
 
+static int cmp_u64_desc(const void *a, const void *b) { return cmp_u64(b, a); }
+
+/*
+ * Returns the value of the given rank among the exact latencies of all workers, each of which are
+ * sorted. The value is searched for between the minimum and the maximum of the histogram, which
+ * records the same latencies.
+ */
+static uint64_t latency_at_rank(const struct hist *hist, uint64_t rank)
+{
+  size_t worker_len = (size_t)num_conns * (size_t)num_reqs;
+  uint64_t lo = hist->min, hi = hist->max;
+
+  /* The lowest value with more than rank latencies at or below it. */
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2, count = 0;
+
+    for (uint32_t i = 0; i < num_workers; i++)
+      count += sort_count_at_most(stats[i]->latencies, worker_len, mid);
+    if (count > rank)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return lo;
+}
+
+/*
+ * Writes the summary, the quantiles and, if requested, the buckets of a histogram. The quantiles
+ * are taken from q if it is not NULL.
+ */
+static void report_hist(struct report *report, const char *name, const struct hist *hist,
+                        const uint64_t *q)
+{
+  report_object_begin(report, name);
+  report_u64(report, "count", hist->count);
+
+  if (hist->count != 0) {
+    report_u64(report, "mean", hist->sum / hist->count);
+    report_u64(report, "min", hist->min);
+    report_u64(report, "max", hist->max);
+
+    report_object_begin(report, "quantiles");
+    for (size_t i = 0; i < NUM_QUANTILES; i++) {
+      uint64_t rank = hist->count * quantiles[i].num / quantiles[i].den;
+      report_u64(report, quantiles[i].name, q != NULL ? q[i] : hist_value_at_rank(hist, rank));
+    }
+    report_object_end(report);
+  }
+
+  if (report_buckets) {
+    report_array_begin(report, "buckets");
+    for (size_t i = 0; i < hist_num_buckets(hist->precision); i++) {
+      if (hist->buckets[i] == 0)
+        continue;
+      report_object_begin(report, /*name=*/NULL);
+      report_u64(report, "lowest", hist_bucket_lowest(hist->precision, i));
+      report_u64(report, "highest", hist_bucket_highest(hist->precision, i));
+      report_u64(report, "count", hist->buckets[i]);
+      report_object_end(report);
+    }
+    report_array_end(report);
+  }
+
+  report_object_end(report);
+}
+
+/* Writes the configuration, the per-worker statistics and the merged results as JSON or CSV. */
+static void write_report(const struct hist *hist, const uint64_t *q, const uint64_t *best,
+                         const uint64_t *worst, size_t num_extremes,
+                         const struct worker_summary *summaries, double tsc_drift_ppm)
+{
+  static const char *const part_names[NUM_PARTS] = {
+      [PART_SEND] = "send",
+      [PART_SERVER] = "server",
+      [PART_WAKEUP] = "wakeup",
+  };
+  struct report report;
+
+  report_begin(&report, format, stdout);
+
+  report_object_begin(&report, "config");
+  report_str(&report, "host", host);
+  report_u64(&report, "port", port);
+  report_str(&report, "engine", engine == ENGINE_IO_URING ? "io_uring" : "epoll");
+  report_u64(&report, "num_workers", num_workers);
+  report_u64(&report, "num_conns", num_conns);
+  if (duration_ms != 0)
+    report_u64(&report, "duration_ms", duration_ms);
+  else
+    report_u64(&report, "num_reqs", num_reqs);
+  if (rate != 0)
+    report_u64(&report, "rate", rate);
+  else
+    report_u64(&report, "delay_ns", delay_ns);
+  report_str(&report, "load", load_name);
+  report_u64(&report, "num_idle", num_idle);
+  report_u64(&report, "precision", precision);
+  report_bool(&report, "exact", exact);
+  report_bool(&report, "tsc", use_tsc);
+  report_bool(&report, "timestamps", timestamping);
+  report_bool(&report, "huge_pages", huge_pages);
+  report_object_end(&report);
+
+  if (duration_ms != 0) {
+    double secs = (double)duration_ms / 1000;
+
+    report_object_begin(&report, "result");
+    report_u64(&report, "requests", hist->count);
+    report_double(&report, "time_s", secs);
+    report_double(&report, "rate", (double)hist->count / secs);
+    report_object_end(&report);
+  }
+
+  report_hist(&report, "latency", hist, q);
+
+  report_array_begin(&report, "best");
+  for (size_t i = 0; i < num_extremes; i++)
+    report_u64(&report, /*key=*/NULL, best[i]);
+  report_array_end(&report);
+
+  report_array_begin(&report, "worst");
+  for (size_t i = 0; i < num_extremes; i++)
+    report_u64(&report, /*key=*/NULL, worst[i]);
+  report_array_end(&report);
+
+  report_array_begin(&report, "workers");
+  for (uint32_t i = 0; i < num_workers; i++) {
+    const struct worker_summary *summary = &summaries[i];
+
+    report_object_begin(&report, /*name=*/NULL);
+    report_u64(&report, "requests", summary->count);
+    if (summary->count != 0) {
+      report_u64(&report, "mean", summary->sum / summary->count);
+      report_u64(&report, "min", summary->min);
+      report_u64(&report, "max", summary->max);
+    }
+    if (timestamping)
+      report_u64(&report, "untimed", summary->num_untimed);
+    report_object_end(&report);
+  }
+  report_array_end(&report);
+
+  weights_report_load(&weights, &report, conn_loads);
+
+  if (timestamping) {
+    report_object_begin(&report, "parts");
+    report_u64(&report, "untimed", stats[0]->num_untimed);
+    for (size_t p = 0; p < NUM_PARTS; p++)
+      report_hist(&report, part_names[p], &stats[0]->parts[p], /*q=*/NULL);
+    report_object_end(&report);
+  }
+
+  if (use_tsc) {
+    report_object_begin(&report, "clock");
+    report_double(&report, "tsc_ghz", tsc_ghz(&tsc_clock));
+    report_double(&report, "drift_ppm", tsc_drift_ppm);
+    report_object_end(&report);
+  }
+
+  if (server_pid != 0) {
+    uint64_t total_conns = (uint64_t)num_workers * num_conns + num_idle;
+    int64_t rss_diff = (int64_t)mem_after.rss - (int64_t)mem_before.rss;
+    int64_t pss_diff = (int64_t)mem_after.pss - (int64_t)mem_before.pss;
+
+    report_object_begin(&report, "server_memory");
+    report_u64(&report, "conns", total_conns);
+    report_u64(&report, "rss_kib", mem_after.rss);
+    report_i64(&report, "rss_diff_kib", rss_diff);
+    report_u64(&report, "pss_kib", mem_after.pss);
+    report_i64(&report, "pss_diff_kib", pss_diff);
+    report_double(&report, "rss_per_conn_b", (double)rss_diff * 1024 / (double)total_conns);
+    report_double(&report, "pss_per_conn_b", (double)pss_diff * 1024 / (double)total_conns);
+    report_object_end(&report);
+
+    proc_report_threads(&report, &server_before, &server_after);
+  }
+
+  report_end(&report);
+}
+
 int main(int argc, char **argv)
 {
   pthread_t *threads;
-  size_t num_latencies, n;
-  uint64_t sum, mean, min, max, median, q09, q095, q099, q0995, q0999, q09995, q09999;
+  struct hist *hist;
+  struct worker_summary *summaries;
+  uint64_t *best, *worst;
+  double tsc_drift_ppm = 0;
+  uint64_t q[NUM_QUANTILES];
+  size_t num_latencies = 0, num_extremes, n;
   int err;
 
   parse_options(argc, argv);
 
+  /* A million connections need a million file descriptors. */
+
+  if (num_idle != 0) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+      limit.rlim_cur = limit.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &limit);
+    }
+  }
+
+  /* Measure the server before any connection is opened. */
+
+  if (server_pid != 0)
+    read_mem_usage(&mem_before);
+
   /* Initialize server address. */
 
   server_addr.sin_family = AF_INET;
@@ -413,23 +1733,63 @@ int main(int argc, char **argv)
     fprintf(stderr, "Converting host IPv4 '%s' failed\n", host);
     return 1;
   }
+  connect_config.server_addr = server_addr;
+
+  /* Calibrate the TSC before any timestamp is taken. */
 
-  /* Prepare latencies. */
+  if (use_tsc && !tsc_calibrate(&tsc_clock, TSC_CALIBRATION_MS)) {
+    fputs("TSC is not invariant, falling back to CLOCK_MONOTONIC\n", stderr);
+    use_tsc = false;
+  }
 
-  num_latencies = (size_t)num_workers * (size_t)num_conns;
-  if (UNLIKELY((size_t)num_reqs > (SIZE_MAX / sizeof(*latencies)) / num_latencies)) {
-    fputs("num_workers * num_conns * num_reqs * sizeof(uint64_t) overflows size_t\n", stderr);
+  if (timestamping) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    realtime_offset_ns =
+        (uint64_t)ts.tv_sec * 1000 * 1000 * 1000 + (uint64_t)ts.tv_nsec - get_current_ns();
+  }
+
+  /* Calculate the interval between requests of a single connection in the constant-rate mode. */
+
+  if (rate != 0) {
+    uint64_t total_conns = (uint64_t)num_workers * num_conns;
+    const uint64_t nsecs_per_sec = 1000 * 1000 * 1000;
+    if (UNLIKELY(total_conns > UINT64_MAX / nsecs_per_sec)) {
+      fputs("Overflow in the calculation of rate interval\n", stderr);
+      return 1;
+    }
+    rate_interval_ns = total_conns * nsecs_per_sec / rate;
+    if (UNLIKELY(rate_interval_ns == 0)) {
+      fputs("Rate is too high\n", stderr);
+      return 1;
+    }
+  }
+
+  /* Prepare statistics, the workers allocate their own. */
+
+  weights_init(&weights, (size_t)num_workers * num_conns);
+  conn_loads = calloc((size_t)num_workers * num_conns, sizeof(*conn_loads));
+  if (UNLIKELY(conn_loads == NULL)) {
+    fputs("Allocating memory for connection loads failed\n", stderr);
     return 1;
   }
-  num_latencies *= num_reqs;
 
-  latencies = calloc(num_latencies, sizeof(*latencies));
-  if (UNLIKELY(latencies == NULL)) {
-    fputs("Allocating memory for latencies failed\n", stderr);
+  stats = calloc(num_workers, sizeof(*stats));
+  if (UNLIKELY(stats == NULL)) {
+    fputs("Allocating memory for statistics failed\n", stderr);
     return 1;
   }
 
-  /* Initialize the barrier. */
+  if (exact) {
+    num_latencies = (size_t)num_workers * (size_t)num_conns;
+    if (UNLIKELY((size_t)num_reqs > (SIZE_MAX / sizeof(uint64_t)) / num_latencies)) {
+      fputs("num_workers * num_conns * num_reqs * sizeof(uint64_t) overflows size_t\n", stderr);
+      return 1;
+    }
+    num_latencies *= num_reqs;
+  }
+
+  /* Initialize the barriers. */
 
   err = pthread_barrier_init(&start_barrier, /*attr=*/NULL, num_workers);
   if (UNLIKELY(err != 0)) {
@@ -437,6 +1797,12 @@ int main(int argc, char **argv)
     return 1;
   }
 
+  err = pthread_barrier_init(&end_barrier, /*attr=*/NULL, num_workers);
+  if (UNLIKELY(err != 0)) {
+    fprintf(stderr, "Creating barrier failed: %s\n", strerror(err));
+    return 1;
+  }
+
   /* Run workers. */
 
   threads = malloc((size_t)num_workers * sizeof(*threads));
@@ -447,13 +1813,27 @@ int main(int argc, char **argv)
 
   for (uint32_t i = 0; i < num_workers; i++) {
     void *arg = (void *)(uintptr_t)i;
-    int err = pthread_create(&threads[i], /*attr=*/NULL, worker, arg);
+    pthread_attr_t attr;
+    int err;
+
+    /* A pinned worker starts on its CPU, so that its memory is allocated near it. */
+    pthread_attr_init(&attr);
+    err = cpus_set_attr(&worker_cpus, i, &attr);
+    if (UNLIKELY(err != 0)) {
+      fprintf(stderr, "Setting thread affinity failed: %s\n", strerror(err));
+      return 1;
+    }
+
+    err = pthread_create(&threads[i], &attr, worker, arg);
+    pthread_attr_destroy(&attr);
     if (UNLIKELY(err != 0)) {
       fprintf(stderr, "Creating thread failed: %s\n", strerror(err));
       return 1;
     }
   }
 
+  connect_print_progress(&num_connected, (uint64_t)num_workers * num_conns + num_idle);
+
   for (uint32_t i = 0; i < num_workers; i++) {
     int err = pthread_join(threads[i], /*retval=*/NULL);
     if (UNLIKELY(err != 0)) {
@@ -462,62 +1842,168 @@ int main(int argc, char **argv)
     }
   }
 
-  /* Calculate and print results. */
+  /* Check that the TSC clock has kept up with CLOCK_MONOTONIC. */
+
+  if (use_tsc) {
+    uint64_t elapsed_ns;
+    int64_t drift_ns = tsc_drift(&tsc_clock, &elapsed_ns);
+
+    tsc_drift_ppm = (double)drift_ns * 1e6 / (double)elapsed_ns;
+    if (tsc_drift_ppm > MAX_TSC_DRIFT_PPM || tsc_drift_ppm < -MAX_TSC_DRIFT_PPM) {
+      fprintf(stderr, "TSC clock drifted by %" PRId64 "ns (%.1lfppm), latencies are off\n",
+              drift_ns, tsc_drift_ppm);
+    }
+  }
+
+  /* Merge statistics of all workers, the merge overwrites those of the first one. */
 
-  sum = 0;
-  for (size_t i = 0; i < num_latencies; i++) {
-    uint64_t latency = latencies[i];
-    if (sum > UINT64_MAX - latency) {
+  summaries = malloc((size_t)num_workers * sizeof(*summaries));
+  if (UNLIKELY(summaries == NULL)) {
+    fputs("Allocating memory for worker summaries failed\n", stderr);
+    return 1;
+  }
+  for (uint32_t i = 0; i < num_workers; i++) {
+    summaries[i].count = stats[i]->hist.count;
+    summaries[i].sum = stats[i]->hist.sum;
+    summaries[i].min = stats[i]->hist.min;
+    summaries[i].max = stats[i]->hist.max;
+    summaries[i].num_untimed = stats[i]->num_untimed;
+  }
+
+  hist = &stats[0]->hist;
+  for (uint32_t i = 1; i < num_workers; i++) {
+    if (!hist_merge(hist, &stats[i]->hist)) {
       fputs("Overflow in the calculation of mean\n", stderr);
       return 1;
     }
-    sum += latencies[i];
   }
-  mean = sum / num_latencies;
 
-  qsort(latencies, num_latencies, sizeof(*latencies), cmp_u64);
+  for (uint32_t i = 1; timestamping && i < num_workers; i++) {
+    for (size_t p = 0; p < NUM_PARTS; p++) {
+      if (!hist_merge(&stats[0]->parts[p], &stats[i]->parts[p])) {
+        fputs("Overflow in the calculation of mean\n", stderr);
+        return 1;
+      }
+    }
+    stats[0]->num_untimed += stats[i]->num_untimed;
+  }
+
+  /* Save the distribution, so that it can be merged with other rounds. */
+
+  if (hist_output_path != NULL) {
+    FILE *file = fopen(hist_output_path, "wb");
+    if (UNLIKELY(file == NULL)) {
+      perror("Opening histogram file failed");
+      return 1;
+    }
+    if (UNLIKELY(!hist_write(hist, file) || fclose(file) != 0)) {
+      perror("Writing histogram file failed");
+      return 1;
+    }
+  }
 
-#if SIZE_MAX >= UINT64_MAX
-  if (num_latencies > UINT64_MAX / 9999) {
+  best = malloc((size_t)num_workers * NUM_EXTREMES * sizeof(*best));
+  worst = malloc((size_t)num_workers * NUM_EXTREMES * sizeof(*worst));
+  if (UNLIKELY(best == NULL || worst == NULL)) {
+    fputs("Allocating memory for extremes failed\n", stderr);
+    return 1;
+  }
+  for (uint32_t i = 0; i < num_workers; i++) {
+    memcpy(&best[i * NUM_EXTREMES], stats[i]->best, sizeof(stats[i]->best));
+    memcpy(&worst[i * NUM_EXTREMES], stats[i]->worst, sizeof(stats[i]->worst));
+  }
+  num_extremes = (size_t)num_workers * NUM_EXTREMES;
+  qsort(best, num_extremes, sizeof(*best), cmp_u64);
+  qsort(worst, num_extremes, sizeof(*worst), cmp_u64_desc);
+
+  /* Calculate and print results. */
+
+  if (UNLIKELY(hist->count == 0)) {
+    fputs("No request was completed\n", stderr);
+    return 1;
+  }
+
+  if (hist->count > UINT64_MAX / MAX_QUANTILE_DEN) {
     fputs("Overflow in the calculation of quantiles\n", stderr);
     return 1;
   }
-#endif
 
-  min = latencies[0];
-  max = latencies[num_latencies - 1];
-  median = latencies[num_latencies / 2];
-  q09 = latencies[num_latencies * 9 / 10];
-  q095 = latencies[num_latencies * 95 / 100];
-  q099 = latencies[num_latencies * 99 / 100];
-  q0995 = latencies[num_latencies * 995 / 1000];
-  q0999 = latencies[num_latencies * 999 / 1000];
-  q09995 = latencies[num_latencies * 9995 / 10000];
-  q09999 = latencies[num_latencies * 9999 / 10000];
+  if (exact) {
+    size_t worker_size = (size_t)num_conns * (size_t)num_reqs * sizeof(uint64_t);
+
+    /* The latencies of the workers are sorted but never gathered, the quantiles are selected. */
+    for (size_t i = 0; i < NUM_QUANTILES; i++)
+      q[i] = latency_at_rank(hist, num_latencies * quantiles[i].num / quantiles[i].den);
+    for (uint32_t i = 0; i < num_workers; i++)
+      munmap(stats[i]->latencies, worker_size);
+  } else {
+    for (size_t i = 0; i < NUM_QUANTILES; i++)
+      q[i] = hist_value_at_rank(hist, hist->count * quantiles[i].num / quantiles[i].den);
+  }
+
+  n = NUM_EXTREMES;
+  if (n > hist->count)
+    n = (size_t)hist->count;
+
+  if (format != REPORT_TEXT) {
+    write_report(hist, q, best, worst, n, summaries, tsc_drift_ppm);
+    return 0;
+  }
+
+  if (duration_ms != 0) {
+    double secs = (double)duration_ms / 1000;
+    printf("%" PRIu64 " requests in %.2lfs, rate: %.2lf req/s\n\n", hist->count, secs,
+           (double)hist->count / secs);
+  }
 
   printf("Latency [ns]:\n"
          "  mean:     %" PRIu64 "\n"
          "  min:      %" PRIu64 "\n"
-         "  max:      %" PRIu64 "\n"
-         "  median:   %" PRIu64 "\n"
-         "  q 0.9:    %" PRIu64 "\n"
-         "  q 0.95:   %" PRIu64 "\n"
-         "  q 0.99:   %" PRIu64 "\n"
-         "  q 0.995:  %" PRIu64 "\n"
-         "  q 0.999:  %" PRIu64 "\n"
-         "  q 0.9995: %" PRIu64 "\n"
-         "  q 0.9999: %" PRIu64 "\n\n",
-         mean, min, max, median, q09, q095, q099, q0995, q0999, q09995, q09999);
-
-  n = 10;
-  if (n > num_latencies)
-    n = num_latencies;
-  printf("Best %zu:\n", n);
+         "  max:      %" PRIu64 "\n",
+         hist->sum / hist->count, hist->min, hist->max);
+  for (size_t i = 0; i < NUM_QUANTILES; i++) {
+    char label[16];
+
+    if (quantiles[i].label == NULL)
+      continue;
+    snprintf(label, sizeof(label), "%s:", quantiles[i].label);
+    printf("  %-10s%" PRIu64 "\n", label, q[i]);
+  }
+  printf("\nBest %zu:\n", n);
   for (size_t i = 0; i < n; i++)
-    printf("  %2zu. %" PRIu64 "\n", i + 1, latencies[i]);
+    printf("  %2zu. %" PRIu64 "\n", i + 1, best[i]);
   printf("\nWorst %zu:\n", n);
   for (size_t i = 0; i < n; i++)
-    printf("  %2zu. %" PRIu64 "\n", i + 1, latencies[num_latencies - i - 1]);
+    printf("  %2zu. %" PRIu64 "\n", i + 1, worst[i]);
+
+  if (timestamping)
+    print_parts(stats[0]);
+
+  if (weights.kind != WEIGHTS_UNIFORM)
+    weights_print_load(&weights, conn_loads);
+
+  if (use_tsc)
+    printf("\nClock:\n"
+           "  tsc [GHz]:   %.4lf\n"
+           "  drift [ppm]: %.2lf\n",
+           tsc_ghz(&tsc_clock), tsc_drift_ppm);
+
+  if (server_pid != 0) {
+    uint64_t total_conns = (uint64_t)num_workers * num_conns + num_idle;
+    int64_t rss_diff = (int64_t)mem_after.rss - (int64_t)mem_before.rss;
+    int64_t pss_diff = (int64_t)mem_after.pss - (int64_t)mem_before.pss;
+
+    printf("\nServer memory with %" PRIu64 " connections:\n"
+           "  rss [KiB]:          %" PRIu64 " (%+" PRId64 ")\n"
+           "  pss [KiB]:          %" PRIu64 " (%+" PRId64 ")\n"
+           "  rss per conn [B]:   %.0lf\n"
+           "  pss per conn [B]:   %.0lf\n",
+           total_conns, mem_after.rss, rss_diff, mem_after.pss, pss_diff,
+           (double)rss_diff * 1024 / (double)total_conns,
+           (double)pss_diff * 1024 / (double)total_conns);
+
+    proc_print_threads(&server_before, &server_after);
+  }
 
   return 0;
 }
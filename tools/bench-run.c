@@ -0,0 +1,889 @@
+/*
+ * Copyright 2020 Patryk Stefanski
+ *
+ * Licensed under the Apache License, Version 2.0, <LICENSE-APACHE or
+ * http://apache.org/licenses/LICENSE-2.0> or the MIT license <LICENSE-MIT or
+ * http://opensource.org/licenses/MIT>, at your option. This file may not be
+ * copied, modified, or distributed except according to those terms.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <sched.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cpus.h"
+
+#define UNREACHABLE() __builtin_unreachable()
+
+#define MAX_KEYS 16
+#define MAX_SIBLINGS 8
+
+/* Server address, the port is incremented every round. */
+static const char *host;
+static uint16_t start_port;
+static struct sockaddr_in server_addr;
+
+/* Server command, run as <SERVER> <HOST> <PORT> [SERVER-ARGS...]. */
+static char **server_argv;
+static int server_argc;
+
+/* Tool command, run as <TOOL> [TOOL-ARGS...] <HOST> <PORT>. */
+static char **tool_argv;
+static int tool_argc;
+
+/* Keys of the reported values in the output of the tool, the first one controls early stopping. */
+static const char *keys[MAX_KEYS];
+static size_t num_keys;
+
+/* Number of warm-up rounds, whose results are discarded. */
+static uint32_t warmup_rounds = 3;
+
+/* Minimal and maximal number of measured rounds. */
+static uint32_t min_rounds = 5;
+static uint32_t max_rounds = 30;
+
+/* Stop once the half-width of the 95% confidence interval is below this fraction of the mean. */
+static double target_rel_error;
+
+/* Time the server has to accept connections, in milliseconds. */
+static uint32_t ready_timeout_ms = 5000;
+
+/* File the raw per-round results are written to, NULL if none. */
+static const char *output_path;
+
+/* How the CPUs are divided between the server and the tool. */
+enum partition {
+  PARTITION_NONE,
+  PARTITION_CORES,
+  PARTITION_SMT,
+};
+
+static enum partition partition = PARTITION_NONE;
+
+/* CPUs to divide, the CPUs bench-run may run on if empty. */
+static struct cpu_list pool;
+
+/* Number of physical cores given to the server, half of them if 0. */
+static uint32_t server_cores;
+
+/* CPU sets of the server and the tool and their lists in the order the workers are pinned. */
+static cpu_set_t server_set, tool_set;
+static char *server_cpus, *tool_cpus;
+
+/* Placeholders in the arguments and their values, the CPU lists only with a partition. */
+struct placeholder {
+  const char *name;
+  const char *value;
+};
+
+static struct placeholder placeholders[] = {
+    {"{round}", NULL},
+    {"{server-cpus}", NULL},
+    {"{tool-cpus}", NULL},
+};
+static size_t num_placeholders = 1;
+
+/* Results of the measured rounds, results[round * num_keys + key]. */
+static double *results;
+
+static void print_help(const char *prog_name)
+{
+  fprintf(
+      stderr,
+      "Usage: %s [OPTIONS] <HOST-IPV4> <START-PORT> <SERVER> [SERVER-ARGS...] -- <TOOL> "
+      "[TOOL-ARGS...]\n"
+      "\n"
+      "Runs the server as <SERVER> <HOST-IPV4> <PORT> [SERVER-ARGS...] and the tool as\n"
+      "<TOOL> [TOOL-ARGS...] <HOST-IPV4> <PORT> in every round, the port is START-PORT + round.\n"
+      "Each {round} in the arguments is replaced by the number of the measured round, or by wN\n"
+      "for the N-th warm-up round.\n"
+      "\n"
+      "With --partition, the server and the tool are restricted to disjoint sets of CPUs, and\n"
+      "each {server-cpus} and {tool-cpus} in the arguments is replaced by the CPU list of that\n"
+      "side, ordered so that pinning worker i to its i-th CPU spreads the workers over the cores.\n"
+      "\n"
+      "Options:\n"
+      "  -k, --key           <KEY>  Report the number after 'KEY:' in the output of the tool,\n"
+      "                             can be given several times (default rate)\n"
+      "  -W, --warmup        <N>    Number of warm-up rounds (default 3)\n"
+      "  -m, --min-rounds    <N>    Minimal number of measured rounds (default 5)\n"
+      "  -n, --max-rounds    <N>    Maximal number of measured rounds (default 30)\n"
+      "  -e, --rel-error     <PCT>  Stop once the 95%% confidence interval of the first key is\n"
+      "                             within PCT percent of the mean (default off)\n"
+      "  -T, --ready-timeout <N>    Milliseconds the server has to start accepting connections\n"
+      "                             (default 5000)\n"
+      "  -o, --output        <FILE> Write the results of all measured rounds to FILE as CSV\n"
+      "  -p, --partition     <MODE> Divide the CPUs between the server and the tool: cores gives\n"
+      "                             them disjoint physical cores, smt the two SMT siblings of\n"
+      "                             each core (default none)\n"
+      "  -C, --cpus          <LIST> CPUs to divide, such as 0-5,12-17 (default all allowed)\n"
+      "  -S, --server-cores  <N>    Number of physical cores of the server with --partition\n"
+      "                             cores (default half)\n",
+      prog_name);
+  exit(1);
+}
+
+static void parse_u32_option(const char *what, uint32_t *p)
+{
+  uint32_t value;
+  if (sscanf(optarg, "%" SCNu32, &value) != 1) {
+    fprintf(stderr, "Parsing %s failed\n", what);
+    exit(1);
+  }
+  if (value < 1) {
+    fprintf(stderr, "%s must be at least 1\n", what);
+    exit(1);
+  }
+  *p = value;
+}
+
+static void parse_options(int argc, char **argv)
+{
+  const char *prog_name = argv[0];
+  int sep;
+
+  for (;;) {
+    static const struct option long_options[] = {
+        {"key", required_argument, NULL, 'k'},
+        {"warmup", required_argument, NULL, 'W'},
+        {"min-rounds", required_argument, NULL, 'm'},
+        {"max-rounds", required_argument, NULL, 'n'},
+        {"rel-error", required_argument, NULL, 'e'},
+        {"ready-timeout", required_argument, NULL, 'T'},
+        {"output", required_argument, NULL, 'o'},
+        {"partition", required_argument, NULL, 'p'},
+        {"cpus", required_argument, NULL, 'C'},
+        {"server-cores", required_argument, NULL, 'S'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int option_index;
+
+    /* The leading '+' stops at the first non-option, the server and tool arguments are left. */
+    int c = getopt_long(argc, argv, "+hC:k:W:m:n:e:T:o:p:S:", long_options, &option_index);
+    if (c == -1)
+      break;
+
+    switch (c) {
+    default:
+    case 'h':
+      print_help(prog_name);
+      UNREACHABLE();
+    case 'k':
+      if (num_keys == MAX_KEYS) {
+        fprintf(stderr, "At most %d keys can be given\n", MAX_KEYS);
+        exit(1);
+      }
+      keys[num_keys++] = optarg;
+      break;
+    case 'W':
+      /* Zero warm-up rounds are fine. */
+      if (sscanf(optarg, "%" SCNu32, &warmup_rounds) != 1) {
+        fputs("Parsing number of warm-up rounds failed\n", stderr);
+        exit(1);
+      }
+      break;
+    case 'm':
+      parse_u32_option("minimal number of rounds", &min_rounds);
+      break;
+    case 'n':
+      parse_u32_option("maximal number of rounds", &max_rounds);
+      break;
+    case 'e':
+      if (sscanf(optarg, "%lf", &target_rel_error) != 1 || !(target_rel_error > 0)) {
+        fputs("Parsing relative error failed\n", stderr);
+        exit(1);
+      }
+      target_rel_error /= 100;
+      break;
+    case 'T':
+      parse_u32_option("ready timeout", &ready_timeout_ms);
+      break;
+    case 'o':
+      output_path = optarg;
+      break;
+    case 'p':
+      if (strcmp(optarg, "none") == 0) {
+        partition = PARTITION_NONE;
+      } else if (strcmp(optarg, "cores") == 0) {
+        partition = PARTITION_CORES;
+      } else if (strcmp(optarg, "smt") == 0) {
+        partition = PARTITION_SMT;
+      } else {
+        fprintf(stderr, "Unknown partition '%s'\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'C':
+      if (!cpus_parse(&pool, optarg)) {
+        fputs("Parsing CPU list failed\n", stderr);
+        exit(1);
+      }
+      break;
+    case 'S':
+      parse_u32_option("number of server cores", &server_cores);
+      break;
+    }
+  }
+
+  if (num_keys == 0)
+    keys[num_keys++] = "rate";
+
+  if (min_rounds > max_rounds)
+    min_rounds = max_rounds;
+
+  argc -= optind;
+  argv += optind;
+
+  for (sep = 0; sep < argc && strcmp(argv[sep], "--") != 0; sep++)
+    ;
+  if (sep < 3 || sep + 1 >= argc) {
+    print_help(prog_name);
+    UNREACHABLE();
+  }
+
+  host = argv[0];
+
+  if (sscanf(argv[1], "%" SCNu16, &start_port) != 1) {
+    fputs("Parsing port failed\n", stderr);
+    exit(1);
+  }
+
+  server_argv = &argv[2];
+  server_argc = sep - 2;
+  tool_argv = &argv[sep + 1];
+  tool_argc = argc - sep - 1;
+}
+
+static uint64_t get_current_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / (1000 * 1000);
+}
+
+/* A physical core and its CPUs in the pool. */
+struct core {
+  int package, id;
+  unsigned cpus[MAX_SIBLINGS];
+  size_t num_cpus;
+};
+
+/* Reads a topology attribute of the CPU from sysfs, -1 if it is not available. */
+static int read_topology(unsigned cpu, const char *name)
+{
+  char path[128];
+  FILE *file;
+  int value;
+
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/%s", cpu, name);
+  file = fopen(path, "r");
+  if (file == NULL)
+    return -1;
+  if (fscanf(file, "%d", &value) != 1)
+    value = -1;
+  fclose(file);
+  return value;
+}
+
+static int compare_cores(const void *a, const void *b)
+{
+  const struct core *x = a, *y = b;
+
+  if (x->package != y->package)
+    return x->package < y->package ? -1 : 1;
+  if (x->id != y->id)
+    return x->id < y->id ? -1 : 1;
+  return 0;
+}
+
+/*
+ * Adds the CPUs of the cores in [first, last) to the set and the list. Only the siblings of the
+ * given parity are taken, or all of them if parity is negative. The first siblings of all cores
+ * come first in the list, so that the workers pinned in order use every core before its siblings.
+ */
+static void add_cores(const struct core *cores, size_t first, size_t last, int parity,
+                      cpu_set_t *set, FILE *list)
+{
+  bool empty = true;
+
+  for (size_t k = 0; k < MAX_SIBLINGS; k++) {
+    if (parity >= 0 && k % 2 != (size_t)parity)
+      continue;
+    for (size_t i = first; i < last; i++) {
+      if (k >= cores[i].num_cpus)
+        continue;
+      CPU_SET(cores[i].cpus[k], set);
+      fprintf(list, empty ? "%u" : ",%u", cores[i].cpus[k]);
+      empty = false;
+    }
+  }
+}
+
+/* Divides the CPUs of the pool between the server and the tool. */
+static void partition_cpus(void)
+{
+  struct core *cores;
+  size_t num_cores = 0, server_size = 0, tool_size = 0, split;
+  FILE *server_list, *tool_list;
+
+  if (pool.num_cpus == 0) {
+    cpu_set_t allowed;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+      perror("Getting CPU affinity failed");
+      exit(1);
+    }
+    for (unsigned cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      char str[16];
+
+      if (!CPU_ISSET(cpu, &allowed))
+        continue;
+      snprintf(str, sizeof(str), "%u", cpu);
+      if (!cpus_parse(&pool, str)) {
+        fputs("Allocating memory for CPUs failed\n", stderr);
+        exit(1);
+      }
+    }
+  }
+
+  /* Group the CPUs by physical core, a CPU without topology information is a core of its own. */
+
+  cores = calloc(pool.num_cpus, sizeof(*cores));
+  if (cores == NULL) {
+    fputs("Allocating memory for cores failed\n", stderr);
+    exit(1);
+  }
+
+  for (size_t i = 0; i < pool.num_cpus; i++) {
+    unsigned cpu = pool.cpus[i];
+    int package = read_topology(cpu, "physical_package_id"), id = read_topology(cpu, "core_id");
+    size_t j;
+
+    if (package < 0 || id < 0) {
+      package = INT_MAX;
+      id = (int)cpu;
+    }
+
+    for (j = 0; j < num_cores; j++) {
+      if (cores[j].package == package && cores[j].id == id)
+        break;
+    }
+    if (j == num_cores) {
+      cores[j].package = package;
+      cores[j].id = id;
+      num_cores++;
+    }
+
+    if (cores[j].num_cpus < MAX_SIBLINGS)
+      cores[j].cpus[cores[j].num_cpus++] = cpu;
+  }
+
+  qsort(cores, num_cores, sizeof(*cores), compare_cores);
+
+  /* Build the CPU sets and lists of both sides. */
+
+  server_list = open_memstream(&server_cpus, &server_size);
+  tool_list = open_memstream(&tool_cpus, &tool_size);
+  if (server_list == NULL || tool_list == NULL) {
+    perror("Opening CPU lists failed");
+    exit(1);
+  }
+
+  CPU_ZERO(&server_set);
+  CPU_ZERO(&tool_set);
+
+  if (partition == PARTITION_CORES) {
+    split = server_cores != 0 ? server_cores : num_cores / 2;
+    if (split >= num_cores) {
+      fprintf(stderr, "Cannot give %zu of %zu cores to the server\n", split, num_cores);
+      exit(1);
+    }
+    add_cores(cores, 0, split, -1, &server_set, server_list);
+    add_cores(cores, split, num_cores, -1, &tool_set, tool_list);
+  } else {
+    for (size_t i = 0; i < num_cores; i++) {
+      if (cores[i].num_cpus < 2) {
+        fprintf(stderr, "CPU %u has no SMT sibling\n", cores[i].cpus[0]);
+        exit(1);
+      }
+    }
+    add_cores(cores, 0, num_cores, 0, &server_set, server_list);
+    add_cores(cores, 0, num_cores, 1, &tool_set, tool_list);
+  }
+
+  if (fclose(server_list) != 0 || fclose(tool_list) != 0) {
+    perror("Building CPU lists failed");
+    exit(1);
+  }
+  free(cores);
+
+  if (CPU_COUNT(&server_set) == 0 || CPU_COUNT(&tool_set) == 0) {
+    fputs("Not enough CPUs to partition\n", stderr);
+    exit(1);
+  }
+
+  placeholders[1].value = server_cpus;
+  placeholders[2].value = tool_cpus;
+  num_placeholders = 3;
+
+  printf("Server CPUs: %s\nTool CPUs: %s\n\n", server_cpus, tool_cpus);
+  fflush(stdout);
+}
+
+/* Returns the placeholder p starts with, or NULL. */
+static const struct placeholder *find_placeholder(const char *p)
+{
+  for (size_t i = 0; i < num_placeholders; i++) {
+    if (strncmp(p, placeholders[i].name, strlen(placeholders[i].name)) == 0)
+      return &placeholders[i];
+  }
+  return NULL;
+}
+
+/* Returns a copy of the argument with the placeholders replaced, or the argument without any. */
+static char *substitute(char *arg)
+{
+  const struct placeholder *placeholder;
+  size_t size = 1;
+  bool found = false;
+  char *result, *out;
+  const char *p;
+
+  for (p = arg; *p != '\0';) {
+    placeholder = find_placeholder(p);
+    if (placeholder != NULL) {
+      size += strlen(placeholder->value);
+      p += strlen(placeholder->name);
+      found = true;
+    } else {
+      size++;
+      p++;
+    }
+  }
+  if (!found)
+    return arg;
+
+  result = malloc(size);
+  if (result == NULL) {
+    fputs("Allocating memory for arguments failed\n", stderr);
+    exit(1);
+  }
+
+  out = result;
+  for (p = arg; *p != '\0';) {
+    placeholder = find_placeholder(p);
+    if (placeholder != NULL) {
+      size_t len = strlen(placeholder->value);
+      memcpy(out, placeholder->value, len);
+      out += len;
+      p += strlen(placeholder->name);
+    } else {
+      *out++ = *p++;
+    }
+  }
+  *out = '\0';
+  return result;
+}
+
+/*
+ * Builds a NULL-terminated argument vector of the given arguments with the placeholders replaced
+ * and host and port inserted.
+ */
+static char **build_argv(char **args, int num_args, int host_pos, char *port_str)
+{
+  char **argv = malloc((size_t)(num_args + 3) * sizeof(*argv));
+  int j = 0;
+
+  if (argv == NULL) {
+    fputs("Allocating memory for arguments failed\n", stderr);
+    exit(1);
+  }
+
+  for (int i = 0; i <= num_args; i++) {
+    if (i == host_pos) {
+      argv[j++] = (char *)host;
+      argv[j++] = port_str;
+    }
+    if (i < num_args)
+      argv[j++] = substitute(args[i]);
+  }
+  argv[j] = NULL;
+  return argv;
+}
+
+/* Frees an argument vector built by build_argv() from the same arguments. */
+static void free_argv(char **argv, char **args, int num_args, int host_pos)
+{
+  for (int i = 0, j = 0; i < num_args; i++, j++) {
+    if (i == host_pos)
+      j += 2;
+    if (argv[j] != args[i])
+      free(argv[j]);
+  }
+  free(argv);
+}
+
+/* Returns true if the server has exited and prints why. */
+static bool server_exited(pid_t pid)
+{
+  int status;
+
+  if (waitpid(pid, &status, WNOHANG) != pid)
+    return false;
+
+  if (WIFSIGNALED(status))
+    fprintf(stderr, "Server was killed by signal %d\n", WTERMSIG(status));
+  else
+    fprintf(stderr, "Server exited with status %d\n", WEXITSTATUS(status));
+  return true;
+}
+
+/* Starts the server with its output discarded and waits until it accepts connections. */
+static pid_t start_server(uint16_t port)
+{
+  const struct timespec retry_interval = {.tv_sec = 0, .tv_nsec = 1000 * 1000};
+  char port_str[8];
+  char **argv;
+  uint64_t deadline_ms;
+  pid_t pid;
+
+  snprintf(port_str, sizeof(port_str), "%" PRIu16, port);
+  argv = build_argv(server_argv, server_argc, 1, port_str);
+
+  pid = fork();
+  if (pid < 0) {
+    perror("Forking server failed");
+    exit(1);
+  }
+
+  if (pid == 0) {
+    int null_fd;
+
+    if (partition != PARTITION_NONE && sched_setaffinity(0, sizeof(server_set), &server_set) != 0) {
+      perror("Setting CPU affinity of server failed");
+      _exit(127);
+    }
+
+    null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0) {
+      dup2(null_fd, STDOUT_FILENO);
+      dup2(null_fd, STDERR_FILENO);
+    }
+    execv(argv[0], argv);
+    _exit(127);
+  }
+
+  free_argv(argv, server_argv, server_argc, 1);
+
+  /* Probe the server instead of sleeping for a fixed time. */
+
+  server_addr.sin_port = htons(port);
+  deadline_ms = get_current_ms() + ready_timeout_ms;
+
+  for (;;) {
+    int sock_fd, ret;
+
+    sock_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock_fd < 0) {
+      perror("Opening probe socket failed");
+      exit(1);
+    }
+    ret = connect(sock_fd, (struct sockaddr *)&server_addr, sizeof(server_addr));
+    close(sock_fd);
+    if (ret == 0)
+      return pid;
+
+    if (server_exited(pid)) {
+      fputs("Server failed to start\n", stderr);
+      exit(1);
+    }
+    if (get_current_ms() >= deadline_ms) {
+      fputs("Server did not accept connections in time\n", stderr);
+      kill(pid, SIGKILL);
+      exit(1);
+    }
+    nanosleep(&retry_interval, /*rem=*/NULL);
+  }
+}
+
+static void stop_server(pid_t pid, uint32_t round)
+{
+  /* A crashed server would make the results of the round meaningless. */
+  if (server_exited(pid)) {
+    fprintf(stderr, "Server failed during round %" PRIu32 "\n", round);
+    exit(1);
+  }
+
+  kill(pid, SIGTERM);
+  waitpid(pid, /*wstatus=*/NULL, 0);
+}
+
+/* Runs the tool and returns its output. */
+static char *run_tool(uint16_t port)
+{
+  char port_str[8];
+  char **argv;
+  char *output = NULL;
+  size_t size = 0, capacity = 0;
+  int pipe_fds[2], status;
+  pid_t pid;
+
+  snprintf(port_str, sizeof(port_str), "%" PRIu16, port);
+  argv = build_argv(tool_argv, tool_argc, tool_argc, port_str);
+
+  if (pipe(pipe_fds) != 0) {
+    perror("Creating pipe failed");
+    exit(1);
+  }
+
+  pid = fork();
+  if (pid < 0) {
+    perror("Forking tool failed");
+    exit(1);
+  }
+
+  if (pid == 0) {
+    if (partition != PARTITION_NONE && sched_setaffinity(0, sizeof(tool_set), &tool_set) != 0) {
+      perror("Setting CPU affinity of tool failed");
+      _exit(127);
+    }
+
+    dup2(pipe_fds[1], STDOUT_FILENO);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    execvp(argv[0], argv);
+    perror("Executing tool failed");
+    _exit(127);
+  }
+
+  free_argv(argv, tool_argv, tool_argc, tool_argc);
+  close(pipe_fds[1]);
+
+  for (;;) {
+    ssize_t num_read;
+
+    if (capacity - size < 4096) {
+      capacity = capacity != 0 ? 2 * capacity : 16384;
+      output = realloc(output, capacity);
+      if (output == NULL) {
+        fputs("Allocating memory for output failed\n", stderr);
+        exit(1);
+      }
+    }
+
+    num_read = read(pipe_fds[0], output + size, capacity - size - 1);
+    if (num_read < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("Reading output of tool failed");
+      exit(1);
+    }
+    if (num_read == 0)
+      break;
+    size += (size_t)num_read;
+  }
+
+  close(pipe_fds[0]);
+  output[size] = '\0';
+
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fputs("Tool failed\n", stderr);
+    exit(1);
+  }
+
+  return output;
+}
+
+/* Returns the number following the first occurrence of 'key:' in the output. */
+static double parse_value(const char *output, const char *key)
+{
+  size_t key_len = strlen(key);
+  const char *p = output;
+
+  while ((p = strstr(p, key)) != NULL) {
+    if (p[key_len] == ':') {
+      char *end;
+      double value = strtod(p + key_len + 1, &end);
+      if (end != p + key_len + 1)
+        return value;
+    }
+    p += key_len;
+  }
+
+  fprintf(stderr, "No value for '%s' in the output of the tool:\n%s", key, output);
+  exit(1);
+}
+
+/* Two-sided 95% quantiles of Student's t-distribution for 1 to 30 degrees of freedom. */
+static const double t_quantiles[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+};
+
+static double t_quantile(uint32_t df)
+{
+  const double z = 1.959964;
+
+  if (df <= sizeof(t_quantiles) / sizeof(t_quantiles[0]))
+    return t_quantiles[df - 1];
+
+  /* The first term of the Cornish-Fisher expansion is accurate enough for larger samples. */
+  return z + (z * z * z + z) / (4.0 * df);
+}
+
+struct summary {
+  double mean, stddev, ci, min, max;
+};
+
+/* Summarizes the values of the key in the first n rounds. */
+static struct summary summarize(size_t key, uint32_t n)
+{
+  struct summary s = {.min = INFINITY, .max = -INFINITY};
+  double sum_sq = 0;
+
+  for (uint32_t i = 0; i < n; i++) {
+    double value = results[(size_t)i * num_keys + key];
+    s.mean += value;
+    if (value < s.min)
+      s.min = value;
+    if (value > s.max)
+      s.max = value;
+  }
+  s.mean /= n;
+
+  if (n < 2)
+    return s;
+
+  for (uint32_t i = 0; i < n; i++) {
+    double diff = results[(size_t)i * num_keys + key] - s.mean;
+    sum_sq += diff * diff;
+  }
+  s.stddev = sqrt(sum_sq / (n - 1));
+  s.ci = t_quantile(n - 1) * s.stddev / sqrt(n);
+  return s;
+}
+
+static void write_output(uint32_t n)
+{
+  FILE *file = fopen(output_path, "w");
+  if (file == NULL) {
+    perror("Opening output file failed");
+    exit(1);
+  }
+
+  fputs("round", file);
+  for (size_t k = 0; k < num_keys; k++)
+    fprintf(file, ",%s", keys[k]);
+  fputc('\n', file);
+
+  for (uint32_t i = 0; i < n; i++) {
+    fprintf(file, "%" PRIu32, i + 1);
+    for (size_t k = 0; k < num_keys; k++)
+      fprintf(file, ",%.2lf", results[(size_t)i * num_keys + k]);
+    fputc('\n', file);
+  }
+
+  if (fclose(file) != 0) {
+    perror("Writing output file failed");
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t n = 0;
+
+  parse_options(argc, argv);
+
+  server_addr.sin_family = AF_INET;
+  if (inet_aton(host, &server_addr.sin_addr) != 1) {
+    fprintf(stderr, "Converting host IPv4 '%s' failed\n", host);
+    return 1;
+  }
+
+  if (partition != PARTITION_NONE)
+    partition_cpus();
+
+  results = malloc((size_t)max_rounds * num_keys * sizeof(*results));
+  if (results == NULL) {
+    fputs("Allocating memory for results failed\n", stderr);
+    return 1;
+  }
+
+  for (uint32_t round = 1; round <= warmup_rounds + max_rounds; round++) {
+    /* A new port every round works around sockets kept alive by io_uring after the server exits. */
+    uint16_t port = (uint16_t)(start_port + round);
+    bool warmup = round <= warmup_rounds;
+    char round_name[16];
+    pid_t pid;
+    char *output;
+
+    if (warmup)
+      snprintf(round_name, sizeof(round_name), "w%" PRIu32, round);
+    else
+      snprintf(round_name, sizeof(round_name), "%" PRIu32, n + 1);
+    placeholders[0].value = round_name;
+
+    pid = start_server(port);
+    output = run_tool(port);
+    stop_server(pid, round);
+
+    if (warmup) {
+      printf("%" PRIu32 "/%" PRIu32 " warm up\n", round, warmup_rounds);
+      free(output);
+      continue;
+    }
+
+    printf("%" PRIu32 "/%" PRIu32, n + 1, max_rounds);
+    for (size_t k = 0; k < num_keys; k++) {
+      double value = parse_value(output, keys[k]);
+      results[(size_t)n * num_keys + k] = value;
+      printf(" %s=%.2lf", keys[k], value);
+    }
+    putchar('\n');
+    fflush(stdout);
+    free(output);
+    n++;
+
+    if (target_rel_error > 0 && n >= min_rounds && n >= 2) {
+      struct summary s = summarize(0, n);
+      if (s.ci <= target_rel_error * fabs(s.mean)) {
+        printf("Relative error of %s below %.2lf%% after %" PRIu32 " rounds\n", keys[0],
+               target_rel_error * 100, n);
+        break;
+      }
+    }
+  }
+
+  printf("\nResults of %" PRIu32 " rounds (mean ± 95%% confidence interval):\n", n);
+  for (size_t k = 0; k < num_keys; k++) {
+    struct summary s = summarize(k, n);
+    double rel = s.mean != 0 ? 100 * s.ci / fabs(s.mean) : 0;
+    printf("  %s: %.2lf ± %.2lf (%.2lf%%), stddev %.2lf, min %.2lf, max %.2lf\n", keys[k], s.mean,
+           s.ci, rel, s.stddev, s.min, s.max);
+  }
+
+  if (output_path != NULL)
+    write_output(n);
+
+  return 0;
+}
@@ -13,29 +13,109 @@
 #include <inttypes.h>
 #include <netinet/in.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/epoll.h>
-#include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "connect.h"
+#include "cpus.h"
+#include "proc.h"
+#include "report.h"
+#include "uring.h"
+#include "weights.h"
+
 #define LIKELY(e) __builtin_expect((e), 1)
 #define UNLIKELY(e) __builtin_expect((e), 0)
 #define UNREACHABLE() __builtin_unreachable()
 
 #define MAX_EVENTS 64
-#define REQUEST "Hello!!!"
+
+/*
+ * The hello servers find the end of each request, so that pipelined requests can be answered in
+ * one batch. The responses are counted by their size.
+ */
+#define REQUEST "GET / HTTP/1.1\r\n\r\n"
+#define RESPONSE "HTTP/1.1 200 OK\nContent-Length: 12\n\nHello world!"
+#define REQUEST_SIZE (sizeof(REQUEST) - 1)
+#define RESPONSE_SIZE (sizeof(RESPONSE) - 1)
+
+/*
+ * A batch must fit into the 1024-byte read buffers of the servers. Otherwise the servers answer it
+ * with several writes, and the later ones wait for an ACK due to Nagle's algorithm.
+ */
+#define MAX_PIPELINE ((uint32_t)(1024 / REQUEST_SIZE))
+
+/* Size of a receive buffer of the epoll engine. */
+#define BUF_SIZE 4096
+
+/* Size of a provided receive buffer of the io_uring engine. */
+#define URING_BUF_SIZE 128
+#define URING_MAX_BUFS 32768
+#define URING_BGID 0
+
+/* The lowest bits of user_data in io_uring requests tell which operation completed. */
+#define URING_TAG_RECV 0u
+#define URING_TAG_WRITE 1u
+#define URING_TAG_MASK 3u
+
+/*
+ * Intervals at the start and at the end of the run with a rate below this fraction of the median
+ * rate are considered warm-up and drain, and are excluded from the steady-state rate.
+ */
+#define STEADY_STATE_THRESHOLD 0.9
+
+enum engine {
+  ENGINE_EPOLL,
+  ENGINE_IO_URING,
+};
 
 struct conn {
   /* Non-blocking socket file descriptor. */
   int sock_fd;
 
+  /* Index of the socket in the registered files (io_uring engine only). */
+  int file_index;
+
   /* Number of performed requests so far. */
   uint32_t num_reqs;
+
+  /* Number of requests sent in one batch, the weight of the connection sets it. */
+  uint32_t pipeline;
+
+  /* Number of requests in the current batch. */
+  uint32_t batch;
+
+  /* Number of bytes of the responses to the current batch that have not been received yet. */
+  uint32_t num_pending;
+
+  /* Time when the last response was received, valid once the connection is done. */
+  uint64_t end_ns;
+};
+
+/* Progress of a worker, written by the worker and sampled by the reporter. */
+struct worker_counter {
+  /* Number of answered requests so far. */
+  uint64_t num_reqs;
+
+  /* Time when the worker finished its work, valid once it is not running. */
+  uint64_t end_ns;
+} __attribute__((aligned(64)));
+
+/* The number of answered requests of all workers at the end of an interval. */
+struct sample {
+  /* Time since the start. */
+  uint64_t time_ns;
+
+  uint64_t num_reqs;
 };
 
 /* Server address we are going to connect to. */
@@ -43,6 +123,15 @@ static const char *host;
 static uint16_t port;
 static struct sockaddr_in server_addr;
 
+/* CPUs the workers are pinned to, one worker per CPU in turn, empty if not pinned. */
+static struct cpu_list worker_cpus;
+
+/* How the connections are opened. */
+static struct connect_config connect_config = {.wave_size = CONNECT_DEFAULT_WAVE};
+
+/* Number of connections established by all workers, for the progress readout. */
+static uint64_t num_connected;
+
 /* Number of workers (threads). */
 static uint32_t num_workers = 1;
 
@@ -52,6 +141,54 @@ static uint32_t num_conns = 1;
 /* Number of requests per connection. */
 static uint32_t num_reqs = 1;
 
+/* Duration of the run in milliseconds, 0 if the run is limited by num_reqs instead. */
+static uint32_t duration_ms = 0;
+
+/* Start and end of the measurement, shared by all workers. */
+static uint64_t start_ns;
+static uint64_t stop_ns = UINT64_MAX;
+
+/* Number of requests sent back to back by a connection before waiting for the responses. */
+static uint32_t pipeline = 1;
+
+/*
+ * Distribution of the load over the connections. The heaviest connection pipelines the full depth,
+ * the others in proportion to their weight.
+ */
+static struct weights weights;
+static const char *load_name = "uniform";
+
+/* Requests answered on each connection, indexed by rank. */
+static struct conn_load *conn_loads;
+
+/* PID of the server whose threads are reported, 0 if none. */
+static uint32_t server_pid;
+
+/* CPU time of the server threads at the start and at the end of the run. */
+static struct proc_threads server_before, server_after;
+
+/* The requests of a full batch, sent with one write. */
+static char *requests;
+
+/* I/O engine used by the workers. */
+static enum engine engine = ENGINE_EPOLL;
+
+/* Interval of the throughput time series in milliseconds, 0 if disabled. */
+static uint32_t interval_ms = 0;
+
+/* Format of the results. */
+static enum report_format format = REPORT_TEXT;
+
+/* Per-worker progress counters, one cache line each. */
+static struct worker_counter *counters;
+
+/* Number of workers that have not finished their work yet. */
+static uint32_t num_running_workers;
+
+/* Time series collected by the reporter. */
+static struct sample *samples;
+static size_t num_samples;
+
 /* Barrier to wait until all threads are initialized, so that we can start to measure the time. */
 static pthread_barrier_t start_barrier;
 
@@ -62,14 +199,29 @@ static uint64_t time_diff;
 
 static void print_help(const char *prog_name)
 {
-  fprintf(stderr,
-          "Usage: %s [OPTIONS] <HOST-IPV4> <PORT>\n"
-          "\n"
-          "Options:\n"
-          "  -c, --num-conns   <N>    Number of connections per worker (default 1)\n"
-          "  -r, --num-reqs    <N>    Number of requests per connection (default 1)\n"
-          "  -w, --num-workers <N>    Number of worker threads (default 1)\n",
-          prog_name);
+  fprintf(
+      stderr,
+      "Usage: %s [OPTIONS] <HOST-IPV4> <PORT>\n"
+      "\n"
+      "Options:\n"
+      "  -c, --num-conns   <N>    Number of connections per worker (default 1)\n"
+      "  -C, --cpus        <LIST> Pin worker i to the i-th CPU of a list such as 0-5,12-17\n"
+      "  -e, --engine      <NAME> I/O engine: epoll or io_uring (default epoll)\n"
+      "  -f, --format      <NAME> Results as text, json or csv (default text)\n"
+      "  -i, --interval    <N>    Print the rate every N milliseconds (default off)\n"
+      "  -l, --load        <DIST> Spread of the load over the connections: uniform, zipf:<S> or\n"
+      "                           hot:<SHARE>, which scales the pipeline depth of each\n"
+      "                           connection, requires -t (default uniform)\n"
+      "  -M, --server-pid  <PID>  Report the CPU time of each server thread\n"
+      "  -p, --pipeline    <N>    Number of requests sent in one batch (default 1)\n"
+      "  -r, --num-reqs    <N>    Number of requests per connection (default 1)\n"
+      "  -t, --duration    <N>    Run for N milliseconds instead of a number of requests\n"
+      "  -s, --source      <A>    Local IPv4 addresses to connect from, comma-separated, ranges\n"
+      "                           as A-B, each adds about 28k ports (default any)\n"
+      "  -A, --reuse-addr         Set SO_REUSEADDR and IP_BIND_ADDRESS_NO_PORT on bound sockets\n"
+      "  -W, --wave        <N>    Connections opened at once by each worker (default 128)\n"
+      "  -w, --num-workers <N>    Number of worker threads (default 1)\n",
+      prog_name);
   exit(1);
 }
 
@@ -87,6 +239,18 @@ static void parse_u32_option(const char *what, uint32_t *p)
   *p = value;
 }
 
+static void parse_engine_option(enum engine *p)
+{
+  if (strcmp(optarg, "epoll") == 0) {
+    *p = ENGINE_EPOLL;
+  } else if (strcmp(optarg, "io_uring") == 0) {
+    *p = ENGINE_IO_URING;
+  } else {
+    fprintf(stderr, "Unknown engine '%s'\n", optarg);
+    exit(1);
+  }
+}
+
 static void parse_options(int argc, char *const *argv)
 {
   const char *prog_name = argv[0];
@@ -94,13 +258,24 @@ static void parse_options(int argc, char *const *argv)
   for (;;) {
     static const struct option long_options[] = {
         {"num-conns", required_argument, NULL, 'c'},
+        {"cpus", required_argument, NULL, 'C'},
+        {"engine", required_argument, NULL, 'e'},
+        {"format", required_argument, NULL, 'f'},
+        {"interval", required_argument, NULL, 'i'},
+        {"load", required_argument, NULL, 'l'},
+        {"server-pid", required_argument, NULL, 'M'},
+        {"pipeline", required_argument, NULL, 'p'},
         {"num-reqs", required_argument, NULL, 'r'},
+        {"duration", required_argument, NULL, 't'},
+        {"source", required_argument, NULL, 's'},
+        {"reuse-addr", no_argument, NULL, 'A'},
+        {"wave", required_argument, NULL, 'W'},
         {"num-workers", required_argument, NULL, 'w'},
         {"help", no_argument, NULL, 'h'},
         {NULL, 0, NULL, 0},
     };
     int option_index;
-    int c = getopt_long(argc, argv, "hc:r:w:", long_options, &option_index);
+    int c = getopt_long(argc, argv, "hAC:c:e:f:i:l:M:p:r:s:t:W:w:", long_options, &option_index);
     if (c == -1)
       break;
 
@@ -112,15 +287,82 @@ static void parse_options(int argc, char *const *argv)
     case 'c':
       parse_u32_option("number of connections", &num_conns);
       break;
+    case 'C':
+      if (!cpus_parse(&worker_cpus, optarg)) {
+        fputs("Parsing CPU list failed\n", stderr);
+        exit(1);
+      }
+      break;
     case 'r':
       parse_u32_option("number of requests", &num_reqs);
       break;
     case 'w':
       parse_u32_option("number of workers", &num_workers);
       break;
+    case 's':
+      if (!connect_add_sources(&connect_config, optarg)) {
+        fputs("Parsing source addresses failed\n", stderr);
+        exit(1);
+      }
+      break;
+    case 'A':
+      connect_config.reuse_addr = true;
+      break;
+    case 'W':
+      parse_u32_option("wave size", &connect_config.wave_size);
+      break;
+    case 'e':
+      parse_engine_option(&engine);
+      break;
+    case 'f':
+      if (!report_parse_format(optarg, &format)) {
+        fprintf(stderr, "Unknown format '%s'\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'i':
+      parse_u32_option("interval", &interval_ms);
+      break;
+    case 'l':
+      if (!weights_parse(&weights, optarg)) {
+        fputs("Parsing load distribution failed\n", stderr);
+        exit(1);
+      }
+      load_name = optarg;
+      break;
+    case 'M':
+      parse_u32_option("server PID", &server_pid);
+      break;
+    case 'p':
+      parse_u32_option("pipeline depth", &pipeline);
+      if (pipeline > MAX_PIPELINE) {
+        fprintf(stderr, "Pipeline depth must be at most %" PRIu32 "\n", MAX_PIPELINE);
+        exit(1);
+      }
+      break;
+    case 't':
+      parse_u32_option("duration", &duration_ms);
+      break;
     }
   }
 
+  /* Connections never run out of requests in a timed run. */
+  if (duration_ms != 0)
+    num_reqs = UINT32_MAX;
+
+  /*
+   * The weights only change the pipeline depths, which skews the load only if the connections do
+   * not stop after a fixed number of requests each.
+   */
+  if (weights.kind != WEIGHTS_UNIFORM && pipeline == 1) {
+    fputs("A load distribution requires a pipeline depth above 1\n", stderr);
+    exit(1);
+  }
+  if (weights.kind != WEIGHTS_UNIFORM && duration_ms == 0) {
+    fputs("A load distribution requires a timed run (--duration)\n", stderr);
+    exit(1);
+  }
+
   argc -= optind;
   argv += optind;
 
@@ -156,27 +398,95 @@ static void parse_options(int argc, char *const *argv)
 GEN_ERR(conn_err, "Got error on a socket")
 GEN_ERR(read_err, "Reading failed")
 GEN_ERR(write_err, "Writing failed")
+GEN_ERR(unexpected_data_err, "Received more data than the responses to the batch")
 
 GEN_PERROR(epoll_wait_err, "Waiting for events failed")
 
+static inline uint64_t get_current_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  const uint64_t nsecs_per_sec = 1000 * 1000 * 1000;
+  return (uint64_t)ts.tv_sec * nsecs_per_sec + (uint64_t)ts.tv_nsec;
+}
+
+/* Returns the timeout until the end of a timed run, or NULL to wait indefinitely. */
+__attribute__((always_inline)) static inline struct timespec *stop_timeout(struct timespec *ts)
+{
+  const uint64_t nsecs_per_sec = 1000 * 1000 * 1000;
+  uint64_t cur_ns, timeout_ns;
+
+  if (LIKELY(stop_ns == UINT64_MAX))
+    return NULL;
+
+  cur_ns = get_current_ns();
+  timeout_ns = stop_ns > cur_ns ? stop_ns - cur_ns : 0;
+  ts->tv_sec = (time_t)(timeout_ns / nsecs_per_sec);
+  ts->tv_nsec = (long)(timeout_ns % nsecs_per_sec);
+  return ts;
+}
+
+/* Returns true if a timed run has ended. */
+__attribute__((always_inline)) static inline bool stopped(void)
+{
+  return UNLIKELY(stop_ns != UINT64_MAX) && get_current_ns() >= stop_ns;
+}
+
+__attribute__((cold, noinline, noreturn)) static void uring_err(const char *msg, int err)
+{
+  fprintf(stderr, "%s: %s\n", msg, strerror(-err));
+  exit(1);
+}
+
+/* Accounts the requests of the next batch of a connection and returns their number. */
+__attribute__((always_inline)) static inline uint32_t start_batch(struct conn *conn)
+{
+  uint32_t batch = num_reqs - conn->num_reqs;
+
+  if (batch > conn->pipeline)
+    batch = conn->pipeline;
+  conn->num_reqs += batch;
+  conn->batch = batch;
+  conn->num_pending = batch * (uint32_t)RESPONSE_SIZE;
+  return batch;
+}
+
+/* Accounts received bytes of responses. Returns true if the whole batch has been answered. */
+__attribute__((always_inline)) static inline bool receive_responses(struct conn *conn,
+                                                                   uint32_t num_received)
+{
+  if (UNLIKELY(num_received > conn->num_pending))
+    unexpected_data_err();
+  conn->num_pending -= num_received;
+  return conn->num_pending == 0;
+}
+
 /* Align to 64 bytes to minimize instruction-cache. */
-__attribute__((aligned(64), noinline)) static void worker_run(int poller_fd)
+__attribute__((aligned(64), noinline)) static void worker_run(int poller_fd,
+                                                              struct worker_counter *counter)
 {
   struct epoll_event events[MAX_EVENTS];
   size_t num_alive_conns = num_conns;
+  uint64_t num_answered = 0;
 
   while (num_alive_conns > 0) {
+    struct timespec ts;
     int n;
 
-    n = epoll_wait(poller_fd, events, MAX_EVENTS, -1);
+    n = epoll_pwait2(poller_fd, events, MAX_EVENTS, stop_timeout(&ts), /*sigmask=*/NULL);
     if (UNLIKELY(n < 0))
       epoll_wait_err();
 
+    /* In a timed run, all connections stop together and late responses are not counted. */
+    if (stopped())
+      break;
+
     for (int i = 0; i < n; i++) {
-      char buf[128];
+      char buf[BUF_SIZE];
       struct conn *conn;
       ssize_t num_read, num_written;
-      uint32_t revents;
+      uint32_t revents, batch;
+      bool answered = false;
 
       conn = events[i].data.ptr;
       revents = events[i].events;
@@ -184,50 +494,272 @@ __attribute__((aligned(64), noinline)) static void worker_run(int poller_fd)
       if (UNLIKELY((revents & (EPOLLRDHUP | EPOLLERR | EPOLLHUP)) != 0))
         conn_err();
 
-      num_read = read(conn->sock_fd, buf, sizeof(buf));
-      if (UNLIKELY(num_read <= 0)) {
-        if (UNLIKELY(errno != EAGAIN))
-          read_err();
+      /* The socket is edge-triggered, so read until a read does not fill the buffer. */
+      do {
+        num_read = read(conn->sock_fd, buf, sizeof(buf));
+        if (UNLIKELY(num_read <= 0)) {
+          if (UNLIKELY(errno != EAGAIN))
+            read_err();
+          break;
+        }
+
+        answered = receive_responses(conn, (uint32_t)num_read);
+      } while (UNLIKELY(num_read == sizeof(buf)) && !answered);
+
+      if (!answered)
         continue;
-      }
+      num_answered += conn->batch;
 
       /* Are we done? */
       if (UNLIKELY(conn->num_reqs == num_reqs)) {
+        conn->end_ns = get_current_ns();
         close(conn->sock_fd);
         --num_alive_conns;
         continue;
       }
-      conn->num_reqs++;
 
-      /* Send a request. */
-      num_written = write(conn->sock_fd, REQUEST, sizeof(REQUEST) - 1);
-      if (UNLIKELY(num_written != sizeof(REQUEST) - 1))
+      /* Send the next batch. */
+      batch = start_batch(conn);
+      num_written = write(conn->sock_fd, requests, batch * REQUEST_SIZE);
+      if (UNLIKELY(num_written != (ssize_t)(batch * REQUEST_SIZE)))
         write_err();
     }
+
+    /* Publish the progress once per wake-up, the reporter only needs a recent value. */
+    __atomic_store_n(&counter->num_reqs, num_answered, __ATOMIC_RELAXED);
   }
 }
 
-static inline uint64_t get_current_ns(void)
+/* Per-worker io_uring state. */
+struct uring_worker {
+  struct uring ring;
+  struct uring_buf_ring buf_ring;
+};
+
+__attribute__((always_inline)) static inline void uring_queue(struct uring *ring,
+                                                              struct io_uring_sqe **sqe)
 {
-  struct timespec ts;
-  clock_gettime(CLOCK_MONOTONIC, &ts);
-  const uint64_t nsecs_per_sec = 1000 * 1000 * 1000;
-  return (uint64_t)ts.tv_sec * nsecs_per_sec + (uint64_t)ts.tv_nsec;
+  *sqe = uring_get_sqe(ring);
+  if (UNLIKELY(*sqe == NULL))
+    uring_err("Submitting requests failed", -EBUSY);
+}
+
+__attribute__((always_inline)) static inline void uring_queue_recv(struct uring *ring,
+                                                                   struct conn *conn)
+{
+  struct io_uring_sqe *sqe;
+
+  uring_queue(ring, &sqe);
+  uring_prep_recv_multishot(sqe, conn->file_index, URING_BGID,
+                            (uint64_t)(uintptr_t)conn | URING_TAG_RECV);
+}
+
+__attribute__((always_inline)) static inline void uring_queue_write(struct uring *ring,
+                                                                    struct conn *conn,
+                                                                    uint32_t batch)
+{
+  struct io_uring_sqe *sqe;
+
+  /* Only failed writes post completions. */
+  uring_queue(ring, &sqe);
+  uring_prep_write_fixed(sqe, conn->file_index, requests, batch * (uint32_t)REQUEST_SIZE,
+                         /*buf_index=*/0, (uint64_t)(uintptr_t)conn | URING_TAG_WRITE);
+  sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+}
+
+/*
+ * The io_uring version of worker_run(). Responses are received by one multishot recv per
+ * connection into provided buffers, and the requests are written from a registered buffer to
+ * registered files. All requests queued while processing completions are submitted with one
+ * io_uring_enter() call, which also waits for the next completions.
+ */
+__attribute__((aligned(64), noinline)) static void
+worker_run_io_uring(struct uring_worker *uw, struct worker_counter *counter)
+{
+  struct uring *ring = &uw->ring;
+  size_t num_alive_conns = num_conns;
+  uint64_t num_answered = 0;
+
+  while (num_alive_conns > 0) {
+    struct timespec ts;
+    unsigned head, tail;
+    int ret;
+
+    ret = uring_submit_and_wait_timeout(ring, 1, stop_timeout(&ts));
+    if (UNLIKELY(ret < 0))
+      uring_err("Waiting for completions failed", ret);
+
+    if (stopped())
+      break;
+
+    head = uring_cq_head(ring);
+    tail = uring_cq_tail(ring);
+
+    for (; head != tail; head++) {
+      struct io_uring_cqe *cqe = uring_cqe(ring, head);
+      struct conn *conn = (void *)(uintptr_t)(cqe->user_data & ~(uint64_t)URING_TAG_MASK);
+      int res = cqe->res;
+      bool answered;
+
+      if (UNLIKELY((cqe->user_data & URING_TAG_MASK) == URING_TAG_WRITE))
+        write_err();
+
+      if (UNLIKELY(res <= 0)) {
+        if (res == 0)
+          conn_err();
+        if (UNLIKELY(res != -ENOBUFS))
+          read_err();
+
+        /* All buffers were in use, which terminated the multishot recv. */
+        uring_queue_recv(ring, conn);
+        continue;
+      }
+
+      uring_buf_ring_recycle(&uw->buf_ring, (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+
+      answered = receive_responses(conn, (uint32_t)res);
+      if (answered)
+        num_answered += conn->batch;
+
+      /* Are we done? */
+      if (UNLIKELY(answered && conn->num_reqs == num_reqs)) {
+        conn->end_ns = get_current_ns();
+        close(conn->sock_fd);
+        --num_alive_conns;
+        continue;
+      }
+
+      if (UNLIKELY((cqe->flags & IORING_CQE_F_MORE) == 0))
+        uring_queue_recv(ring, conn);
+
+      /* Send the next batch. */
+      if (answered)
+        uring_queue_write(ring, conn, start_batch(conn));
+    }
+
+    uring_cq_advance(ring, head);
+
+    __atomic_store_n(&counter->num_reqs, num_answered, __ATOMIC_RELAXED);
+  }
+}
+
+static void uring_worker_init(struct uring_worker *uw, struct conn *conns)
+{
+  struct iovec iov;
+  uint32_t num_bufs;
+  size_t bufs_per_conn;
+  int *fds;
+  int err;
+
+  /* Each connection has at most one recv and one failed write in flight. */
+  err = uring_init(&uw->ring, num_conns < 4096 ? num_conns : 4096, 2 * num_conns,
+                   IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN);
+  if (err == -EINVAL)
+    err = uring_init(&uw->ring, num_conns < 4096 ? num_conns : 4096, 2 * num_conns, 0);
+  if (UNLIKELY(err < 0))
+    uring_err("Creating io_uring instance failed", err);
+
+  /* Each connection waits for the responses to at most one batch. */
+  bufs_per_conn = (pipeline * RESPONSE_SIZE + URING_BUF_SIZE - 1) / URING_BUF_SIZE;
+  for (num_bufs = 1; num_bufs < num_conns * bufs_per_conn && num_bufs < URING_MAX_BUFS;
+       num_bufs *= 2)
+    ;
+  err = uring_buf_ring_init(&uw->ring, &uw->buf_ring, URING_BGID, (uint16_t)num_bufs,
+                            URING_BUF_SIZE);
+  if (UNLIKELY(err < 0))
+    uring_err("Registering buffer ring failed", err);
+
+  iov.iov_base = requests;
+  iov.iov_len = pipeline * REQUEST_SIZE;
+  err = uring_register_buffers(&uw->ring, &iov, 1);
+  if (UNLIKELY(err < 0))
+    uring_err("Registering requests buffer failed", err);
+
+  fds = malloc((size_t)num_conns * sizeof(*fds));
+  if (UNLIKELY(fds == NULL)) {
+    fputs("Allocating memory for file descriptors failed\n", stderr);
+    exit(1);
+  }
+  for (uint32_t i = 0; i < num_conns; i++) {
+    conns[i].file_index = (int)i;
+    fds[i] = conns[i].sock_fd;
+  }
+  err = uring_register_files(&uw->ring, fds, num_conns);
+  if (UNLIKELY(err < 0))
+    uring_err("Registering files failed", err);
+  free(fds);
+
+  /* Start receiving. */
+  for (uint32_t i = 0; i < num_conns; i++)
+    uring_queue_recv(&uw->ring, &conns[i]);
+  err = uring_submit_and_wait(&uw->ring, 0);
+  if (UNLIKELY(err < 0))
+    uring_err("Submitting requests failed", err);
+}
+
+static void uring_worker_destroy(struct uring_worker *uw)
+{
+  /* Closing the ring drops the references to the registered sockets. */
+  uring_destroy(&uw->ring);
+  uring_buf_ring_destroy(&uw->buf_ring);
+}
+
+static void read_server_threads(struct proc_threads *threads)
+{
+  if (UNLIKELY(!proc_read_threads(server_pid, threads))) {
+    perror("Reading the threads of the server failed");
+    exit(1);
+  }
+}
+
+/*
+ * Returns the pipeline depth of the connection of the given rank: the full depth for the heaviest
+ * connections, in proportion to the weight for the others, at least 1.
+ */
+static uint32_t conn_pipeline(size_t rank)
+{
+  double depth = (double)pipeline * weights_get(&weights, rank) / weights_get(&weights, 0);
+
+  if (weights.kind == WEIGHTS_HOT)
+    return rank < weights_num_hot(&weights) ? pipeline : 1;
+  if (depth < 1)
+    return 1;
+  return (uint32_t)(depth + 0.5);
+}
+
+/*
+ * Waits until all workers (and the reporter) are initialized. The start and the end of a timed run
+ * must be seen by all of them before they start, so they wait for the serial thread to set them.
+ */
+static void start_barrier_wait(void)
+{
+  if (pthread_barrier_wait(&start_barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+    if (server_pid != 0)
+      read_server_threads(&server_before);
+    start_ns = get_current_ns();
+    if (duration_ms != 0)
+      stop_ns = start_ns + (uint64_t)duration_ms * 1000 * 1000;
+  }
+
+  pthread_barrier_wait(&start_barrier);
 }
 
 static void *worker(void *arg)
 {
+  struct uring_worker uw;
   struct conn *conns;
-  uint64_t start, end;
+  int *fds;
   uint32_t thread_no;
-  int poller_fd;
+  int poller_fd = -1, err;
 
   thread_no = (uint32_t)(uintptr_t)arg;
 
-  poller_fd = epoll_create1(0);
-  if (UNLIKELY(poller_fd < 0)) {
-    perror("Creating epoll instance failed");
-    exit(1);
+  if (engine == ENGINE_EPOLL) {
+    poller_fd = epoll_create1(0);
+    if (UNLIKELY(poller_fd < 0)) {
+      perror("Creating epoll instance failed");
+      exit(1);
+    }
   }
 
   /* Align to 64 to avoid false sharing. */
@@ -237,66 +769,97 @@ static void *worker(void *arg)
     exit(1);
   }
 
+  /* Open the connections in waves, they are spread over the source addresses of all workers. */
+
+  fds = malloc((size_t)num_conns * sizeof(*fds));
+  if (UNLIKELY(fds == NULL)) {
+    fputs("Allocating memory for sockets failed\n", stderr);
+    exit(1);
+  }
+
+  err = connect_all(&connect_config, fds, num_conns, (size_t)thread_no * num_conns, &num_connected);
+  if (UNLIKELY(err != 0)) {
+    fprintf(stderr, "Connecting to the server failed: %s\n", strerror(-err));
+    exit(1);
+  }
+
   /* Initialize connections. */
 
   for (uint32_t i = 0; i < num_conns; i++) {
     struct epoll_event ev;
     struct conn *conn = &conns[i];
-    int sock_fd, err;
-
-    sock_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (UNLIKELY(sock_fd < 0)) {
-      perror("Opening client socket failed");
-      exit(1);
-    }
-
-    err = connect(sock_fd, (struct sockaddr *)&server_addr, sizeof(server_addr));
-    if (UNLIKELY(err < 0)) {
-      perror("Connecting to the server failed");
-      exit(1);
-    }
-
-    err = ioctl(sock_fd, FIONBIO, &(int){1});
-    if (UNLIKELY(err < 0)) {
-      perror("ioctl() on client socket failed");
-      exit(1);
-    }
+    int sock_fd = fds[i];
 
     conn->sock_fd = sock_fd;
-    conn->num_reqs = 1;
+    conn->file_index = -1;
+    conn->num_reqs = 0;
+    conn->pipeline = conn_pipeline((size_t)i * num_workers + thread_no);
+    conn->batch = 0;
+    conn->num_pending = 0;
+    conn->end_ns = 0;
+
+    if (engine != ENGINE_EPOLL)
+      continue;
 
     ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
     ev.data.ptr = conn;
-    err = epoll_ctl(poller_fd, EPOLL_CTL_ADD, sock_fd, &ev);
-    if (UNLIKELY(err < 0)) {
+    if (UNLIKELY(epoll_ctl(poller_fd, EPOLL_CTL_ADD, sock_fd, &ev) < 0)) {
       perror("Adding client socket to poller failed");
       exit(1);
     }
   }
 
-  /* Wait for all threads to finish the initialization. */
+  free(fds);
 
-  pthread_barrier_wait(&start_barrier);
+  if (engine == ENGINE_IO_URING)
+    uring_worker_init(&uw, conns);
 
-  /* Start counting the time. */
+  /* Wait for all threads to finish the initialization and start counting the time. */
 
-  if (thread_no == 0)
-    start = get_current_ns();
+  start_barrier_wait();
 
-  /* Send the first requests. */
+  /* Send the first batches. */
 
   for (uint32_t i = 0; i < num_conns; i++) {
     struct conn *conn = &conns[i];
+    uint32_t batch = start_batch(conn);
     ssize_t num_written;
 
-    num_written = write(conn->sock_fd, REQUEST, sizeof(REQUEST) - 1);
-    if (UNLIKELY(num_written != sizeof(REQUEST) - 1))
+    num_written = write(conn->sock_fd, requests, batch * REQUEST_SIZE);
+    if (UNLIKELY(num_written != (ssize_t)(batch * REQUEST_SIZE)))
       write_err();
   }
 
   /* Start the hot loop. */
 
-  worker_run(poller_fd);
+  if (engine == ENGINE_IO_URING) {
+    worker_run_io_uring(&uw, &counters[thread_no]);
+    uring_worker_destroy(&uw);
+  } else {
+    worker_run(poller_fd, &counters[thread_no]);
+  }
+
+  /* The connections of a timed run are still open. */
+
+  if (duration_ms != 0) {
+    for (uint32_t i = 0; i < num_conns; i++)
+      close(conns[i].sock_fd);
+  }
+
+  /* The ranks are dealt out to the workers in turn. A batch in flight is not answered. */
+
+  for (uint32_t i = 0; i < num_conns; i++) {
+    const struct conn *conn = &conns[i];
+    struct conn_load *load = &conn_loads[(size_t)i * num_workers + thread_no];
+
+    load->num_reqs = conn->num_reqs - (conn->num_pending != 0 ? conn->batch : 0);
+    load->time_ns = (duration_ms != 0 ? stop_ns : conn->end_ns) - start_ns;
+  }
+
+  /* Let the reporter know, the end time must be visible before the decrement. */
+
+  counters[thread_no].end_ns = duration_ms != 0 ? stop_ns : get_current_ns();
+  __atomic_sub_fetch(&num_running_workers, 1, __ATOMIC_RELEASE);
 
   /* Wait for all threads to finish the work. */
 
@@ -305,16 +868,242 @@ static void *worker(void *arg)
   /* Calculate the taken time. */
 
   if (thread_no == 0) {
-    end = get_current_ns();
-    time_diff = end - start;
+    time_diff = duration_ms != 0 ? stop_ns - start_ns : get_current_ns() - start_ns;
+    if (server_pid != 0)
+      read_server_threads(&server_after);
+  }
+
+  return NULL;
+}
+
+static void append_sample(uint64_t time_ns, uint64_t num_reqs)
+{
+  static size_t capacity;
+
+  if (num_samples == capacity) {
+    capacity = capacity != 0 ? 2 * capacity : 64;
+    samples = realloc(samples, capacity * sizeof(*samples));
+    if (UNLIKELY(samples == NULL)) {
+      fputs("Allocating memory for samples failed\n", stderr);
+      exit(1);
+    }
+  }
+
+  samples[num_samples].time_ns = time_ns;
+  samples[num_samples].num_reqs = num_reqs;
+  num_samples++;
+}
+
+/*
+ * Samples the worker counters at the end of each interval. It sleeps with absolute deadlines, so
+ * the intervals do not drift, and it touches only one cache line per worker per interval.
+ */
+static void *reporter(void *arg)
+{
+  const uint64_t nsecs_per_sec = 1000 * 1000 * 1000;
+  const uint64_t interval_ns = (uint64_t)interval_ms * 1000 * 1000;
+  uint64_t deadline_ns;
+
+  (void)arg;
+
+  start_barrier_wait();
+
+  for (deadline_ns = start_ns + interval_ns;; deadline_ns += interval_ns) {
+    struct timespec ts;
+    uint64_t num_reqs = 0, end_ns = 0;
+    bool last, done;
+
+    last = deadline_ns >= stop_ns;
+    if (last)
+      deadline_ns = stop_ns;
+
+    ts.tv_sec = (time_t)(deadline_ns / nsecs_per_sec);
+    ts.tv_nsec = (long)(deadline_ns % nsecs_per_sec);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, /*remain=*/NULL) == EINTR)
+      ;
+
+    /* A timed run ends together for all workers, wait until they have stored the last counts. */
+    if (last) {
+      while (__atomic_load_n(&num_running_workers, __ATOMIC_ACQUIRE) != 0)
+        sched_yield();
+    }
+
+    done = __atomic_load_n(&num_running_workers, __ATOMIC_ACQUIRE) == 0;
+    for (uint32_t i = 0; i < num_workers; i++) {
+      num_reqs += __atomic_load_n(&counters[i].num_reqs, __ATOMIC_RELAXED);
+      if (done && counters[i].end_ns > end_ns)
+        end_ns = counters[i].end_ns;
+    }
+
+    /* The last interval ends when the last worker finished. */
+    if (done) {
+      append_sample(end_ns > start_ns ? end_ns - start_ns : 0, num_reqs);
+      break;
+    }
+    append_sample(deadline_ns - start_ns, num_reqs);
   }
 
   return NULL;
 }
 
+static int cmp_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* The rate of each interval and of the steady state between warm-up and drain. */
+struct interval_stats {
+  double *rates;
+
+  /* The steady-state intervals, unless the run was shorter than one full interval. */
+  bool has_steady_state;
+  size_t first, last;
+  double steady_rate;
+};
+
+static void compute_intervals(struct interval_stats *stats)
+{
+  size_t num_full, first, last;
+  double *rates, *sorted, threshold;
+  uint64_t num_reqs, time_ns;
+
+  rates = malloc(2 * num_samples * sizeof(*rates));
+  if (UNLIKELY(rates == NULL)) {
+    fputs("Allocating memory for rates failed\n", stderr);
+    exit(1);
+  }
+  sorted = rates + num_samples;
+
+  for (size_t i = 0; i < num_samples; i++) {
+    uint64_t prev_time_ns = i > 0 ? samples[i - 1].time_ns : 0;
+    uint64_t prev_num_reqs = i > 0 ? samples[i - 1].num_reqs : 0;
+
+    num_reqs = samples[i].num_reqs - prev_num_reqs;
+    time_ns = samples[i].time_ns - prev_time_ns;
+    rates[i] = time_ns != 0 ? (double)num_reqs * 1e9 / (double)time_ns : 0.0;
+  }
+  stats->rates = rates;
+
+  /* The last interval is cut short by the end of the run. */
+  num_full = num_samples - 1;
+  stats->has_steady_state = num_full != 0;
+  if (num_full == 0)
+    return;
+
+  memcpy(sorted, rates, num_full * sizeof(*rates));
+  qsort(sorted, num_full, sizeof(*sorted), cmp_double);
+  threshold = STEADY_STATE_THRESHOLD * sorted[num_full / 2];
+
+  /* The median interval passes, so both loops stop. */
+  for (first = 0; rates[first] < threshold; first++)
+    ;
+  for (last = num_full - 1; rates[last] < threshold; last--)
+    ;
+
+  num_reqs = samples[last].num_reqs - (first > 0 ? samples[first - 1].num_reqs : 0);
+  time_ns = samples[last].time_ns - (first > 0 ? samples[first - 1].time_ns : 0);
+  stats->first = first;
+  stats->last = last;
+  stats->steady_rate = (double)num_reqs * 1e9 / (double)time_ns;
+}
+
+/* Number of requests answered in the interval i. */
+static uint64_t interval_requests(size_t i)
+{
+  return samples[i].num_reqs - (i > 0 ? samples[i - 1].num_reqs : 0);
+}
+
+/* Prints the time series and the rate of the steady state. */
+static void print_intervals(const struct interval_stats *stats)
+{
+  printf("Intervals:\n"
+         "  %10s %12s %16s\n",
+         "time [ms]", "requests", "rate [req/s]");
+  for (size_t i = 0; i < num_samples; i++)
+    printf("  %10.1lf %12" PRIu64 " %16.2lf\n", (double)samples[i].time_ns / 1e6,
+           interval_requests(i), stats->rates[i]);
+
+  if (!stats->has_steady_state) {
+    puts("Steady-state rate: the run was shorter than one interval");
+    return;
+  }
+  printf("Steady-state rate: %.2lf req/s (intervals %zu-%zu of %zu)\n", stats->steady_rate,
+         stats->first + 1, stats->last + 1, num_samples);
+}
+
+/* Writes the configuration, the per-worker counters and the time series as JSON or CSV. */
+static void write_report(uint64_t total_requests, const struct interval_stats *stats)
+{
+  struct report report;
+  double s = (double)time_diff / 1e9;
+
+  report_begin(&report, format, stdout);
+
+  report_object_begin(&report, "config");
+  report_str(&report, "host", host);
+  report_u64(&report, "port", port);
+  report_str(&report, "engine", engine == ENGINE_IO_URING ? "io_uring" : "epoll");
+  report_u64(&report, "num_workers", num_workers);
+  report_u64(&report, "num_conns", num_conns);
+  if (duration_ms != 0)
+    report_u64(&report, "duration_ms", duration_ms);
+  else
+    report_u64(&report, "num_reqs", num_reqs);
+  report_u64(&report, "pipeline", pipeline);
+  report_str(&report, "load", load_name);
+  report_u64(&report, "interval_ms", interval_ms);
+  report_object_end(&report);
+
+  report_object_begin(&report, "result");
+  report_u64(&report, "requests", total_requests);
+  report_u64(&report, "time_ns", time_diff);
+  report_double(&report, "rate", (double)total_requests / s);
+  report_object_end(&report);
+
+  report_array_begin(&report, "workers");
+  for (uint32_t i = 0; i < num_workers; i++) {
+    uint64_t worker_ns = counters[i].end_ns - start_ns;
+
+    report_object_begin(&report, /*name=*/NULL);
+    report_u64(&report, "requests", counters[i].num_reqs);
+    report_u64(&report, "time_ns", worker_ns);
+    report_double(&report, "rate", (double)counters[i].num_reqs * 1e9 / (double)worker_ns);
+    report_object_end(&report);
+  }
+  report_array_end(&report);
+
+  weights_report_load(&weights, &report, conn_loads);
+  if (server_pid != 0)
+    proc_report_threads(&report, &server_before, &server_after);
+
+  if (interval_ms != 0) {
+    report_array_begin(&report, "intervals");
+    for (size_t i = 0; i < num_samples; i++) {
+      report_object_begin(&report, /*name=*/NULL);
+      report_double(&report, "time_ms", (double)samples[i].time_ns / 1e6);
+      report_u64(&report, "requests", interval_requests(i));
+      report_double(&report, "rate", stats->rates[i]);
+      report_object_end(&report);
+    }
+    report_array_end(&report);
+
+    if (stats->has_steady_state) {
+      report_object_begin(&report, "steady_state");
+      report_u64(&report, "first_interval", stats->first + 1);
+      report_u64(&report, "last_interval", stats->last + 1);
+      report_double(&report, "rate", stats->steady_rate);
+      report_object_end(&report);
+    }
+  }
+
+  report_end(&report);
+}
+
 int main(int argc, char **argv)
 {
-  pthread_t *threads;
+  pthread_t *threads, reporter_thread;
+  struct interval_stats interval_stats = {.rates = NULL};
   uint64_t total_requests;
   double s;
   int err;
@@ -329,10 +1118,22 @@ int main(int argc, char **argv)
     fprintf(stderr, "Converting host IPv4 '%s' failed\n", host);
     return 1;
   }
+  connect_config.server_addr = server_addr;
+
+  /* Initialize the requests of a batch. */
+
+  requests = malloc(pipeline * REQUEST_SIZE);
+  if (UNLIKELY(requests == NULL)) {
+    fputs("Allocating memory for requests failed\n", stderr);
+    return 1;
+  }
+  for (uint32_t i = 0; i < pipeline; i++)
+    memcpy(requests + i * REQUEST_SIZE, REQUEST, REQUEST_SIZE);
 
   /* Initialize the barriers. */
 
-  err = pthread_barrier_init(&start_barrier, /*attr=*/NULL, num_workers);
+  /* The reporter starts its clock together with the workers. */
+  err = pthread_barrier_init(&start_barrier, /*attr=*/NULL, num_workers + (interval_ms != 0));
   if (UNLIKELY(err != 0)) {
     fprintf(stderr, "Creating the start barrier failed: %s\n", strerror(err));
     return 1;
@@ -344,7 +1145,24 @@ int main(int argc, char **argv)
     return 1;
   }
 
-  /* Run workers. */
+  /* Initialize the counters. */
+
+  counters = aligned_alloc(64, (size_t)num_workers * sizeof(*counters));
+  if (UNLIKELY(counters == NULL)) {
+    fputs("Allocating memory for counters failed\n", stderr);
+    return 1;
+  }
+  memset(counters, 0, (size_t)num_workers * sizeof(*counters));
+  num_running_workers = num_workers;
+
+  weights_init(&weights, (size_t)num_workers * num_conns);
+  conn_loads = calloc((size_t)num_workers * num_conns, sizeof(*conn_loads));
+  if (UNLIKELY(conn_loads == NULL)) {
+    fputs("Allocating memory for connection loads failed\n", stderr);
+    return 1;
+  }
+
+  /* Run workers and the reporter. */
 
   threads = malloc((size_t)num_workers * sizeof(*threads));
   if (UNLIKELY(threads == NULL)) {
@@ -354,13 +1172,35 @@ int main(int argc, char **argv)
 
   for (uint32_t i = 0; i < num_workers; i++) {
     void *arg = (void *)(uintptr_t)i;
-    int err = pthread_create(&threads[i], /*attr=*/NULL, worker, arg);
+    pthread_attr_t attr;
+    int err;
+
+    /* A pinned worker starts on its CPU, so that its memory is allocated near it. */
+    pthread_attr_init(&attr);
+    err = cpus_set_attr(&worker_cpus, i, &attr);
+    if (UNLIKELY(err != 0)) {
+      fprintf(stderr, "Setting thread affinity failed: %s\n", strerror(err));
+      return 1;
+    }
+
+    err = pthread_create(&threads[i], &attr, worker, arg);
+    pthread_attr_destroy(&attr);
     if (UNLIKELY(err != 0)) {
       fprintf(stderr, "Creating thread failed: %s\n", strerror(err));
       return 1;
     }
   }
 
+  if (interval_ms != 0) {
+    err = pthread_create(&reporter_thread, /*attr=*/NULL, reporter, /*arg=*/NULL);
+    if (UNLIKELY(err != 0)) {
+      fprintf(stderr, "Creating reporter thread failed: %s\n", strerror(err));
+      return 1;
+    }
+  }
+
+  connect_print_progress(&num_connected, (uint64_t)num_workers * num_conns);
+
   for (uint32_t i = 0; i < num_workers; i++) {
     int err = pthread_join(threads[i], /*retval=*/NULL);
     if (UNLIKELY(err != 0)) {
@@ -369,18 +1209,49 @@ int main(int argc, char **argv)
     }
   }
 
+  if (interval_ms != 0) {
+    err = pthread_join(reporter_thread, /*retval=*/NULL);
+    if (UNLIKELY(err != 0)) {
+      fprintf(stderr, "Joining reporter thread failed: %s\n", strerror(err));
+      return 1;
+    }
+  }
+
   /* Calculate and print results. */
 
-  total_requests = (uint64_t)num_reqs * (uint64_t)num_conns;
-  if (UNLIKELY(total_requests > UINT64_MAX / (uint64_t)num_workers)) {
-    fputs("Overflow in the calculation of total requests\n", stderr);
-    return 1;
+  if (duration_ms != 0) {
+    total_requests = 0;
+    for (uint32_t i = 0; i < num_workers; i++)
+      total_requests += counters[i].num_reqs;
+  } else {
+    total_requests = (uint64_t)num_reqs * (uint64_t)num_conns;
+    if (UNLIKELY(total_requests > UINT64_MAX / (uint64_t)num_workers)) {
+      fputs("Overflow in the calculation of total requests\n", stderr);
+      return 1;
+    }
+    total_requests *= num_workers;
+  }
+
+  if (interval_ms != 0)
+    compute_intervals(&interval_stats);
+
+  if (format != REPORT_TEXT) {
+    write_report(total_requests, &interval_stats);
+    return 0;
   }
-  total_requests *= num_workers;
 
   s = (double)time_diff / 1e9;
   printf("%" PRIu64 " requests in %.2lfs, rate: %.2lf req/s\n", total_requests, s,
          (double)total_requests / s);
 
+  if (interval_ms != 0)
+    print_intervals(&interval_stats);
+
+  if (weights.kind != WEIGHTS_UNIFORM)
+    weights_print_load(&weights, conn_loads);
+
+  if (server_pid != 0)
+    proc_print_threads(&server_before, &server_after);
+
   return 0;
 }
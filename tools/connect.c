@@ -0,0 +1,201 @@
+/*
+ * Copyright 2020 Patryk Stefanski
+ *
+ * Licensed under the Apache License, Version 2.0, <LICENSE-APACHE or
+ * http://apache.org/licenses/LICENSE-2.0> or the MIT license <LICENSE-MIT or
+ * http://opensource.org/licenses/MIT>, at your option. This file may not be
+ * copied, modified, or distributed except according to those terms.
+ */
+
+#include "connect.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 64
+
+static bool parse_addr(const char *str, size_t len, uint32_t *addr)
+{
+  char buf[INET_ADDRSTRLEN];
+  struct in_addr in;
+
+  if (len == 0 || len >= sizeof(buf))
+    return false;
+  memcpy(buf, str, len);
+  buf[len] = '\0';
+
+  if (inet_aton(buf, &in) != 1)
+    return false;
+  *addr = ntohl(in.s_addr);
+  return true;
+}
+
+bool connect_add_sources(struct connect_config *config, const char *list)
+{
+  for (;;) {
+    size_t len = strcspn(list, ","), dash = strcspn(list, "-");
+    uint32_t first, last;
+    struct in_addr *addrs;
+    size_t num_addrs;
+
+    if (dash < len) {
+      if (!parse_addr(list, dash, &first) || !parse_addr(list + dash + 1, len - dash - 1, &last) ||
+          last < first)
+        return false;
+    } else {
+      if (!parse_addr(list, len, &first))
+        return false;
+      last = first;
+    }
+
+    num_addrs = config->num_source_addrs + (size_t)(last - first) + 1;
+    addrs = realloc(config->source_addrs, num_addrs * sizeof(*addrs));
+    if (addrs == NULL)
+      return false;
+    config->source_addrs = addrs;
+
+    for (uint64_t addr = first; addr <= last; addr++)
+      addrs[config->num_source_addrs++].s_addr = htonl((uint32_t)addr);
+
+    if (list[len] == '\0')
+      return true;
+    list += len + 1;
+  }
+}
+
+/* Starts a non-blocking connect, the socket is stored in *fd. */
+static int start_connect(const struct connect_config *config, size_t conn_no, int *fd)
+{
+  int sock_fd, err;
+
+  sock_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (sock_fd < 0)
+    return -errno;
+
+  if (config->num_source_addrs != 0) {
+    struct sockaddr_in local_addr;
+
+    if (config->reuse_addr &&
+        (setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int)) != 0 ||
+         setsockopt(sock_fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &(int){1}, sizeof(int)) != 0))
+      goto out_close;
+
+    memset(&local_addr, 0, sizeof(local_addr));
+    local_addr.sin_family = AF_INET;
+    local_addr.sin_addr = config->source_addrs[conn_no % config->num_source_addrs];
+    if (bind(sock_fd, (const struct sockaddr *)&local_addr, sizeof(local_addr)) != 0)
+      goto out_close;
+  }
+
+  if (connect(sock_fd, (const struct sockaddr *)&config->server_addr,
+              sizeof(config->server_addr)) != 0 &&
+      errno != EINPROGRESS)
+    goto out_close;
+
+  *fd = sock_fd;
+  return 0;
+
+out_close:
+  err = -errno;
+  close(sock_fd);
+  return err;
+}
+
+/* Returns 0 if the connection has been established or a negative error code. */
+static int finish_connect(int poller_fd, int sock_fd)
+{
+  int err;
+
+  if (getsockopt(sock_fd, SOL_SOCKET, SO_ERROR, &err, &(socklen_t){sizeof(err)}) != 0)
+    return -errno;
+  if (err != 0)
+    return -err;
+
+  if (epoll_ctl(poller_fd, EPOLL_CTL_DEL, sock_fd, /*event=*/NULL) != 0)
+    return -errno;
+  return 0;
+}
+
+int connect_all(const struct connect_config *config, int *fds, size_t num_fds, size_t first_no,
+                uint64_t *progress)
+{
+  struct epoll_event events[MAX_EVENTS];
+  size_t num_started = 0, num_done = 0;
+  int poller_fd, err = 0;
+
+  poller_fd = epoll_create1(0);
+  if (poller_fd < 0)
+    return -errno;
+
+  while (num_done < num_fds) {
+    int n;
+
+    /* Top up the wave, so that the listen backlog of the server is not flooded. */
+    while (num_started < num_fds && num_started - num_done < config->wave_size) {
+      struct epoll_event ev;
+
+      err = start_connect(config, first_no + num_started, &fds[num_started]);
+      if (err != 0)
+        goto out;
+
+      ev.events = EPOLLOUT;
+      ev.data.u64 = num_started++;
+      if (epoll_ctl(poller_fd, EPOLL_CTL_ADD, fds[ev.data.u64], &ev) != 0) {
+        err = -errno;
+        goto out;
+      }
+    }
+
+    n = epoll_wait(poller_fd, events, MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      err = -errno;
+      goto out;
+    }
+
+    for (int i = 0; i < n; i++) {
+      err = finish_connect(poller_fd, fds[events[i].data.u64]);
+      if (err != 0)
+        goto out;
+      num_done++;
+      __atomic_add_fetch(progress, 1, __ATOMIC_RELAXED);
+    }
+  }
+
+out:
+  if (err != 0) {
+    for (size_t i = 0; i < num_started; i++)
+      close(fds[i]);
+  }
+  close(poller_fd);
+  return err;
+}
+
+void connect_print_progress(const uint64_t *progress, uint64_t total)
+{
+  const struct timespec poll_interval = {.tv_sec = 0, .tv_nsec = 100 * 1000 * 1000};
+
+  for (unsigned i = 1;; i++) {
+    uint64_t num_connected = __atomic_load_n(progress, __ATOMIC_RELAXED);
+    if (num_connected >= total)
+      break;
+
+    /* Print once a second, but notice the end sooner. */
+    if (i % 10 == 0)
+      fprintf(stderr, "Connected %" PRIu64 "/%" PRIu64 "\n", num_connected, total);
+    nanosleep(&poll_interval, /*rem=*/NULL);
+  }
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2020 Patryk Stefanski
+ *
+ * Licensed under the Apache License, Version 2.0, <LICENSE-APACHE or
+ * http://apache.org/licenses/LICENSE-2.0> or the MIT license <LICENSE-MIT or
+ * http://opensource.org/licenses/MIT>, at your option. This file may not be
+ * copied, modified, or distributed except according to those terms.
+ */
+
+#ifndef ASYNC_BENCH_CONNECT_H
+#define ASYNC_BENCH_CONNECT_H
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Default number of connection attempts in flight per connect_all() call. */
+#define CONNECT_DEFAULT_WAVE 128
+
+/*
+ * How the load generators open their connections. One destination gives about 28k ephemeral ports
+ * per local address, binding the connections to several local addresses (e.g. on 127.0.0.0/8)
+ * raises the limit accordingly.
+ */
+struct connect_config {
+  struct sockaddr_in server_addr;
+
+  /* Local addresses the connections are bound to in turn. If empty, the kernel chooses. */
+  struct in_addr *source_addrs;
+  size_t num_source_addrs;
+
+  /* Maximum number of connection attempts in flight at once. */
+  uint32_t wave_size;
+
+  /*
+   * If true, bound sockets get SO_REUSEADDR and IP_BIND_ADDRESS_NO_PORT, so that the local port is
+   * chosen at connect() for the whole 4-tuple instead of at bind() for the local address only.
+   */
+  bool reuse_addr;
+};
+
+/*
+ * Appends the addresses of a comma-separated list of IPv4 addresses and inclusive ranges A-B to the
+ * source addresses. Returns false if the list is malformed or allocating memory failed.
+ */
+bool connect_add_sources(struct connect_config *config, const char *list);
+
+/*
+ * Opens num_fds non-blocking connections with at most wave_size attempts in flight and stores the
+ * sockets in fds. The connection first_no + i is bound to the source address of that index, so
+ * that the connections of all workers are spread evenly. Each established connection increments
+ * *progress atomically. Returns 0 on success or a negative error code, then no socket is left open.
+ */
+int connect_all(const struct connect_config *config, int *fds, size_t num_fds, size_t first_no,
+                uint64_t *progress);
+
+/*
+ * Prints the value of *progress to stderr every second until it reaches total. Nothing is printed
+ * if the connections are established within the first second.
+ */
+void connect_print_progress(const uint64_t *progress, uint64_t total);
+
+#endif
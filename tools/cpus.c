@@ -0,0 +1,73 @@
+/*
+ * Copyright 2020 Patryk Stefanski
+ *
+ * Licensed under the Apache License, Version 2.0, <LICENSE-APACHE or
+ * http://apache.org/licenses/LICENSE-2.0> or the MIT license <LICENSE-MIT or
+ * http://opensource.org/licenses/MIT>, at your option. This file may not be
+ * copied, modified, or distributed except according to those terms.
+ */
+
+#include "cpus.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+static bool parse_cpu(const char *str, const char **end, unsigned *cpu)
+{
+  char *p;
+  unsigned long value;
+
+  if (*str < '0' || *str > '9')
+    return false;
+  value = strtoul(str, &p, 10);
+  if (value >= CPU_SETSIZE)
+    return false;
+
+  *cpu = (unsigned)value;
+  *end = p;
+  return true;
+}
+
+bool cpus_parse(struct cpu_list *list, const char *str)
+{
+  for (;;) {
+    unsigned first, last, *cpus;
+    size_t num_cpus;
+
+    if (!parse_cpu(str, &str, &first))
+      return false;
+    last = first;
+    if (*str == '-' && (!parse_cpu(str + 1, &str, &last) || last < first))
+      return false;
+    if (*str != ',' && *str != '\0')
+      return false;
+
+    num_cpus = list->num_cpus + (last - first) + 1;
+    cpus = realloc(list->cpus, num_cpus * sizeof(*cpus));
+    if (cpus == NULL)
+      return false;
+    list->cpus = cpus;
+
+    for (unsigned cpu = first; cpu <= last; cpu++)
+      cpus[list->num_cpus++] = cpu;
+
+    if (*str == '\0')
+      return true;
+    str++;
+  }
+}
+
+int cpus_set_attr(const struct cpu_list *list, size_t worker, pthread_attr_t *attr)
+{
+  cpu_set_t set;
+
+  if (list->num_cpus == 0)
+    return 0;
+
+  CPU_ZERO(&set);
+  CPU_SET(list->cpus[worker % list->num_cpus], &set);
+  return pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+}
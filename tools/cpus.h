@@ -0,0 +1,35 @@
+/*
+ * Copyright 2020 Patryk Stefanski
+ *
+ * Licensed under the Apache License, Version 2.0, <LICENSE-APACHE or
+ * http://apache.org/licenses/LICENSE-2.0> or the MIT license <LICENSE-MIT or
+ * http://opensource.org/licenses/MIT>, at your option. This file may not be
+ * copied, modified, or distributed except according to those terms.
+ */
+
+#ifndef ASYNC_BENCH_CPUS_H
+#define ASYNC_BENCH_CPUS_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* CPUs the worker threads are pinned to, the worker i runs on cpus[i % num_cpus]. */
+struct cpu_list {
+  unsigned *cpus;
+  size_t num_cpus;
+};
+
+/*
+ * Appends the CPUs of a comma-separated list of CPU numbers and inclusive ranges A-B, as taken by
+ * taskset -c, to the list. Returns false if the list is malformed or allocating memory failed.
+ */
+bool cpus_parse(struct cpu_list *list, const char *str);
+
+/*
+ * Sets the affinity of the thread attributes to the CPU of the given worker, so that the thread
+ * starts there. Nothing is changed if the list is empty. Returns 0 or an error number.
+ */
+int cpus_set_attr(const struct cpu_list *list, size_t worker, pthread_attr_t *attr);
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ * Copyright 2020 Patryk Stefanski
+ *
+ * Licensed under the Apache License, Version 2.0, <LICENSE-APACHE or
+ * http://apache.org/licenses/LICENSE-2.0> or the MIT license <LICENSE-MIT or
+ * http://opensource.org/licenses/MIT>, at your option. This file may not be
+ * copied, modified, or distributed except according to those terms.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hist.h"
+
+/* Quantiles reported in the results, as fractions num / den, the same as in bench-latency. */
+static const struct {
+  const char *name;
+  uint64_t num, den;
+} quantiles[] = {
+    {"median", 1, 2},
+    {"q 0.9", 9, 10},
+    {"q 0.95", 95, 100},
+    {"q 0.99", 99, 100},
+    {"q 0.995", 995, 1000},
+    {"q 0.999", 999, 1000},
+    {"q 0.9995", 9995, 10000},
+    {"q 0.9999", 9999, 10000},
+};
+
+#define NUM_QUANTILES (sizeof(quantiles) / sizeof(quantiles[0]))
+
+/* The mean followed by the quantiles of a single round, their spread across rounds is reported. */
+struct round_stats {
+  uint64_t values[1 + NUM_QUANTILES];
+};
+
+static void print_help(const char *prog_name)
+{
+  fprintf(stderr,
+          "Usage: %s <FILE>...\n"
+          "\n"
+          "Merges latency histograms written by bench-latency --hist-output into pooled quantiles\n"
+          "and reports the spread of the per-round values.\n",
+          prog_name);
+  exit(1);
+}
+
+static void compute_round_stats(const struct hist *hist, struct round_stats *stats)
+{
+  stats->values[0] = hist->sum / hist->count;
+  for (size_t i = 0; i < NUM_QUANTILES; i++)
+    stats->values[1 + i] =
+        hist_value_at_rank(hist, hist->count * quantiles[i].num / quantiles[i].den);
+}
+
+static void print_spread(const char *name, const struct round_stats *rounds, size_t num_rounds,
+                         size_t index)
+{
+  uint64_t min = UINT64_MAX, max = 0;
+  double mean = 0;
+
+  for (size_t i = 0; i < num_rounds; i++) {
+    uint64_t value = rounds[i].values[index];
+    if (value < min)
+      min = value;
+    if (value > max)
+      max = value;
+    mean += (double)value;
+  }
+  mean /= (double)num_rounds;
+
+  printf("  %-10s%12" PRIu64 " %12.0lf %12" PRIu64 "\n", name, min, mean, max);
+}
+
+int main(int argc, char **argv)
+{
+  struct round_stats *rounds, pooled;
+  struct hist merged;
+  size_t num_rounds = (size_t)argc - 1;
+
+  if (argc < 2)
+    print_help(argv[0]);
+
+  rounds = malloc(num_rounds * sizeof(*rounds));
+  if (rounds == NULL) {
+    fputs("Allocating memory for rounds failed\n", stderr);
+    return 1;
+  }
+
+  /* Read and merge all histograms. */
+
+  for (size_t i = 0; i < num_rounds; i++) {
+    const char *path = argv[i + 1];
+    struct hist hist;
+    FILE *file;
+
+    file = fopen(path, "rb");
+    if (file == NULL) {
+      perror(path);
+      return 1;
+    }
+    if (!hist_read(&hist, file)) {
+      fprintf(stderr, "Reading histogram '%s' failed\n", path);
+      return 1;
+    }
+    fclose(file);
+
+    if (hist.count == 0) {
+      fprintf(stderr, "Histogram '%s' is empty\n", path);
+      return 1;
+    }
+    if (hist.count > UINT64_MAX / 9999) {
+      fputs("Overflow in the calculation of quantiles\n", stderr);
+      return 1;
+    }
+
+    compute_round_stats(&hist, &rounds[i]);
+
+    if (i == 0) {
+      merged = hist;
+      continue;
+    }
+
+    if (hist.precision != merged.precision) {
+      fprintf(stderr, "Histogram '%s' has a different precision\n", path);
+      return 1;
+    }
+    if (!hist_merge(&merged, &hist) || merged.count > UINT64_MAX / 9999) {
+      fputs("Overflow in the calculation of mean\n", stderr);
+      return 1;
+    }
+    hist_destroy(&hist);
+  }
+
+  /* The pooled quantiles are those of all latencies, not averages of the per-round ones. */
+
+  compute_round_stats(&merged, &pooled);
+
+  printf("%zu rounds, %" PRIu64 " latencies\n\n", num_rounds, merged.count);
+
+  printf("Latency [ns]:\n"
+         "  mean:     %" PRIu64 "\n"
+         "  min:      %" PRIu64 "\n"
+         "  max:      %" PRIu64 "\n",
+         pooled.values[0], merged.min, merged.max);
+  for (size_t i = 0; i < NUM_QUANTILES; i++) {
+    char label[16];
+    snprintf(label, sizeof(label), "%s:", quantiles[i].name);
+    printf("  %-10s%" PRIu64 "\n", label, pooled.values[1 + i]);
+  }
+
+  printf("\nPer-round spread [ns]:\n  %-10s%12s %12s %12s\n", "", "min", "mean", "max");
+  print_spread("mean", rounds, num_rounds, 0);
+  for (size_t i = 0; i < NUM_QUANTILES; i++)
+    print_spread(quantiles[i].name, rounds, num_rounds, 1 + i);
+
+  hist_destroy(&merged);
+  free(rounds);
+  return 0;
+}
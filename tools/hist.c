@@ -0,0 +1,194 @@
+/*
+ * Copyright 2020 Patryk Stefanski
+ *
+ * Licensed under the Apache License, Version 2.0, <LICENSE-APACHE or
+ * http://apache.org/licenses/LICENSE-2.0> or the MIT license <LICENSE-MIT or
+ * http://opensource.org/licenses/MIT>, at your option. This file may not be
+ * copied, modified, or distributed except according to those terms.
+ */
+
+#include "hist.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool hist_init(struct hist *hist, uint32_t precision)
+{
+  size_t size;
+
+  assert(precision >= HIST_MIN_PRECISION && precision <= HIST_MAX_PRECISION);
+
+  /* Align to 64 to avoid false sharing between histograms of different workers. */
+  size = hist_num_buckets(precision) * sizeof(*hist->buckets);
+  hist->buckets = aligned_alloc(64, (size + 63) & ~(size_t)63);
+  if (hist->buckets == NULL)
+    return false;
+  memset(hist->buckets, 0, size);
+
+  hist->precision = precision;
+  hist->count = 0;
+  hist->sum = 0;
+  hist->min = UINT64_MAX;
+  hist->max = 0;
+  return true;
+}
+
+void hist_destroy(struct hist *hist) { free(hist->buckets); }
+
+uint64_t hist_bucket_lowest(uint32_t precision, size_t index)
+{
+  size_t high = index >> precision;
+  uint32_t shift;
+  uint64_t mantissa;
+
+  /* The first two ranges are linear with bucket width 1. */
+  if (high <= 1)
+    return (uint64_t)index;
+
+  shift = (uint32_t)high - 1;
+  mantissa = (uint64_t)(index & (((size_t)1 << precision) - 1)) | ((uint64_t)1 << precision);
+  return mantissa << shift;
+}
+
+uint64_t hist_bucket_highest(uint32_t precision, size_t index)
+{
+  size_t high = index >> precision;
+
+  if (high <= 1)
+    return (uint64_t)index;
+
+  return hist_bucket_lowest(precision, index) + (((uint64_t)1 << (high - 1)) - 1);
+}
+
+bool hist_merge(struct hist *dst, const struct hist *src)
+{
+  size_t num_buckets = hist_num_buckets(dst->precision);
+
+  assert(dst->precision == src->precision);
+
+  if (dst->sum > UINT64_MAX - src->sum)
+    return false;
+
+  for (size_t i = 0; i < num_buckets; i++)
+    dst->buckets[i] += src->buckets[i];
+
+  dst->count += src->count;
+  dst->sum += src->sum;
+  if (src->min < dst->min)
+    dst->min = src->min;
+  if (src->max > dst->max)
+    dst->max = src->max;
+  return true;
+}
+
+uint64_t hist_value_at_rank(const struct hist *hist, uint64_t rank)
+{
+  size_t num_buckets = hist_num_buckets(hist->precision);
+  uint64_t seen = 0, value;
+  size_t i;
+
+  assert(rank < hist->count);
+
+  for (i = 0; i < num_buckets; i++) {
+    seen += hist->buckets[i];
+    if (seen > rank)
+      break;
+  }
+  assert(i < num_buckets);
+
+  value = hist_bucket_highest(hist->precision, i);
+  if (value < hist->min)
+    value = hist->min;
+  if (value > hist->max)
+    value = hist->max;
+  return value;
+}
+
+/* Identifies the format and its version. */
+static const char hist_magic[8] = "ABHIST1";
+
+struct hist_header {
+  char magic[8];
+  uint32_t precision;
+  uint32_t reserved;
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint64_t num_entries;
+};
+
+struct hist_entry {
+  uint64_t index;
+  uint64_t count;
+};
+
+bool hist_write(const struct hist *hist, FILE *file)
+{
+  size_t num_buckets = hist_num_buckets(hist->precision);
+  struct hist_header header;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, hist_magic, sizeof(header.magic));
+  header.precision = hist->precision;
+  header.count = hist->count;
+  header.sum = hist->sum;
+  header.min = hist->min;
+  header.max = hist->max;
+  for (size_t i = 0; i < num_buckets; i++)
+    header.num_entries += hist->buckets[i] != 0;
+
+  if (fwrite(&header, sizeof(header), 1, file) != 1)
+    return false;
+
+  for (size_t i = 0; i < num_buckets; i++) {
+    struct hist_entry entry = {.index = i, .count = hist->buckets[i]};
+    if (entry.count != 0 && fwrite(&entry, sizeof(entry), 1, file) != 1)
+      return false;
+  }
+
+  return true;
+}
+
+bool hist_read(struct hist *hist, FILE *file)
+{
+  struct hist_header header;
+  size_t num_buckets;
+  uint64_t count = 0;
+
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      memcmp(header.magic, hist_magic, sizeof(header.magic)) != 0 ||
+      header.precision < HIST_MIN_PRECISION || header.precision > HIST_MAX_PRECISION)
+    return false;
+
+  if (!hist_init(hist, header.precision))
+    return false;
+
+  num_buckets = hist_num_buckets(header.precision);
+  for (uint64_t i = 0; i < header.num_entries; i++) {
+    struct hist_entry entry;
+    if (fread(&entry, sizeof(entry), 1, file) != 1 || entry.index >= num_buckets)
+      goto out_destroy;
+    hist->buckets[entry.index] += entry.count;
+    count += entry.count;
+  }
+
+  /* The quantiles rely on the buckets adding up to the count. */
+  if (count != header.count)
+    goto out_destroy;
+
+  hist->count = header.count;
+  hist->sum = header.sum;
+  hist->min = header.min;
+  hist->max = header.max;
+  return true;
+
+out_destroy:
+  hist_destroy(hist);
+  return false;
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2020 Patryk Stefanski
+ *
+ * Licensed under the Apache License, Version 2.0, <LICENSE-APACHE or
+ * http://apache.org/licenses/LICENSE-2.0> or the MIT license <LICENSE-MIT or
+ * http://opensource.org/licenses/MIT>, at your option. This file may not be
+ * copied, modified, or distributed except according to those terms.
+ */
+
+#ifndef ASYNC_BENCH_HIST_H
+#define ASYNC_BENCH_HIST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Log-linear histogram of 64-bit values (similar to HdrHistogram). Values below 2^precision are
+ * counted exactly, each larger power-of-two range is split into 2^precision equal buckets, so the
+ * relative error of a value is below 2^-precision. The memory usage does not depend on the number
+ * of recorded values, and histograms of the same precision can be merged.
+ */
+struct hist {
+  /* Buckets, there are hist_num_buckets(precision) of them. */
+  uint64_t *buckets;
+
+  /* Number of significant bits. */
+  uint32_t precision;
+
+  /* Number of recorded values. */
+  uint64_t count;
+
+  /* Sum of recorded values. */
+  uint64_t sum;
+
+  /* Exact minimum and maximum of recorded values. */
+  uint64_t min;
+  uint64_t max;
+};
+
+#define HIST_MIN_PRECISION 1
+#define HIST_MAX_PRECISION 20
+
+static inline size_t hist_num_buckets(uint32_t precision)
+{
+  return (size_t)(65 - precision) << precision;
+}
+
+static inline size_t hist_bucket_index(uint32_t precision, uint64_t value)
+{
+  uint32_t msb, shift;
+
+  if (value < ((uint64_t)1 << precision))
+    return (size_t)value;
+
+  msb = 63 - (uint32_t)__builtin_clzll(value);
+  shift = msb - precision;
+  return ((size_t)shift << precision) + (size_t)(value >> shift);
+}
+
+__attribute__((always_inline)) static inline void hist_record(struct hist *hist, uint64_t value)
+{
+  hist->buckets[hist_bucket_index(hist->precision, value)]++;
+  hist->count++;
+  hist->sum += value;
+  if (value < hist->min)
+    hist->min = value;
+  if (value > hist->max)
+    hist->max = value;
+}
+
+/* Initializes an empty histogram. Returns false if allocating the buckets failed. */
+bool hist_init(struct hist *hist, uint32_t precision);
+
+void hist_destroy(struct hist *hist);
+
+/* Returns the lowest and the highest value that are counted in the given bucket. */
+uint64_t hist_bucket_lowest(uint32_t precision, size_t index);
+uint64_t hist_bucket_highest(uint32_t precision, size_t index);
+
+/*
+ * Adds all values of src to dst. Both histograms must have the same precision. Returns false if the
+ * sum overflows.
+ */
+bool hist_merge(struct hist *dst, const struct hist *src);
+
+/*
+ * Returns the value of the given rank (0-based index in the sorted sequence of the recorded
+ * values). The value is the highest value equivalent to the bucket, clamped to the exact minimum
+ * and maximum. The histogram must not be empty and rank must be less than its count.
+ */
+uint64_t hist_value_at_rank(const struct hist *hist, uint64_t rank);
+
+/*
+ * Writes the histogram in a compact binary format: a header with the precision and the exact
+ * statistics, followed by the index and the count of each non-empty bucket. Integers are stored in
+ * the native byte order. Returns false if writing failed.
+ */
+bool hist_write(const struct hist *hist, FILE *file);
+
+/*
+ * Initializes the histogram from the format of hist_write(). Returns false if reading failed, the
+ * data is malformed or allocating the buckets failed.
+ */
+bool hist_read(struct hist *hist, FILE *file);
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ * Copyright 2020 Patryk Stefanski
+ *
+ * Licensed under the Apache License, Version 2.0, <LICENSE-APACHE or
+ * http://apache.org/licenses/LICENSE-2.0> or the MIT license <LICENSE-MIT or
+ * http://opensource.org/licenses/MIT>, at your option. This file may not be
+ * copied, modified, or distributed except according to those terms.
+ */
+
+#include "proc.h"
+
+#include <dirent.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "report.h"
+
+static bool read_thread(uint32_t pid, uint32_t tid, struct thread_cpu *thread)
+{
+  char path[64], buf[1024], *name, *end;
+  unsigned long long utime, stime;
+  long ticks = sysconf(_SC_CLK_TCK);
+  size_t len;
+  FILE *file;
+
+  snprintf(path, sizeof(path), "/proc/%" PRIu32 "/task/%" PRIu32 "/stat", pid, tid);
+  file = fopen(path, "r");
+  if (file == NULL)
+    return false;
+  len = fread(buf, 1, sizeof(buf) - 1, file);
+  fclose(file);
+  buf[len] = '\0';
+
+  /* The name is in parentheses and may contain anything, so the fields follow the last ')'. */
+  name = strchr(buf, '(');
+  end = strrchr(buf, ')');
+  if (name == NULL || end == NULL || end < name || ticks <= 0)
+    return false;
+
+  len = (size_t)(end - name - 1);
+  if (len >= sizeof(thread->name))
+    len = sizeof(thread->name) - 1;
+  memcpy(thread->name, name + 1, len);
+  thread->name[len] = '\0';
+
+  /* utime and stime are the fields 14 and 15, the state after the name is the field 3. */
+  if (sscanf(end + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) !=
+      2)
+    return false;
+
+  thread->tid = tid;
+  thread->cpu_ns = (uint64_t)(utime + stime) * 1000 * 1000 * 1000 / (uint64_t)ticks;
+  return true;
+}
+
+bool proc_read_threads(uint32_t pid, struct proc_threads *threads)
+{
+  char path[64];
+  struct dirent *entry;
+  struct timespec ts;
+  size_t capacity = 0;
+  DIR *dir;
+
+  threads->threads = NULL;
+  threads->num_threads = 0;
+
+  snprintf(path, sizeof(path), "/proc/%" PRIu32 "/task", pid);
+  dir = opendir(path);
+  if (dir == NULL)
+    return false;
+
+  while ((entry = readdir(dir)) != NULL) {
+    uint32_t tid;
+
+    if (sscanf(entry->d_name, "%" SCNu32, &tid) != 1)
+      continue;
+
+    if (threads->num_threads == capacity) {
+      struct thread_cpu *grown;
+
+      capacity = capacity != 0 ? 2 * capacity : 16;
+      grown = realloc(threads->threads, capacity * sizeof(*grown));
+      if (grown == NULL)
+        goto err;
+      threads->threads = grown;
+    }
+
+    /* A thread may exit in the meantime. */
+    if (read_thread(pid, tid, &threads->threads[threads->num_threads]))
+      threads->num_threads++;
+  }
+  closedir(dir);
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  threads->time_ns = (uint64_t)ts.tv_sec * 1000 * 1000 * 1000 + (uint64_t)ts.tv_nsec;
+  return true;
+
+err:
+  closedir(dir);
+  proc_threads_destroy(threads);
+  return false;
+}
+
+void proc_threads_destroy(struct proc_threads *threads)
+{
+  free(threads->threads);
+  threads->threads = NULL;
+  threads->num_threads = 0;
+}
+
+/* Returns the CPU time the thread used since before, all of it if the thread is new. */
+static uint64_t cpu_diff(const struct proc_threads *before, const struct thread_cpu *thread)
+{
+  for (size_t i = 0; i < before->num_threads; i++) {
+    if (before->threads[i].tid == thread->tid)
+      return thread->cpu_ns - before->threads[i].cpu_ns;
+  }
+  return thread->cpu_ns;
+}
+
+static uint64_t total_cpu_diff(const struct proc_threads *before, const struct proc_threads *after)
+{
+  uint64_t total = 0;
+
+  for (size_t i = 0; i < after->num_threads; i++)
+    total += cpu_diff(before, &after->threads[i]);
+  return total;
+}
+
+void proc_print_threads(const struct proc_threads *before, const struct proc_threads *after)
+{
+  uint64_t elapsed_ns = after->time_ns - before->time_ns, total = total_cpu_diff(before, after);
+
+  printf("\nServer threads:\n"
+         "  %-8s %-16s %10s %10s %10s\n",
+         "tid", "name", "cpu [ms]", "busy [%]", "share [%]");
+  for (size_t i = 0; i < after->num_threads; i++) {
+    const struct thread_cpu *thread = &after->threads[i];
+    uint64_t cpu_ns = cpu_diff(before, thread);
+
+    if (cpu_ns == 0)
+      continue;
+    printf("  %-8" PRIu32 " %-16s %10.1lf %10.2lf %10.2lf\n", thread->tid, thread->name,
+           (double)cpu_ns / 1e6, (double)cpu_ns * 100 / (double)elapsed_ns,
+           (double)cpu_ns * 100 / (double)total);
+  }
+}
+
+void proc_report_threads(struct report *report, const struct proc_threads *before,
+                         const struct proc_threads *after)
+{
+  uint64_t elapsed_ns = after->time_ns - before->time_ns, total = total_cpu_diff(before, after);
+
+  report_array_begin(report, "server_threads");
+  for (size_t i = 0; i < after->num_threads; i++) {
+    const struct thread_cpu *thread = &after->threads[i];
+    uint64_t cpu_ns = cpu_diff(before, thread);
+
+    if (cpu_ns == 0)
+      continue;
+    report_object_begin(report, /*name=*/NULL);
+    report_u64(report, "tid", thread->tid);
+    report_str(report, "name", thread->name);
+    report_u64(report, "cpu_ns", cpu_ns);
+    report_double(report, "busy_pct", (double)cpu_ns * 100 / (double)elapsed_ns);
+    report_double(report, "share_pct", (double)cpu_ns * 100 / (double)total);
+    report_object_end(report);
+  }
+  report_array_end(report);
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2020 Patryk Stefanski
+ *
+ * Licensed under the Apache License, Version 2.0, <LICENSE-APACHE or
+ * http://apache.org/licenses/LICENSE-2.0> or the MIT license <LICENSE-MIT or
+ * http://opensource.org/licenses/MIT>, at your option. This file may not be
+ * copied, modified, or distributed except according to those terms.
+ */
+
+#ifndef ASYNC_BENCH_PROC_H
+#define ASYNC_BENCH_PROC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "report.h"
+
+/* CPU time of a thread, as reported by /proc/<pid>/task/<tid>/stat. */
+struct thread_cpu {
+  uint32_t tid;
+  char name[17];
+
+  /* User and system time. */
+  uint64_t cpu_ns;
+};
+
+/* The threads of a process at one point in time. */
+struct proc_threads {
+  struct thread_cpu *threads;
+  size_t num_threads;
+
+  /* CLOCK_MONOTONIC time of the reading. */
+  uint64_t time_ns;
+};
+
+/* Reads the CPU time of all threads of a process. Returns false if reading failed. */
+bool proc_read_threads(uint32_t pid, struct proc_threads *threads);
+
+void proc_threads_destroy(struct proc_threads *threads);
+
+/*
+ * Prints the CPU time each thread used between two readings, how busy it was, and its share of the
+ * CPU time of all threads. Threads that used no CPU time in between are left out.
+ */
+void proc_print_threads(const struct proc_threads *before, const struct proc_threads *after);
+
+/* Writes the same as proc_print_threads(). */
+void proc_report_threads(struct report *report, const struct proc_threads *before,
+                         const struct proc_threads *after);
+
+#endif
@@ -0,0 +1,237 @@
+/*
+ * Copyright 2020 Patryk Stefanski
+ *
+ * Licensed under the Apache License, Version 2.0, <LICENSE-APACHE or
+ * http://apache.org/licenses/LICENSE-2.0> or the MIT license <LICENSE-MIT or
+ * http://opensource.org/licenses/MIT>, at your option. This file may not be
+ * copied, modified, or distributed except according to those terms.
+ */
+
+#include "report.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+bool report_parse_format(const char *name, enum report_format *format)
+{
+  if (strcmp(name, "text") == 0)
+    *format = REPORT_TEXT;
+  else if (strcmp(name, "json") == 0)
+    *format = REPORT_JSON;
+  else if (strcmp(name, "csv") == 0)
+    *format = REPORT_CSV;
+  else
+    return false;
+  return true;
+}
+
+static void write_json_str(FILE *file, const char *str)
+{
+  fputc('"', file);
+  for (; *str != '\0'; str++) {
+    unsigned char c = (unsigned char)*str;
+    if (c == '"' || c == '\\')
+      fprintf(file, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(file, "\\u%04x", c);
+    else
+      fputc(c, file);
+  }
+  fputc('"', file);
+}
+
+static void write_csv_str(FILE *file, const char *str)
+{
+  if (strpbrk(str, ",\"\n") == NULL) {
+    fputs(str, file);
+    return;
+  }
+
+  fputc('"', file);
+  for (; *str != '\0'; str++) {
+    if (*str == '"')
+      fputc('"', file);
+    fputc(*str, file);
+  }
+  fputc('"', file);
+}
+
+/* Writes the path of the current level in CSV rows. */
+static void write_csv_path(const struct report *report)
+{
+  for (size_t i = 1; i <= report->depth; i++) {
+    if (i > 1)
+      fputc('.', report->file);
+    if (report->levels[i].name != NULL)
+      write_csv_str(report->file, report->levels[i].name);
+    else
+      fprintf(report->file, "%zu", report->levels[i].index);
+  }
+}
+
+/*
+ * Starts an item of the current level: writes the separator and the key in JSON, or the path and
+ * the key in CSV. Returns the index of the item.
+ */
+static size_t begin_item(struct report *report, const char *key)
+{
+  struct report_level *level = &report->levels[report->depth];
+  size_t index = level->num_items++;
+
+  assert((key == NULL) == level->array);
+
+  if (report->format == REPORT_JSON) {
+    fprintf(report->file, "%s\n%*s", index > 0 ? "," : "", 2 * (int)(report->depth + 1), "");
+    if (key != NULL) {
+      write_json_str(report->file, key);
+      fputs(": ", report->file);
+    }
+  }
+  return index;
+}
+
+/* Starts a value, in CSV the whole row up to the value. */
+static void begin_value(struct report *report, const char *key)
+{
+  size_t index = begin_item(report, key);
+
+  if (report->format == REPORT_CSV) {
+    write_csv_path(report);
+    fputc(',', report->file);
+    if (key != NULL)
+      write_csv_str(report->file, key);
+    else
+      fprintf(report->file, "%zu", index);
+    fputc(',', report->file);
+  }
+}
+
+static void end_value(struct report *report)
+{
+  if (report->format == REPORT_CSV)
+    fputc('\n', report->file);
+}
+
+static void begin_level(struct report *report, const char *name, bool array)
+{
+  size_t index = begin_item(report, name);
+
+  assert(report->depth + 1 < REPORT_MAX_DEPTH);
+  report->depth++;
+  report->levels[report->depth].name = name;
+  report->levels[report->depth].index = index;
+  report->levels[report->depth].num_items = 0;
+  report->levels[report->depth].array = array;
+
+  if (report->format == REPORT_JSON)
+    fputc(array ? '[' : '{', report->file);
+}
+
+static void end_level(struct report *report)
+{
+  bool array = report->levels[report->depth].array;
+  bool empty = report->levels[report->depth].num_items == 0;
+
+  assert(report->depth > 0);
+  report->depth--;
+
+  if (report->format == REPORT_JSON) {
+    if (!empty)
+      fprintf(report->file, "\n%*s", 2 * (int)(report->depth + 1), "");
+    fputc(array ? ']' : '}', report->file);
+  }
+}
+
+void report_begin(struct report *report, enum report_format format, FILE *file)
+{
+  assert(format != REPORT_TEXT);
+
+  report->format = format;
+  report->file = file;
+  report->depth = 0;
+  report->levels[0].name = NULL;
+  report->levels[0].index = 0;
+  report->levels[0].num_items = 0;
+  report->levels[0].array = false;
+
+  if (format == REPORT_JSON)
+    fputc('{', file);
+  else
+    fputs("path,key,value\n", file);
+}
+
+void report_end(struct report *report)
+{
+  assert(report->depth == 0);
+
+  if (report->format == REPORT_JSON)
+    fputs("\n}\n", report->file);
+  fflush(report->file);
+}
+
+void report_object_begin(struct report *report, const char *name)
+{
+  begin_level(report, name, false);
+}
+
+void report_object_end(struct report *report)
+{
+  end_level(report);
+}
+
+void report_array_begin(struct report *report, const char *name)
+{
+  begin_level(report, name, true);
+}
+
+void report_array_end(struct report *report)
+{
+  end_level(report);
+}
+
+void report_u64(struct report *report, const char *key, uint64_t value)
+{
+  begin_value(report, key);
+  fprintf(report->file, "%" PRIu64, value);
+  end_value(report);
+}
+
+void report_i64(struct report *report, const char *key, int64_t value)
+{
+  begin_value(report, key);
+  fprintf(report->file, "%" PRId64, value);
+  end_value(report);
+}
+
+void report_double(struct report *report, const char *key, double value)
+{
+  begin_value(report, key);
+  if (isfinite(value))
+    fprintf(report->file, "%.3lf", value);
+  else if (report->format == REPORT_JSON)
+    fputs("null", report->file);
+  end_value(report);
+}
+
+void report_bool(struct report *report, const char *key, bool value)
+{
+  begin_value(report, key);
+  fputs(value ? "true" : "false", report->file);
+  end_value(report);
+}
+
+void report_str(struct report *report, const char *key, const char *value)
+{
+  begin_value(report, key);
+  if (report->format == REPORT_JSON)
+    write_json_str(report->file, value);
+  else
+    write_csv_str(report->file, value);
+  end_value(report);
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2020 Patryk Stefanski
+ *
+ * Licensed under the Apache License, Version 2.0, <LICENSE-APACHE or
+ * http://apache.org/licenses/LICENSE-2.0> or the MIT license <LICENSE-MIT or
+ * http://opensource.org/licenses/MIT>, at your option. This file may not be
+ * copied, modified, or distributed except according to those terms.
+ */
+
+#ifndef ASYNC_BENCH_REPORT_H
+#define ASYNC_BENCH_REPORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define REPORT_MAX_DEPTH 8
+
+enum report_format {
+  REPORT_TEXT,
+  REPORT_JSON,
+  REPORT_CSV,
+};
+
+/*
+ * Writer of machine-readable results. The results are a tree of objects and arrays, written either
+ * as one JSON document or as CSV rows of path,key,value, where path names the enclosing objects
+ * separated by dots (array elements by their index) and key is the index in an array of values.
+ * Text output is written by the tools themselves.
+ */
+struct report {
+  enum report_format format;
+  FILE *file;
+
+  /* The enclosing objects and arrays, the root object is the level 0. */
+  struct report_level {
+    const char *name;
+    size_t index;
+    size_t num_items;
+    bool array;
+  } levels[REPORT_MAX_DEPTH];
+  size_t depth;
+};
+
+/* Parses text, json or csv. Returns false if the name is unknown. */
+bool report_parse_format(const char *name, enum report_format *format);
+
+/* Starts the root object. The format must not be REPORT_TEXT. */
+void report_begin(struct report *report, enum report_format format, FILE *file);
+
+/* Ends the root object. */
+void report_end(struct report *report);
+
+/* Starts and ends nested objects and arrays. The name must be NULL for the elements of an array. */
+void report_object_begin(struct report *report, const char *name);
+void report_object_end(struct report *report);
+void report_array_begin(struct report *report, const char *name);
+void report_array_end(struct report *report);
+
+/* Writes a value. The key must be NULL for the elements of an array. */
+void report_u64(struct report *report, const char *key, uint64_t value);
+void report_i64(struct report *report, const char *key, int64_t value);
+void report_double(struct report *report, const char *key, double value);
+void report_bool(struct report *report, const char *key, bool value);
+void report_str(struct report *report, const char *key, const char *value);
+
+#endif
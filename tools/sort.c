@@ -0,0 +1,90 @@
+/*
+ * Copyright 2020 Patryk Stefanski
+ *
+ * Licensed under the Apache License, Version 2.0, <LICENSE-APACHE or
+ * http://apache.org/licenses/LICENSE-2.0> or the MIT license <LICENSE-MIT or
+ * http://opensource.org/licenses/MIT>, at your option. This file may not be
+ * copied, modified, or distributed except according to those terms.
+ */
+
+#include "sort.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DIGIT_BITS 8
+#define NUM_DIGITS (64 / DIGIT_BITS)
+#define RADIX (1 << DIGIT_BITS)
+
+static int cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+void sort_u64(uint64_t *values, size_t n)
+{
+  static __thread size_t counts[NUM_DIGITS][RADIX];
+  uint64_t *src = values, *dst;
+
+  if (n < 2)
+    return;
+
+  dst = malloc(n * sizeof(*dst));
+  if (dst == NULL) {
+    qsort(values, n, sizeof(*values), cmp_u64);
+    return;
+  }
+
+  /* Count the digits of all passes at once. */
+  memset(counts, 0, sizeof(counts));
+  for (size_t i = 0; i < n; i++) {
+    uint64_t value = values[i];
+    for (size_t d = 0; d < NUM_DIGITS; d++)
+      counts[d][(value >> (d * DIGIT_BITS)) & (RADIX - 1)]++;
+  }
+
+  for (size_t d = 0; d < NUM_DIGITS; d++) {
+    unsigned shift = (unsigned)(d * DIGIT_BITS);
+    size_t *offsets = counts[d], offset = 0;
+    uint64_t *tmp;
+
+    /* The pass would not move anything. */
+    if (offsets[(src[0] >> shift) & (RADIX - 1)] == n)
+      continue;
+
+    for (size_t i = 0; i < RADIX; i++) {
+      size_t count = offsets[i];
+      offsets[i] = offset;
+      offset += count;
+    }
+    for (size_t i = 0; i < n; i++)
+      dst[offsets[(src[i] >> shift) & (RADIX - 1)]++] = src[i];
+
+    tmp = src;
+    src = dst;
+    dst = tmp;
+  }
+
+  if (src != values) {
+    memcpy(values, src, n * sizeof(*values));
+    dst = src;
+  }
+  free(dst);
+}
+
+size_t sort_count_at_most(const uint64_t *values, size_t n, uint64_t value)
+{
+  size_t lo = 0, hi = n;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (values[mid] <= value)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
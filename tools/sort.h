@@ -0,0 +1,26 @@
+/*
+ * Copyright 2020 Patryk Stefanski
+ *
+ * Licensed under the Apache License, Version 2.0, <LICENSE-APACHE or
+ * http://apache.org/licenses/LICENSE-2.0> or the MIT license <LICENSE-MIT or
+ * http://opensource.org/licenses/MIT>, at your option. This file may not be
+ * copied, modified, or distributed except according to those terms.
+ */
+
+#ifndef ASYNC_BENCH_SORT_H
+#define ASYNC_BENCH_SORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Sorts values in ascending order with an LSD radix sort of 8-bit digits. The digits that are the
+ * same in all values are skipped, so latencies, which fit into a few bytes, take a few passes.
+ * Falls back to qsort() if allocating the scratch buffer of n values fails.
+ */
+void sort_u64(uint64_t *values, size_t n);
+
+/* Returns the number of values at most value in a sorted array. */
+size_t sort_count_at_most(const uint64_t *values, size_t n, uint64_t value);
+
+#endif
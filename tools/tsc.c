@@ -0,0 +1,98 @@
+/*
+ * Copyright 2020 Patryk Stefanski
+ *
+ * Licensed under the Apache License, Version 2.0, <LICENSE-APACHE or
+ * http://apache.org/licenses/LICENSE-2.0> or the MIT license <LICENSE-MIT or
+ * http://opensource.org/licenses/MIT>, at your option. This file may not be
+ * copied, modified, or distributed except according to those terms.
+ */
+
+#include "tsc.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#define NUM_SAMPLES 16
+
+static bool tsc_is_invariant(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned eax, ebx, ecx, edx;
+
+  /* Advanced power management information, EDX bit 8 is the invariant TSC. */
+  if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0)
+    return false;
+  return (edx & (1U << 8)) != 0;
+#else
+  return false;
+#endif
+}
+
+static uint64_t monotonic_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 * 1000 * 1000 + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Reads both clocks at about the same time. Of several attempts, the one with the shortest window
+ * between the two TSC reads around clock_gettime() is taken, so that preemptions are left out.
+ */
+static void sample(uint64_t *tsc, uint64_t *ns)
+{
+  uint64_t best_window = UINT64_MAX;
+
+  *tsc = 0;
+  *ns = 0;
+  for (int i = 0; i < NUM_SAMPLES; i++) {
+    uint64_t before = tsc_read(), cur_ns = monotonic_ns(), after = tsc_read();
+
+    if (after - before < best_window) {
+      best_window = after - before;
+      *tsc = before + (after - before) / 2;
+      *ns = cur_ns;
+    }
+  }
+}
+
+bool tsc_calibrate(struct tsc_clock *clock, uint32_t period_ms)
+{
+  const struct timespec period = {
+      .tv_sec = period_ms / 1000,
+      .tv_nsec = (long)(period_ms % 1000) * 1000 * 1000,
+  };
+  uint64_t start_tsc, start_ns, end_tsc, end_ns;
+
+  if (!tsc_is_invariant())
+    return false;
+
+  sample(&start_tsc, &start_ns);
+  nanosleep(&period, /*rem=*/NULL);
+  sample(&end_tsc, &end_ns);
+
+  if (end_tsc <= start_tsc || end_ns <= start_ns)
+    return false;
+
+  clock->base_tsc = end_tsc;
+  clock->base_ns = end_ns;
+  clock->mult = (uint64_t)(((unsigned __int128)(end_ns - start_ns) << 32) / (end_tsc - start_tsc));
+  return clock->mult != 0;
+}
+
+double tsc_ghz(const struct tsc_clock *clock) { return 4294967296.0 / (double)clock->mult; }
+
+int64_t tsc_drift(const struct tsc_clock *clock, uint64_t *elapsed_ns)
+{
+  uint64_t tsc, ns, tsc_ns;
+
+  sample(&tsc, &ns);
+  tsc_ns = clock->base_ns + tsc_ticks_to_ns(clock, tsc - clock->base_tsc);
+  *elapsed_ns = ns - clock->base_ns;
+  return (int64_t)(tsc_ns - ns);
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2020 Patryk Stefanski
+ *
+ * Licensed under the Apache License, Version 2.0, <LICENSE-APACHE or
+ * http://apache.org/licenses/LICENSE-2.0> or the MIT license <LICENSE-MIT or
+ * http://opensource.org/licenses/MIT>, at your option. This file may not be
+ * copied, modified, or distributed except according to those terms.
+ */
+
+#ifndef ASYNC_BENCH_TSC_H
+#define ASYNC_BENCH_TSC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * Nanosecond clock based on the invariant TSC, read without entering the vDSO. It is calibrated
+ * against CLOCK_MONOTONIC and continues its timeline, so its readings can be compared with those of
+ * CLOCK_MONOTONIC as long as the two do not drift apart.
+ */
+struct tsc_clock {
+  /* Reading of the TSC and CLOCK_MONOTONIC at the end of the calibration. */
+  uint64_t base_tsc;
+  uint64_t base_ns;
+
+  /* Nanoseconds per tick as a 32.32 fixed-point number. */
+  uint64_t mult;
+};
+
+/*
+ * Calibrates the clock over the given number of milliseconds. Returns false if the TSC is not
+ * invariant (its rate changes with frequency scaling or it stops in deep sleep states) or the CPU
+ * has none, then CLOCK_MONOTONIC should be used instead.
+ */
+bool tsc_calibrate(struct tsc_clock *clock, uint32_t period_ms);
+
+/* Returns the frequency of the TSC in GHz. */
+double tsc_ghz(const struct tsc_clock *clock);
+
+/*
+ * Returns by how many nanoseconds the clock is ahead of CLOCK_MONOTONIC now. Stored in *elapsed_ns
+ * is the time since the calibration.
+ */
+int64_t tsc_drift(const struct tsc_clock *clock, uint64_t *elapsed_ns);
+
+__attribute__((always_inline)) static inline uint64_t tsc_read(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  /* Do not let the read move before the preceding loads, as the kernel does. */
+  _mm_lfence();
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+__attribute__((always_inline)) static inline uint64_t tsc_ticks_to_ns(const struct tsc_clock *clock,
+                                                                      uint64_t ticks)
+{
+  return (uint64_t)(((unsigned __int128)ticks * clock->mult) >> 32);
+}
+
+__attribute__((always_inline)) static inline uint64_t tsc_now_ns(const struct tsc_clock *clock)
+{
+  return clock->base_ns + tsc_ticks_to_ns(clock, tsc_read() - clock->base_tsc);
+}
+
+#endif
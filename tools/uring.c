@@ -0,0 +1,231 @@
+/*
+ * Copyright 2020 Patryk Stefanski
+ *
+ * Licensed under the Apache License, Version 2.0, <LICENSE-APACHE or
+ * http://apache.org/licenses/LICENSE-2.0> or the MIT license <LICENSE-MIT or
+ * http://opensource.org/licenses/MIT>, at your option. This file may not be
+ * copied, modified, or distributed except according to those terms.
+ */
+
+#include "uring.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+                              const void *arg, size_t argsz)
+{
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args)
+{
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(struct uring *ring, unsigned entries, unsigned cq_entries, unsigned flags)
+{
+  struct io_uring_params params;
+  void *sqes;
+  unsigned *sq_array;
+  int fd, err;
+
+  memset(&params, 0, sizeof(params));
+  params.flags = flags;
+  if (cq_entries != 0) {
+    /* Clamp to the kernel maximum rather than fail, overflowed completions are kept anyway. */
+    params.flags |= IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+    params.cq_entries = cq_entries;
+  }
+
+  fd = sys_io_uring_setup(entries, &params);
+  if (fd < 0)
+    return -errno;
+
+  ring->fd = fd;
+
+  ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                      IORING_OFF_SQ_RING);
+  if (ring->sq_ptr == MAP_FAILED) {
+    err = -errno;
+    goto out_close;
+  }
+
+  ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                      IORING_OFF_CQ_RING);
+  if (ring->cq_ptr == MAP_FAILED) {
+    err = -errno;
+    goto out_unmap_sq;
+  }
+
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+              IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    err = -errno;
+    goto out_unmap_cq;
+  }
+
+  ring->sq_khead = (unsigned *)((char *)ring->sq_ptr + params.sq_off.head);
+  ring->sq_ktail = (unsigned *)((char *)ring->sq_ptr + params.sq_off.tail);
+  ring->sq_mask = *(unsigned *)((char *)ring->sq_ptr + params.sq_off.ring_mask);
+  ring->sq_entries = params.sq_entries;
+  ring->sq_tail = *ring->sq_ktail;
+  ring->sq_submitted = ring->sq_tail;
+  ring->sqes = sqes;
+
+  /* SQEs are always used in order, so the indirection array can be set up once. */
+  sq_array = (unsigned *)((char *)ring->sq_ptr + params.sq_off.array);
+  for (unsigned i = 0; i < params.sq_entries; i++)
+    sq_array[i] = i;
+
+  ring->cq_khead = (unsigned *)((char *)ring->cq_ptr + params.cq_off.head);
+  ring->cq_ktail = (unsigned *)((char *)ring->cq_ptr + params.cq_off.tail);
+  ring->cq_mask = *(unsigned *)((char *)ring->cq_ptr + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ptr + params.cq_off.cqes);
+
+  return 0;
+
+out_unmap_cq:
+  munmap(ring->cq_ptr, ring->cq_size);
+
+out_unmap_sq:
+  munmap(ring->sq_ptr, ring->sq_size);
+
+out_close:
+  close(fd);
+  return err;
+}
+
+void uring_destroy(struct uring *ring)
+{
+  munmap(ring->sqes, ring->sqes_size);
+  munmap(ring->cq_ptr, ring->cq_size);
+  munmap(ring->sq_ptr, ring->sq_size);
+  close(ring->fd);
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *ring)
+{
+  struct io_uring_sqe *sqe;
+
+  while (ring->sq_tail - __atomic_load_n(ring->sq_khead, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+    int ret = uring_submit_and_wait(ring, 0);
+    if (ret < 0 && ret != -EAGAIN && ret != -EBUSY)
+      return NULL;
+  }
+
+  sqe = &ring->sqes[ring->sq_tail & ring->sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  ring->sq_tail++;
+  return sqe;
+}
+
+int uring_submit_and_wait(struct uring *ring, unsigned wait_nr)
+{
+  return uring_submit_and_wait_timeout(ring, wait_nr, NULL);
+}
+
+int uring_submit_and_wait_timeout(struct uring *ring, unsigned wait_nr, const struct timespec *ts)
+{
+  unsigned to_submit = ring->sq_tail - ring->sq_submitted;
+  unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+  struct __kernel_timespec kts;
+  struct io_uring_getevents_arg arg;
+  const void *argp = NULL;
+  size_t argsz = 0;
+  int ret;
+
+  __atomic_store_n(ring->sq_ktail, ring->sq_tail, __ATOMIC_RELEASE);
+
+  if (ts != NULL && wait_nr > 0) {
+    kts.tv_sec = ts->tv_sec;
+    kts.tv_nsec = ts->tv_nsec;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t)&kts;
+    flags |= IORING_ENTER_EXT_ARG;
+    argp = &arg;
+    argsz = sizeof(arg);
+  }
+
+  do {
+    ret = sys_io_uring_enter(ring->fd, to_submit, wait_nr, flags, argp, argsz);
+  } while (ret < 0 && errno == EINTR);
+
+  if (ret < 0)
+    return errno == ETIME ? 0 : -errno;
+
+  ring->sq_submitted += (unsigned)ret;
+  return ret;
+}
+
+int uring_register_files(struct uring *ring, const int *fds, unsigned num_fds)
+{
+  if (sys_io_uring_register(ring->fd, IORING_REGISTER_FILES, fds, num_fds) < 0)
+    return -errno;
+  return 0;
+}
+
+int uring_register_buffers(struct uring *ring, const struct iovec *iovecs, unsigned num_iovecs)
+{
+  if (sys_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS, iovecs, num_iovecs) < 0)
+    return -errno;
+  return 0;
+}
+
+int uring_buf_ring_init(struct uring *ring, struct uring_buf_ring *buf_ring, uint16_t bgid,
+                        uint16_t entries, uint32_t buf_size)
+{
+  struct io_uring_buf_reg reg;
+  size_t bufs_size;
+  void *ptr;
+
+  /* The ring and the buffers share one mapping, the ring must be page-aligned. */
+  bufs_size = (size_t)entries * buf_size;
+  buf_ring->ring_size = (size_t)entries * sizeof(struct io_uring_buf) + bufs_size;
+  ptr = mmap(NULL, buf_ring->ring_size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (ptr == MAP_FAILED)
+    return -errno;
+
+  buf_ring->br = ptr;
+  buf_ring->bufs = (char *)ptr + (size_t)entries * sizeof(struct io_uring_buf);
+  buf_ring->buf_size = buf_size;
+  buf_ring->entries = entries;
+  buf_ring->tail = 0;
+
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)buf_ring->br;
+  reg.ring_entries = entries;
+  reg.bgid = bgid;
+  if (sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    int err = -errno;
+    munmap(ptr, buf_ring->ring_size);
+    return err;
+  }
+
+  for (uint32_t i = 0; i < entries; i++)
+    uring_buf_ring_recycle(buf_ring, (uint16_t)i);
+
+  return 0;
+}
+
+void uring_buf_ring_destroy(struct uring_buf_ring *buf_ring)
+{
+  munmap(buf_ring->br, buf_ring->ring_size);
+}
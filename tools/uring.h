@@ -0,0 +1,154 @@
+/*
+ * Copyright 2020 Patryk Stefanski
+ *
+ * Licensed under the Apache License, Version 2.0, <LICENSE-APACHE or
+ * http://apache.org/licenses/LICENSE-2.0> or the MIT license <LICENSE-MIT or
+ * http://opensource.org/licenses/MIT>, at your option. This file may not be
+ * copied, modified, or distributed except according to those terms.
+ */
+
+#ifndef ASYNC_BENCH_URING_H
+#define ASYNC_BENCH_URING_H
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+
+/*
+ * A minimal io_uring wrapper, only what the load generators need. It talks to the kernel directly,
+ * so that the tools do not depend on liburing. The ring must be used by one thread only.
+ */
+struct uring {
+  int fd;
+
+  /* Submission queue. */
+  unsigned *sq_khead;
+  unsigned *sq_ktail;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned sq_tail;
+  unsigned sq_submitted;
+  struct io_uring_sqe *sqes;
+
+  /* Completion queue. */
+  unsigned *cq_khead;
+  unsigned *cq_ktail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+
+  /* Mappings. */
+  void *sq_ptr;
+  size_t sq_size;
+  void *cq_ptr;
+  size_t cq_size;
+  size_t sqes_size;
+};
+
+/* Ring of provided buffers of a fixed size, which the kernel selects buffers from. */
+struct uring_buf_ring {
+  struct io_uring_buf_ring *br;
+  char *bufs;
+  size_t ring_size;
+  uint32_t buf_size;
+  uint16_t entries;
+  uint16_t tail;
+};
+
+/*
+ * Creates a ring with at least the given number of SQ entries and cq_entries CQ entries (0 for
+ * the kernel default), at most the kernel maximum of CQ entries. Returns 0 on success or a
+ * negative error code.
+ */
+int uring_init(struct uring *ring, unsigned entries, unsigned cq_entries, unsigned flags);
+
+void uring_destroy(struct uring *ring);
+
+/* Returns a cleared SQE, submitting the queued ones first if the SQ is full. */
+struct io_uring_sqe *uring_get_sqe(struct uring *ring);
+
+/*
+ * Submits all queued SQEs and waits for at least wait_nr completions. Returns the number of
+ * submitted SQEs or a negative error code.
+ */
+int uring_submit_and_wait(struct uring *ring, unsigned wait_nr);
+
+/*
+ * Like uring_submit_and_wait(), but waits at most the given relative timeout (if not NULL). An
+ * expired timeout is not an error.
+ */
+int uring_submit_and_wait_timeout(struct uring *ring, unsigned wait_nr, const struct timespec *ts);
+
+int uring_register_files(struct uring *ring, const int *fds, unsigned num_fds);
+
+int uring_register_buffers(struct uring *ring, const struct iovec *iovecs, unsigned num_iovecs);
+
+/*
+ * Registers a ring of the given number of buffers (a power of two) of buf_size bytes each in the
+ * buffer group bgid and provides all the buffers. Returns 0 on success or a negative error code.
+ */
+int uring_buf_ring_init(struct uring *ring, struct uring_buf_ring *buf_ring, uint16_t bgid,
+                        uint16_t entries, uint32_t buf_size);
+
+void uring_buf_ring_destroy(struct uring_buf_ring *buf_ring);
+
+/* Completion queue iteration: for (head = uring_cq_head(); head != tail; head++) ... */
+
+static inline unsigned uring_cq_head(const struct uring *ring) { return *ring->cq_khead; }
+
+static inline unsigned uring_cq_tail(const struct uring *ring)
+{
+  return __atomic_load_n(ring->cq_ktail, __ATOMIC_ACQUIRE);
+}
+
+static inline struct io_uring_cqe *uring_cqe(const struct uring *ring, unsigned head)
+{
+  return &ring->cqes[head & ring->cq_mask];
+}
+
+static inline void uring_cq_advance(struct uring *ring, unsigned head)
+{
+  __atomic_store_n(ring->cq_khead, head, __ATOMIC_RELEASE);
+}
+
+/* Gives the buffer back to the kernel. */
+static inline void uring_buf_ring_recycle(struct uring_buf_ring *buf_ring, uint16_t bid)
+{
+  struct io_uring_buf *buf = &buf_ring->br->bufs[buf_ring->tail & (buf_ring->entries - 1)];
+
+  buf->addr = (uint64_t)(uintptr_t)(buf_ring->bufs + (size_t)bid * buf_ring->buf_size);
+  buf->len = buf_ring->buf_size;
+  buf->bid = bid;
+  buf_ring->tail++;
+  __atomic_store_n(&buf_ring->br->tail, buf_ring->tail, __ATOMIC_RELEASE);
+}
+
+/* SQE preparation. */
+
+static inline void uring_prep_recv_multishot(struct io_uring_sqe *sqe, int file_index,
+                                             uint16_t bgid, uint64_t user_data)
+{
+  sqe->opcode = IORING_OP_RECV;
+  sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->fd = file_index;
+  sqe->buf_group = bgid;
+  sqe->user_data = user_data;
+}
+
+static inline void uring_prep_write_fixed(struct io_uring_sqe *sqe, int file_index,
+                                          const void *buf, uint32_t len, uint16_t buf_index,
+                                          uint64_t user_data)
+{
+  sqe->opcode = IORING_OP_WRITE_FIXED;
+  sqe->flags = IOSQE_FIXED_FILE;
+  sqe->fd = file_index;
+  sqe->addr = (uint64_t)(uintptr_t)buf;
+  sqe->len = len;
+  sqe->buf_index = buf_index;
+  sqe->user_data = user_data;
+}
+
+#endif
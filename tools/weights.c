@@ -0,0 +1,187 @@
+/*
+ * Copyright 2020 Patryk Stefanski
+ *
+ * Licensed under the Apache License, Version 2.0, <LICENSE-APACHE or
+ * http://apache.org/licenses/LICENSE-2.0> or the MIT license <LICENSE-MIT or
+ * http://opensource.org/licenses/MIT>, at your option. This file may not be
+ * copied, modified, or distributed except according to those terms.
+ */
+
+#include "weights.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "report.h"
+
+/* A range of ranks [first, last) reported together. */
+struct group {
+  size_t first, last;
+  char label[48];
+};
+
+/* Enough for the decades of ranks of any size_t. */
+#define MAX_GROUPS 24
+
+bool weights_parse(struct weights *weights, const char *str)
+{
+  char rest;
+
+  memset(weights, 0, sizeof(*weights));
+  if (strcmp(str, "uniform") == 0) {
+    weights->kind = WEIGHTS_UNIFORM;
+    return true;
+  }
+  if (sscanf(str, "zipf:%lf%c", &weights->param, &rest) == 1 && weights->param >= 0) {
+    weights->kind = WEIGHTS_ZIPF;
+    return true;
+  }
+  if (sscanf(str, "hot:%lf%c", &weights->param, &rest) == 1 && weights->param > 0 &&
+      weights->param < 1) {
+    weights->kind = WEIGHTS_HOT;
+    return true;
+  }
+  return false;
+}
+
+void weights_init(struct weights *weights, size_t num_conns)
+{
+  weights->num_conns = num_conns;
+  weights->zipf_sum = 0;
+  if (weights->kind == WEIGHTS_ZIPF) {
+    for (size_t i = 0; i < num_conns; i++)
+      weights->zipf_sum += pow((double)(i + 1), -weights->param);
+  }
+}
+
+size_t weights_num_hot(const struct weights *weights)
+{
+  size_t num_hot;
+
+  if (weights->kind != WEIGHTS_HOT)
+    return 0;
+
+  /* At least one connection is hot. */
+  num_hot = (size_t)ceil(weights->param * (double)weights->num_conns);
+  return num_hot > weights->num_conns ? weights->num_conns : num_hot;
+}
+
+double weights_get(const struct weights *weights, size_t rank)
+{
+  switch (weights->kind) {
+  case WEIGHTS_ZIPF:
+    return (double)weights->num_conns * pow((double)(rank + 1), -weights->param) /
+           weights->zipf_sum;
+  case WEIGHTS_HOT:
+    return rank < weights_num_hot(weights) ? INFINITY : 1.0;
+  case WEIGHTS_UNIFORM:
+  default:
+    return 1.0;
+  }
+}
+
+static size_t make_groups(const struct weights *weights, struct group *groups)
+{
+  size_t num_conns = weights->num_conns, num_hot = weights_num_hot(weights), num_groups = 0;
+
+  if (num_hot != 0) {
+    groups[0] = (struct group){.first = 0, .last = num_hot, .label = "hot"};
+    groups[1] = (struct group){.first = num_hot, .last = num_conns, .label = "cold"};
+    return num_hot < num_conns ? 2 : 1;
+  }
+
+  for (size_t first = 0, last = 1; first < num_conns; first = last, last *= 10) {
+    struct group *group = &groups[num_groups++];
+
+    group->first = first;
+    group->last = last < num_conns ? last : num_conns;
+    if (group->last - group->first == 1)
+      snprintf(group->label, sizeof(group->label), "%zu", first + 1);
+    else
+      snprintf(group->label, sizeof(group->label), "%zu-%zu", first + 1, group->last);
+  }
+  return num_groups;
+}
+
+/* Sums the load of a group. The rate is per connection, each with its own time. */
+static void sum_group(const struct group *group, const struct conn_load *loads, uint64_t *num_reqs,
+                      double *rate)
+{
+  *num_reqs = 0;
+  *rate = 0;
+  for (size_t i = group->first; i < group->last; i++) {
+    *num_reqs += loads[i].num_reqs;
+    if (loads[i].time_ns != 0)
+      *rate += (double)loads[i].num_reqs * 1e9 / (double)loads[i].time_ns;
+  }
+  *rate /= (double)(group->last - group->first);
+}
+
+static uint64_t total_requests(const struct weights *weights, const struct conn_load *loads)
+{
+  uint64_t total = 0;
+
+  for (size_t i = 0; i < weights->num_conns; i++)
+    total += loads[i].num_reqs;
+  return total;
+}
+
+void weights_print_load(const struct weights *weights, const struct conn_load *loads)
+{
+  struct group groups[MAX_GROUPS];
+  size_t num_groups = make_groups(weights, groups);
+  uint64_t total = total_requests(weights, loads);
+
+  printf("\nConnection load:\n"
+         "  %-16s %8s %10s %12s %10s %20s\n",
+         "ranks", "conns", "weight", "requests", "share [%]", "rate/conn [req/s]");
+  for (size_t i = 0; i < num_groups; i++) {
+    const struct group *group = &groups[i];
+    uint64_t num_reqs;
+    double rate;
+
+    sum_group(group, loads, &num_reqs, &rate);
+    printf("  %-16s %8zu %10.3lf %12" PRIu64 " %10.2lf %20.2lf\n", group->label,
+           group->last - group->first, weights_get(weights, group->first), num_reqs,
+           total != 0 ? (double)num_reqs * 100 / (double)total : 0.0, rate);
+  }
+}
+
+void weights_report_load(const struct weights *weights, struct report *report,
+                         const struct conn_load *loads)
+{
+  struct group groups[MAX_GROUPS];
+  size_t num_groups = make_groups(weights, groups);
+
+  report_array_begin(report, "conn_groups");
+  for (size_t i = 0; i < num_groups; i++) {
+    const struct group *group = &groups[i];
+    uint64_t num_reqs;
+    double rate;
+
+    sum_group(group, loads, &num_reqs, &rate);
+    report_object_begin(report, /*name=*/NULL);
+    report_str(report, "ranks", group->label);
+    report_u64(report, "conns", group->last - group->first);
+    report_double(report, "weight", weights_get(weights, group->first));
+    report_u64(report, "requests", num_reqs);
+    report_double(report, "rate_per_conn", rate);
+    report_object_end(report);
+  }
+  report_array_end(report);
+
+  report_array_begin(report, "conns");
+  for (size_t i = 0; i < weights->num_conns; i++) {
+    report_object_begin(report, /*name=*/NULL);
+    report_double(report, "weight", weights_get(weights, i));
+    report_u64(report, "requests", loads[i].num_reqs);
+    report_u64(report, "time_ns", loads[i].time_ns);
+    report_object_end(report);
+  }
+  report_array_end(report);
+}
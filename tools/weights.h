@@ -0,0 +1,73 @@
+/*
+ * Copyright 2020 Patryk Stefanski
+ *
+ * Licensed under the Apache License, Version 2.0, <LICENSE-APACHE or
+ * http://apache.org/licenses/LICENSE-2.0> or the MIT license <LICENSE-MIT or
+ * http://opensource.org/licenses/MIT>, at your option. This file may not be
+ * copied, modified, or distributed except according to those terms.
+ */
+
+#ifndef ASYNC_BENCH_WEIGHTS_H
+#define ASYNC_BENCH_WEIGHTS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "report.h"
+
+enum weights_kind {
+  WEIGHTS_UNIFORM,
+  WEIGHTS_ZIPF,
+  WEIGHTS_HOT,
+};
+
+/*
+ * Distribution of the load over the connections of a tool. The connections are ranked from the
+ * heaviest one, rank 0, and the tools deal the ranks out to the workers in turn, so that the heavy
+ * connections are not all served by one worker.
+ */
+struct weights {
+  enum weights_kind kind;
+
+  /* Exponent of the Zipf distribution, or the share of hot connections. */
+  double param;
+
+  /* Number of connections, and the sum of the Zipf weights 1 / rank^param over them. */
+  size_t num_conns;
+  double zipf_sum;
+};
+
+/* Parses uniform, zipf:<EXPONENT> or hot:<SHARE>. Returns false if the string is malformed. */
+bool weights_parse(struct weights *weights, const char *str);
+
+/* Prepares the weights of num_conns connections. */
+void weights_init(struct weights *weights, size_t num_conns);
+
+/* Returns the number of hot connections, 0 unless the distribution is hot. */
+size_t weights_num_hot(const struct weights *weights);
+
+/*
+ * Returns the weight of the connection of the given rank. The weights of uniform and Zipf have a
+ * mean of 1, so they scale the request rate of a connection without changing the total. Hot
+ * connections have an infinite weight (no think time at all), the cold ones 1.
+ */
+double weights_get(const struct weights *weights, size_t rank);
+
+/* Requests answered on a connection and the time it took, the connections indexed by rank. */
+struct conn_load {
+  uint64_t num_reqs;
+  uint64_t time_ns;
+};
+
+/*
+ * Prints how the requests were spread over groups of connections: the hot and the cold ones, or
+ * otherwise the ranks 1, 2-10, 11-100 and so on.
+ */
+void weights_print_load(const struct weights *weights, const struct conn_load *loads);
+
+/* Writes the groups of weights_print_load() and the load of each connection. */
+void weights_report_load(const struct weights *weights, struct report *report,
+                         const struct conn_load *loads);
+
+#endif
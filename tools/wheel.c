@@ -0,0 +1,92 @@
+/*
+ * Copyright 2020 Patryk Stefanski
+ *
+ * Licensed under the Apache License, Version 2.0, <LICENSE-APACHE or
+ * http://apache.org/licenses/LICENSE-2.0> or the MIT license <LICENSE-MIT or
+ * http://opensource.org/licenses/MIT>, at your option. This file may not be
+ * copied, modified, or distributed except according to those terms.
+ */
+
+#include "wheel.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+bool wheel_init(struct wheel *wheel, uint32_t slots_log2, uint32_t tick_shift, uint64_t now_ns)
+{
+  size_t num_slots = (size_t)1 << slots_log2;
+
+  wheel->slots = calloc(num_slots, sizeof(*wheel->slots));
+  if (wheel->slots == NULL)
+    return false;
+
+  wheel->slot_mask = num_slots - 1;
+  wheel->tick_shift = tick_shift;
+  wheel->cur_tick = now_ns >> tick_shift;
+  wheel->num_timers = 0;
+  return true;
+}
+
+void wheel_destroy(struct wheel *wheel) { free(wheel->slots); }
+
+uint64_t wheel_next_deadline(const struct wheel *wheel)
+{
+  uint64_t num_slots = wheel->slot_mask + 1;
+
+  if (wheel->num_timers == 0)
+    return UINT64_MAX;
+
+  for (uint64_t tick = wheel->cur_tick; tick < wheel->cur_tick + num_slots; tick++) {
+    uint64_t min = UINT64_MAX;
+
+    /* Timers added with a deadline in the past are due in cur_tick too. */
+    for (struct wheel_timer *timer = wheel->slots[tick & wheel->slot_mask]; timer != NULL;
+         timer = timer->next) {
+      if ((timer->deadline_ns >> wheel->tick_shift) <= tick && timer->deadline_ns < min)
+        min = timer->deadline_ns;
+    }
+
+    if (min != UINT64_MAX)
+      return min;
+  }
+
+  return (wheel->cur_tick + num_slots) << wheel->tick_shift;
+}
+
+struct wheel_timer *wheel_expire(struct wheel *wheel, uint64_t now_ns)
+{
+  struct wheel_timer *expired = NULL;
+  uint64_t now_tick = now_ns >> wheel->tick_shift;
+  uint64_t end_tick = now_tick;
+
+  if (wheel->num_timers == 0) {
+    wheel->cur_tick = now_tick;
+    return NULL;
+  }
+
+  /* One rotation visits every slot. */
+  if (end_tick - wheel->cur_tick > wheel->slot_mask)
+    end_tick = wheel->cur_tick + wheel->slot_mask;
+
+  for (uint64_t tick = wheel->cur_tick; tick <= end_tick; tick++) {
+    struct wheel_timer **pp = &wheel->slots[tick & wheel->slot_mask];
+
+    while (*pp != NULL) {
+      struct wheel_timer *timer = *pp;
+      if (timer->deadline_ns <= now_ns) {
+        *pp = timer->next;
+        timer->next = expired;
+        expired = timer;
+        wheel->num_timers--;
+      } else {
+        pp = &timer->next;
+      }
+    }
+  }
+
+  /* The current tick can still have timers later than now_ns. */
+  wheel->cur_tick = now_tick;
+  return expired;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2020 Patryk Stefanski
+ *
+ * Licensed under the Apache License, Version 2.0, <LICENSE-APACHE or
+ * http://apache.org/licenses/LICENSE-2.0> or the MIT license <LICENSE-MIT or
+ * http://opensource.org/licenses/MIT>, at your option. This file may not be
+ * copied, modified, or distributed except according to those terms.
+ */
+
+#ifndef ASYNC_BENCH_WHEEL_H
+#define ASYNC_BENCH_WHEEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Hashed timer wheel. A timer with the deadline d is put into the slot (d >> tick_shift) modulo the
+ * number of slots, timers further than one rotation away stay in their slot and are skipped until
+ * their rotation comes. Deadlines are kept exactly, so the tick only affects the cost of the scans,
+ * not the precision. Adding a timer costs O(1) and no syscalls, the owner is expected to sleep
+ * until wheel_next_deadline() and then call wheel_expire().
+ */
+struct wheel_timer {
+  struct wheel_timer *next;
+  uint64_t deadline_ns;
+};
+
+struct wheel {
+  struct wheel_timer **slots;
+  uint64_t slot_mask;
+  uint32_t tick_shift;
+
+  /* All ticks before cur_tick have been expired. */
+  uint64_t cur_tick;
+
+  /* Number of pending timers. */
+  size_t num_timers;
+};
+
+/*
+ * Initializes a wheel with 2^slots_log2 slots, each covering 2^tick_shift nanoseconds. Returns
+ * false if allocating the slots failed.
+ */
+bool wheel_init(struct wheel *wheel, uint32_t slots_log2, uint32_t tick_shift, uint64_t now_ns);
+
+void wheel_destroy(struct wheel *wheel);
+
+__attribute__((always_inline)) static inline void wheel_add(struct wheel *wheel,
+                                                            struct wheel_timer *timer,
+                                                            uint64_t deadline_ns)
+{
+  uint64_t tick = deadline_ns >> wheel->tick_shift;
+  struct wheel_timer **slot;
+
+  if (tick < wheel->cur_tick)
+    tick = wheel->cur_tick;
+
+  slot = &wheel->slots[tick & wheel->slot_mask];
+  timer->deadline_ns = deadline_ns;
+  timer->next = *slot;
+  *slot = timer;
+  wheel->num_timers++;
+}
+
+/*
+ * Returns the earliest deadline or UINT64_MAX if there are no timers. If all timers are more than
+ * one rotation away, the start of the next rotation is returned instead.
+ */
+uint64_t wheel_next_deadline(const struct wheel *wheel);
+
+/*
+ * Removes all timers with deadlines not later than now_ns and returns them as a list linked with
+ * the next field, in no particular order.
+ */
+struct wheel_timer *wheel_expire(struct wheel *wheel, uint64_t now_ns);
+
+#endif